@@ -106,22 +106,31 @@ public:
 	void RenderStereoTargets();
 	void RenderCompanionWindow();
 	void RenderScene( vr::Hmd_Eye nEye );
+	void UpdateHudLayer();
+	void RenderHudLayer( vr::Hmd_Eye nEye );
 
 	Matrix4 GetHMDMatrixProjectionEye( vr::Hmd_Eye nEye );
 	Matrix4 GetHMDMatrixPoseEye( vr::Hmd_Eye nEye );
 	virtual Matrix4 GetRobotMatrixPose( std::string frame_name );
+	virtual void UpdateMarkerPoses();
+	void UpdateAssetInstances();
 	Matrix4 GetCurrentViewProjectionMatrix( vr::Hmd_Eye nEye );
 	virtual void UpdateHMDMatrixPose();
 
 	Matrix4 ConvertSteamVRMatrixToMatrix4( const vr::HmdMatrix34_t &matPose );
 
 	GLuint CompileGLShader( const char *pchShaderName, const char *pchVertexShader, const char *pchFragmentShader );
+	GLuint CompileGLShader( const char *pchShaderName, const char *pchVertexShader, const char *pchGeometryShader, const char *pchFragmentShader );
 	bool CreateAllShaders();
 
 	void SetupRenderModelForTrackedDevice( vr::TrackedDeviceIndex_t unTrackedDeviceIndex );
 	CGLRenderModel *FindOrLoadRenderModel( const char *pchRenderModelName );
 
 	unsigned int m_unPointSize;
+	float m_fLineWidth;
+	bool m_bHudText;        ///!< Draw text markers attached to the HMD into a cached HUD layer, instead of the world
+	float m_fMapAlpha;      ///!< Opacity of occupancy grids
+	float m_fCameraPlaneAlpha;  ///!< Opacity of camera images placed in the world
 	std::string m_strTextPath;
     std::string m_strActionManifestPath;
 	std::vector<Mesh*> robot_meshes;
@@ -238,12 +247,56 @@ protected:
     GLuint m_unRenderModelProgramID;
     GLuint m_unLitRGBModelProgramID;
     GLuint m_unLitModelProgramID;
+    GLuint m_unLitInstancedProgramID;
+    GLuint m_unMarkerPointsProgramID;
+    GLuint m_unThickLinesProgramID;
+    GLuint m_unTextProgramID;
+    GLuint m_unAssetInstancedProgramID;
+    GLuint m_unHudProgramID;
+    GLuint m_unOccupancyGridProgramID;
+    GLuint m_unHeightfieldProgramID;
+    GLuint m_unYUVProgramID;
+    GLuint m_unCameraPlaneProgramID;
 
 	GLint m_nSceneMatrixLocation;
 	GLint m_nControllerMatrixLocation;
     GLint m_nRenderModelMatrixLocation;
     GLint m_nLitRGBModelMatrixLocation;
     GLint m_nLitModelMatrixLocation;
+    GLint m_nLitInstancedMatrixLocation;
+    GLint m_nMarkerPointsMatrixLocation;
+    GLint m_nMarkerPointsScaleLocation;
+    GLint m_nThickLinesMatrixLocation;
+    GLint m_nThickLinesViewportLocation;
+    GLint m_nThickLinesWorldWidthLocation;
+    GLint m_nThickLinesMinWidthLocation;
+    GLint m_nTextMatrixLocation;
+    GLint m_nTextWorldLocation;
+    GLint m_nTextAnchorLocation;
+    GLint m_nTextRightLocation;
+    GLint m_nTextUpLocation;
+    GLint m_nTextColorLocation;
+    GLint m_nTextAtlasLocation;
+    GLint m_nAssetMatrixLocation;
+    GLint m_nAssetTexturedLocation;
+    GLint m_nAssetTextureLocation;
+    GLint m_nHudMatrixLocation;
+    GLint m_nHudExtentLocation;
+    GLint m_nHudTextureLocation;
+    GLint m_nOccupancyGridMatrixLocation;
+    GLint m_nOccupancyGridTextureLocation;
+    GLint m_nOccupancyGridAlphaLocation;
+    GLint m_nHeightfieldMatrixLocation;
+    GLint m_nHeightfieldWorldLocation;
+    GLint m_nHeightfieldTextureLocation;
+    GLint m_nHeightfieldOffsetLocation;
+    GLint m_nHeightfieldRangeLocation;
+    GLint m_nYUVLayoutLocation;
+    GLint m_nYUVRowsLocation;
+    GLint m_nYUVColorSpaceLocation;
+    GLint m_nCameraPlaneMatrixLocation;
+    GLint m_nCameraPlaneTextureLocation;
+    GLint m_nCameraPlaneAlphaLocation;
 
     GLuint m_WVPRGBLocation;
     GLuint m_WorldMatrixRGBLocation;
@@ -263,12 +316,17 @@ protected:
     GLuint m_numPointLightsLocation;
     GLuint m_numSpotLightsLocation;
 
+    GLuint m_WorldMatrixInstancedLocation;
+    GLuint m_eyeWorldPosInstancedLocation;
+    GLuint m_numPointLightsInstancedLocation;
+    GLuint m_numSpotLightsInstancedLocation;
+
     struct {
         GLuint Color;
         GLuint AmbientIntensity;
         GLuint DiffuseIntensity;
         GLuint Direction;
-    } m_dirLightLocation,m_dirLightRGBLocation;
+    } m_dirLightLocation,m_dirLightRGBLocation,m_dirLightInstancedLocation;
 
     struct {
         GLuint Color;
@@ -307,6 +365,18 @@ protected:
 	FramebufferDesc leftEyeDesc;
 	FramebufferDesc rightEyeDesc;
 
+	/// HUD text is drawn into this once whenever it changes, then shown as one quad per eye
+	GLuint m_unHudFramebuffer;
+	GLuint m_unHudTexture;
+	GLuint m_unHudVAO;
+	unsigned int m_nHudSize;
+	float m_fHudExtent[2];              ///!< Half size of the HUD quad, one unit in front of the head
+	bool m_bHudVisible;
+	std::vector<double> m_vecHudSignature;   ///!< What the layer was last drawn from, to tell when it changed
+
+	/// Markers using each MESH_RESOURCE asset this frame, already in the asset's instance buffer
+	std::map<AssetCache::Asset*, unsigned int> m_mapAssetInstanceCounts;
+
 	vr::VROverlayHandle_t m_ulOverlayHandle;
 
 	bool CreateFrameBuffer( int nWidth, int nHeight, FramebufferDesc &framebufferDesc );
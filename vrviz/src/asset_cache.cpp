@@ -0,0 +1,363 @@
+#include <cstring>
+#include <cstddef>
+#include <ros/ros.h>
+#include <ros/package.h>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+#include "asset_cache.h"
+#include "mesh.h"
+
+/// Same as Mesh uses, PreTransformVertices flattens the node hierarchy for us
+#define ASSET_LOAD_FLAGS (aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices | aiProcess_PreTransformVertices)
+
+AssetCache::AssetCache()
+    : m_stop(false)
+{
+}
+
+/// The GL objects are released in Clear(), while the GL context is still around
+AssetCache::~AssetCache()
+{
+}
+
+/*!
+ * \brief turn a package:// or file:// url into a plain path
+ * \return the path, or an empty string if the package couldn't be found
+ */
+std::string AssetCache::ResolvePath(const std::string& url)
+{
+    std::string path=url;
+    if (path.find("package://") == 0)
+    {
+        path.erase(0, strlen("package://"));
+        size_t pos = path.find("/");
+        if (pos == std::string::npos)
+        {
+            ROS_ERROR("Could not parse package:// format into file:// format");
+            return std::string();
+        }
+
+        std::string package = path.substr(0, pos);
+        path.erase(0, pos);
+        std::string package_path = ros::package::getPath(package);
+
+        if (package_path.empty())
+        {
+            ROS_ERROR("Package [%s] does not exist",package.c_str());
+            return std::string();
+        }
+
+        path = package_path + path;
+    }else if (path.find("file://") == 0){
+        path.erase(0, strlen("file://"));
+    }
+    return path;
+}
+
+/*!
+ * \brief check the up_axis of a Collada file
+ *
+ * Assimp doesn't load the 'units' or 'up_axis' attributes of Collada files
+ * https://github.com/assimp/assimp/issues/165
+ *
+ * \return true if the file says it is Z_UP
+ */
+bool AssetCache::ColladaZUp(const std::string& path)
+{
+    if(path.length()<4 || path.substr(path.length()-4,4)!=".dae"){
+        return false;
+    }
+    try{
+        boost::property_tree::ptree pt;
+        boost::property_tree::xml_parser::read_xml(path, pt );
+
+        boost::property_tree::ptree asset=pt.get_child("COLLADA").get_child("asset");
+
+        if( asset.count("up_axis") != 0 ){
+            std::string up_axis_str=asset.get<std::string>("up_axis");
+            if(up_axis_str=="Z_UP"){
+                return true;
+            }else if(up_axis_str!="Y_UP"){
+                ROS_WARN("up_axis unexpected! up_axis=%s",up_axis_str.c_str());
+            }
+        }
+    }catch(const boost::property_tree::ptree_error& e){
+        ROS_WARN("Could not read the Collada header of %s: %s",path.c_str(),e.what());
+    }
+    return false;
+}
+
+/*!
+ * \brief get the shared asset for a mesh url, starting the import if it's new
+ * \return the asset, check its state before drawing it. NULL if the url can't be resolved.
+ */
+AssetCache::Asset* AssetCache::Acquire(const std::string& url)
+{
+    std::string path=ResolvePath(url);
+    if(path.empty()){
+        return NULL;
+    }
+
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    std::map<std::string, Asset*>::iterator found=m_assets.find(path);
+    if(found!=m_assets.end()){
+        return found->second;
+    }
+
+    Asset* asset=new Asset;
+    asset->path=path;
+    asset->state=LOADING;
+    asset->Z_UP=false;
+    asset->InstanceVB=0;
+    asset->InstanceCapacity=0;
+    m_assets[path]=asset;
+    m_queue.push_back(asset);
+
+    /// Only start the worker once there's something for it to do
+    if(!m_thread.joinable()){
+        m_stop=false;
+        m_thread=boost::thread(&AssetCache::WorkerLoop,this);
+    }
+    m_queued.notify_one();
+    return asset;
+}
+
+void AssetCache::WorkerLoop()
+{
+    while(true){
+        Asset* asset;
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex);
+            while(!m_stop && m_queue.empty()){
+                m_queued.wait(lock);
+            }
+            if(m_stop){
+                return;
+            }
+            asset=m_queue.front();
+            m_queue.pop_front();
+        }
+        bool success=Import(asset);
+        asset->state = success ? IMPORTED : FAILED;
+    }
+}
+
+/*!
+ * \brief read the file with assimp, into CPU side submeshes (worker thread)
+ */
+bool AssetCache::Import(Asset* asset)
+{
+    Assimp::Importer Importer;
+    const aiScene* pScene = Importer.ReadFile(asset->path.c_str(), ASSET_LOAD_FLAGS);
+    if (!pScene) {
+        ROS_ERROR("Error parsing '%s': '%s'", asset->path.c_str(), Importer.GetErrorString());
+        return false;
+    }
+    asset->Z_UP=ColladaZUp(asset->path);
+
+    /// Textures can only be loaded on the render thread, so just remember the filenames
+    std::string::size_type SlashIndex = asset->path.find_last_of("/");
+    std::string Dir = (SlashIndex == std::string::npos) ? "." : asset->path.substr(0, SlashIndex);
+    std::vector<int> material_texture(pScene->mNumMaterials,-1);
+    for (unsigned int i = 0 ; i < pScene->mNumMaterials ; i++) {
+        aiString Path;
+        if (pScene->mMaterials[i]->GetTextureCount(aiTextureType_DIFFUSE) > 0 &&
+            pScene->mMaterials[i]->GetTexture(aiTextureType_DIFFUSE, 0, &Path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS) {
+            material_texture[i]=asset->texture_files.size();
+            asset->texture_files.push_back(Dir + "/" + Path.data);
+        }
+    }
+
+    asset->submeshes.resize(pScene->mNumMeshes);
+    for (unsigned int idx = 0 ; idx < pScene->mNumMeshes ; idx++) {
+        const aiMesh* paiMesh = pScene->mMeshes[idx];
+        SubMesh& sub=asset->submeshes[idx];
+        sub.NumIndices=0;
+        sub.InstanceVA=0;
+        sub.Texture = (paiMesh->mMaterialIndex < material_texture.size() && paiMesh->HasTextureCoords(0)) ? material_texture[paiMesh->mMaterialIndex] : -1;
+
+        /// Default to the material's diffuse color if there are no vertex colors
+        aiColor4D diffuse(1.0f,1.0f,1.0f,1.0f);
+        if(paiMesh->mMaterialIndex < pScene->mNumMaterials){
+            pScene->mMaterials[paiMesh->mMaterialIndex]->Get(AI_MATKEY_COLOR_DIFFUSE, diffuse);
+        }
+
+        sub.Vertices.resize(paiMesh->mNumVertices);
+        for (unsigned int i = 0 ; i < paiMesh->mNumVertices ; i++) {
+            aiVector3D pos = paiMesh->mVertices[i];
+            aiVector3D n = paiMesh->HasNormals() ? paiMesh->mNormals[i] : aiVector3D(0,0,1);
+            if(asset->Z_UP){
+                pos = aiVector3D(pos.x,-pos.z,pos.y);
+                n = aiVector3D(n.x,-n.z,n.y);
+            }
+            vr::RenderModel_Vertex_t_rgb& v=sub.Vertices[i];
+            v.vPosition.v[0]=pos.x;
+            v.vPosition.v[1]=pos.y;
+            v.vPosition.v[2]=pos.z;
+            v.vNormal.v[0]=n.x;
+            v.vNormal.v[1]=n.y;
+            v.vNormal.v[2]=n.z;
+            if(sub.Texture>=0){
+                v.vColor.v[0]=paiMesh->mTextureCoords[0][i].x;
+                v.vColor.v[1]=paiMesh->mTextureCoords[0][i].y;
+                v.vColor.v[2]=0;
+            }else if(paiMesh->HasVertexColors(0)){
+                v.vColor.v[0]=paiMesh->mColors[0][i].r;
+                v.vColor.v[1]=paiMesh->mColors[0][i].g;
+                v.vColor.v[2]=paiMesh->mColors[0][i].b;
+            }else{
+                v.vColor.v[0]=diffuse.r;
+                v.vColor.v[1]=diffuse.g;
+                v.vColor.v[2]=diffuse.b;
+            }
+        }
+
+        sub.Indices.reserve(paiMesh->mNumFaces*3);
+        for (unsigned int i = 0 ; i < paiMesh->mNumFaces ; i++) {
+            const aiFace& Face = paiMesh->mFaces[i];
+            if(Face.mNumIndices == 3){
+                sub.Indices.push_back(Face.mIndices[0]);
+                sub.Indices.push_back(Face.mIndices[1]);
+                sub.Indices.push_back(Face.mIndices[2]);
+            }
+        }
+    }
+    return true;
+}
+
+/*!
+ * \brief upload an asset that has finished importing
+ *
+ * Call once a frame from the render thread. Only one asset is uploaded per call, so
+ * a burst of new meshes is spread over several frames.
+ */
+void AssetCache::Update()
+{
+    Asset* asset=NULL;
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        for(std::map<std::string, Asset*>::iterator it=m_assets.begin();it!=m_assets.end();++it){
+            if(it->second->state==IMPORTED){
+                asset=it->second;
+                break;
+            }
+        }
+    }
+    if(!asset){
+        return;
+    }
+
+    glGenBuffers( 1, &asset->InstanceVB );
+    for(size_t idx=0;idx<asset->texture_files.size();idx++){
+        Texture* texture=new Texture(GL_TEXTURE_2D, asset->texture_files[idx]);
+        if(!texture->Load()){
+            ROS_ERROR("Error loading texture '%s'", asset->texture_files[idx].c_str());
+            delete texture;
+            texture=NULL;
+        }
+        asset->textures.push_back(texture);
+    }
+
+    for(size_t idx=0;idx<asset->submeshes.size();idx++){
+        SubMesh& sub=asset->submeshes[idx];
+        if(sub.Texture>=0 && !asset->textures[sub.Texture]){
+            /// Couldn't load it, so fall back to plain white
+            sub.Texture=-1;
+            for(size_t ii=0;ii<sub.Vertices.size();ii++){
+                sub.Vertices[ii].vColor.v[0]=sub.Vertices[ii].vColor.v[1]=sub.Vertices[ii].vColor.v[2]=1.0f;
+            }
+        }
+        if(sub.Indices.empty() || !Mesh::geometry_pool.Allocate(sub.Vertices.size(),sub.Indices.size(),sub.range)){
+            continue;
+        }
+        Mesh::geometry_pool.Upload(sub.range,sub.Vertices,sub.Indices);
+        sub.NumIndices=sub.Indices.size();
+
+        glGenVertexArrays( 1, &sub.InstanceVA );
+        glBindVertexArray( sub.InstanceVA );
+
+        glBindBuffer( GL_ARRAY_BUFFER, Mesh::geometry_pool.GetVertexBuffer(sub.range) );
+        glEnableVertexAttribArray( 0 );
+        glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vPosition ) );
+        glEnableVertexAttribArray( 1 );
+        glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vNormal ) );
+        glEnableVertexAttribArray( 2 );
+        glVertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vColor ) );
+
+        /// The transform takes four attribute slots, one per column
+        glBindBuffer( GL_ARRAY_BUFFER, asset->InstanceVB );
+        for(int col=0;col<4;col++){
+            glEnableVertexAttribArray( 3+col );
+            glVertexAttribPointer( 3+col, 4, GL_FLOAT, GL_FALSE, sizeof( Instance ), (void *)(offsetof( Instance, mat )+sizeof(float)*4*col) );
+            glVertexAttribDivisor( 3+col, 1 );
+        }
+        glEnableVertexAttribArray( 7 );
+        glVertexAttribPointer( 7, 4, GL_FLOAT, GL_FALSE, sizeof( Instance ), (void *)offsetof( Instance, color ) );
+        glVertexAttribDivisor( 7, 1 );
+
+        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, Mesh::geometry_pool.GetIndexBuffer(sub.range) );
+
+        glBindVertexArray( 0 );
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+        std::vector<vr::RenderModel_Vertex_t_rgb>().swap(sub.Vertices);
+        std::vector<u_int32_t>().swap(sub.Indices);
+    }
+    asset->state=READY;
+}
+
+/*!
+ * \brief fill the asset's instance buffer for this frame
+ */
+void AssetCache::UploadInstances(Asset* asset, const std::vector<Instance>& instances)
+{
+    if(instances.empty()){
+        return;
+    }
+    glBindBuffer( GL_ARRAY_BUFFER, asset->InstanceVB );
+    if(instances.size()>asset->InstanceCapacity){
+        /// Leave some room to grow, so a fleet that is still appearing doesn't reallocate every frame
+        asset->InstanceCapacity=instances.size()*2;
+        glBufferData( GL_ARRAY_BUFFER, sizeof( Instance ) * asset->InstanceCapacity, NULL, GL_STREAM_DRAW );
+    }
+    glBufferSubData( GL_ARRAY_BUFFER, 0, sizeof( Instance ) * instances.size(), &instances[0] );
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
+/*!
+ * \brief stop the worker and release everything
+ * \warning any Asset pointers handed out are invalid after this
+ */
+void AssetCache::Clear()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_stop=true;
+        m_queue.clear();
+    }
+    m_queued.notify_all();
+    if(m_thread.joinable()){
+        m_thread.join();
+    }
+
+    for(std::map<std::string, Asset*>::iterator it=m_assets.begin();it!=m_assets.end();++it){
+        Asset* asset=it->second;
+        for(size_t idx=0;idx<asset->submeshes.size();idx++){
+            if(asset->submeshes[idx].InstanceVA){
+                glDeleteVertexArrays( 1, &asset->submeshes[idx].InstanceVA );
+            }
+            Mesh::geometry_pool.Free(asset->submeshes[idx].range);
+        }
+        for(size_t idx=0;idx<asset->textures.size();idx++){
+            delete asset->textures[idx];
+        }
+        if(asset->InstanceVB){
+            glDeleteBuffers( 1, &asset->InstanceVB );
+        }
+        delete asset;
+    }
+    m_assets.clear();
+}
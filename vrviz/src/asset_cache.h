@@ -0,0 +1,79 @@
+#ifndef ASSET_CACHE_H
+#define	ASSET_CACHE_H
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+#include "geometry_pool.h"
+#include "texture.h"
+
+/*!
+ * \brief Imports mesh files (MESH_RESOURCE markers) once, and shares them
+ *
+ * Assets are keyed by their resolved path, so every marker pointing at the same file
+ * gets the same Asset. Files are imported with assimp on a worker thread, then
+ * uploaded into the GeometryPool on the render thread, one asset per frame. All the
+ * markers using an asset are drawn together with one instanced draw per submesh.
+ *
+ * To keep to one vertex format, textured submeshes keep their texture coordinate in
+ * vColor.xy, the same trick the text glyph runs use.
+ */
+class AssetCache
+{
+public:
+    enum State { LOADING, IMPORTED, READY, FAILED };
+
+    struct SubMesh {
+        PoolRange range;
+        unsigned int NumIndices;
+        int Texture;                ///!< Index into the asset's textures, or -1 to use vertex colors
+        GLuint InstanceVA;          ///!< The pool's buffers plus the asset's instance buffer
+        std::vector<vr::RenderModel_Vertex_t_rgb> Vertices; ///!< Only kept until uploaded
+        std::vector<u_int32_t> Indices;
+    };
+
+    /// One copy of an asset: where it goes, and what color it is
+    struct Instance {
+        float mat[16];              ///!< Asset to vr world transform, column-major
+        float color[4];             ///!< Marker color. Alpha of 0 means use the embedded materials instead
+    };
+
+    struct Asset {
+        std::string path;
+        volatile State state;
+        bool Z_UP;
+        std::vector<SubMesh> submeshes;
+        std::vector<std::string> texture_files;
+        std::vector<Texture*> textures;
+        GLuint InstanceVB;
+        unsigned int InstanceCapacity;
+    };
+
+    AssetCache();
+
+    ~AssetCache();
+
+    Asset* Acquire(const std::string& url);
+    void Update();
+    void UploadInstances(Asset* asset, const std::vector<Instance>& instances);
+    void Clear();
+
+    static std::string ResolvePath(const std::string& url);
+    static bool ColladaZUp(const std::string& path);
+
+private:
+    void WorkerLoop();
+    bool Import(Asset* asset);
+
+    boost::thread m_thread;
+    boost::mutex m_mutex;                   ///!< Protects m_assets, m_queue and m_stop
+    boost::condition_variable m_queued;
+    bool m_stop;
+    std::map<std::string, Asset*> m_assets; ///!< Resolved path -> asset
+    std::deque<Asset*> m_queue;             ///!< Waiting to be imported
+};
+
+
+#endif	/* ASSET_CACHE_H */
@@ -0,0 +1,240 @@
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include "camera_planes.h"
+
+/*!
+ * \param count                     cameras, each gets a layer of the texture array
+ * \param layer_width,layer_height  size of the layers in texels, or 0 to use the first image's
+ * \param distance                  ROS units, how far in front of each camera to put its image
+ */
+CameraPlanes::CameraPlanes(const std::string& name, unsigned int count, unsigned int layer_width, unsigned int layer_height, float distance)
+    : m_layerWidth(layer_width),
+      m_layerHeight(layer_height),
+      m_distance(distance),
+      m_readFramebuffer(0),
+      m_drawFramebuffer(0)
+{
+    for(unsigned int idx=0;idx<count;idx++){
+        m_cameras.push_back(new Camera);
+    }
+    mesh=new Mesh;
+    mesh->name=name;
+    mesh->frame_locked=true;
+    /// It goes in robot_meshes long before Allocate()
+    mesh->initialized=false;
+    mesh->needs_update=false;
+    mesh->m_Entries.resize(1);
+    mesh->m_Entries[0].MaterialIndex=CAMERA_PLANE;
+}
+
+/// The GL objects have to be freed by Release() first, on the render thread
+CameraPlanes::~CameraPlanes()
+{
+    for(unsigned int idx=0;idx<m_cameras.size();idx++){
+        delete m_cameras[idx];
+    }
+}
+
+/*!
+ * \brief the frame the camera's images are in, which is where its plane goes
+ */
+void CameraPlanes::SetFrame(unsigned int camera, const std::string& frame_id)
+{
+    boost::lock_guard<boost::mutex> lock(m_cameras[camera]->mutex);
+    m_cameras[camera]->frame_id=frame_id;
+}
+
+void CameraPlanes::SetInfo(unsigned int camera, const sensor_msgs::CameraInfo::ConstPtr& info)
+{
+    boost::lock_guard<boost::mutex> lock(m_cameras[camera]->mutex);
+    m_cameras[camera]->info=info;
+}
+
+std::string CameraPlanes::FrameId(unsigned int camera)
+{
+    boost::lock_guard<boost::mutex> lock(m_cameras[camera]->mutex);
+    return m_cameras[camera]->frame_id;
+}
+
+/*!
+ * \brief the texture array, the framebuffers to blit into it, and the instance buffer
+ * \param width,height  of the first image, for the layers if they weren't given a size
+ */
+void CameraPlanes::Allocate(unsigned int width, unsigned int height)
+{
+    Mesh::MeshEntry& entry=mesh->m_Entries[0];
+    if(m_layerWidth==0 || m_layerHeight==0){
+        m_layerWidth=width;
+        m_layerHeight=height;
+    }
+    GLint max_size=0;
+    glGetIntegerv( GL_MAX_TEXTURE_SIZE, &max_size );
+    if(m_layerWidth>(unsigned int)max_size || m_layerHeight>(unsigned int)max_size){
+        printf("Camera images of %ux%u texels are bigger than the biggest texture, scaling them to fit in %d\n",m_layerWidth,m_layerHeight,max_size);
+        m_layerWidth=std::min(m_layerWidth,(unsigned int)max_size);
+        m_layerHeight=std::min(m_layerHeight,(unsigned int)max_size);
+    }
+
+    glGenTextures( 1, &entry.DataTexture );
+    glBindTexture( GL_TEXTURE_2D_ARRAY, entry.DataTexture );
+    glTexImage3D( GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, m_layerWidth, m_layerHeight, m_cameras.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+    glGenerateMipmap( GL_TEXTURE_2D_ARRAY );
+    glBindTexture( GL_TEXTURE_2D_ARRAY, 0 );
+
+    glGenFramebuffers( 1, &m_readFramebuffer );
+    glGenFramebuffers( 1, &m_drawFramebuffer );
+    for(unsigned int idx=0;idx<m_cameras.size();idx++){
+        m_cameras[idx]->streamer.SetLayer(entry.DataTexture,idx,m_layerWidth,m_layerHeight);
+    }
+
+    /// No geometry, the corners come from gl_VertexID and everything else from the instance
+    glGenVertexArrays( 1, &entry.InstanceVA );
+    glGenBuffers( 1, &entry.InstanceVB );
+    glBindVertexArray( entry.InstanceVA );
+    glBindBuffer( GL_ARRAY_BUFFER, entry.InstanceVB );
+    entry.InstanceCapacity=m_cameras.size();
+    glBufferData( GL_ARRAY_BUFFER, sizeof( Instance ) * entry.InstanceCapacity, NULL, GL_DYNAMIC_DRAW );
+    for(int column=0;column<4;column++){
+        glEnableVertexAttribArray( column );
+        glVertexAttribPointer( column, 4, GL_FLOAT, GL_FALSE, sizeof( Instance ), (void *)( offsetof( Instance, pose ) + sizeof( float ) * 4 * column ) );
+        glVertexAttribDivisor( column, 1 );
+    }
+    glEnableVertexAttribArray( 4 );
+    glVertexAttribPointer( 4, 4, GL_FLOAT, GL_FALSE, sizeof( Instance ), (void *)offsetof( Instance, frustum ) );
+    glVertexAttribDivisor( 4, 1 );
+    /// Depth and layer
+    glEnableVertexAttribArray( 5 );
+    glVertexAttribPointer( 5, 2, GL_FLOAT, GL_FALSE, sizeof( Instance ), (void *)offsetof( Instance, depth ) );
+    glVertexAttribDivisor( 5, 1 );
+    glBindVertexArray( 0 );
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+    entry.NumIndices=4;
+    entry.NumInstances=0;
+    mesh->initialized=true;
+    mesh->needs_update=false;
+}
+
+/*!
+ * \brief start uploading each camera's newest image, straight into its layer if it can, otherwise copy it in
+ *
+ * The texture array is only allocated once the first image is in.
+ * \param yuv_program,yuv_layout_location,yuv_rows_location,yuv_color_space_location   the shader that converts YUV images
+ */
+void CameraPlanes::Update(GLuint yuv_program, GLint yuv_layout_location, GLint yuv_rows_location, GLint yuv_color_space_location)
+{
+    Mesh::MeshEntry& entry=mesh->m_Entries[0];
+    bool changed=false;
+    for(unsigned int idx=0;idx<m_cameras.size();idx++){
+        ImageStreamer& streamer=m_cameras[idx]->streamer;
+        if(!streamer.Update(yuv_program,yuv_layout_location,yuv_rows_location,yuv_color_space_location)){
+            continue;
+        }
+        if(entry.DataTexture==INVALID_OGL_VALUE){
+            /// Now there's an image to size the layers from. It went into the streamer's texture, so gets blitted
+            Allocate(streamer.Width(),streamer.Height());
+        }
+        m_cameras[idx]->shown=true;
+        changed=true;
+        if(streamer.InLayer()){
+            continue;
+        }
+        /// Scaled to fill the layer, the plane's shape comes from the intrinsics instead
+        glBindFramebuffer( GL_READ_FRAMEBUFFER, m_readFramebuffer );
+        glFramebufferTexture2D( GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, streamer.Texture(), 0 );
+        glBindFramebuffer( GL_DRAW_FRAMEBUFFER, m_drawFramebuffer );
+        glFramebufferTextureLayer( GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, entry.DataTexture, 0, idx );
+        glBlitFramebuffer( 0, 0, streamer.Width(), streamer.Height(), 0, 0, m_layerWidth, m_layerHeight,
+                           GL_COLOR_BUFFER_BIT, GL_LINEAR );
+    }
+    if(!changed){
+        return;
+    }
+    glBindFramebuffer( GL_READ_FRAMEBUFFER, 0 );
+    glBindFramebuffer( GL_DRAW_FRAMEBUFFER, 0 );
+
+    /// This does every layer, but only once however many cameras had a new image
+    glBindTexture( GL_TEXTURE_2D_ARRAY, entry.DataTexture );
+    glGenerateMipmap( GL_TEXTURE_2D_ARRAY );
+    glBindTexture( GL_TEXTURE_2D_ARRAY, 0 );
+}
+
+/*!
+ * \brief place every camera that has an image and a frame
+ * \param poses     each camera's frame_id in the mesh's frame_id, in vr units
+ */
+void CameraPlanes::SetPoses(const std::vector<Matrix4>& poses, float scaling_factor)
+{
+    Mesh::MeshEntry& entry=mesh->m_Entries[0];
+    if(entry.InstanceVA==INVALID_OGL_VALUE){
+        return;
+    }
+    m_instances.clear();
+    for(unsigned int idx=0;idx<m_cameras.size() && idx<poses.size();idx++){
+        Camera& camera=*m_cameras[idx];
+        if(!camera.shown){
+            continue;
+        }
+        sensor_msgs::CameraInfo::ConstPtr info;
+        {
+            boost::lock_guard<boost::mutex> lock(camera.mutex);
+            if(camera.frame_id.empty()){
+                continue;
+            }
+            info=camera.info;
+        }
+
+        /// Without intrinsics, a 90 degree field of view across the image
+        float width=camera.streamer.Width();
+        float height=camera.streamer.Height();
+        float fx=width/2, fy=width/2, cx=width/2, cy=height/2;
+        if(info && info->K[0]>0 && info->K[4]>0 && info->width>0 && info->height>0){
+            width=info->width;
+            height=info->height;
+            fx=info->K[0];
+            fy=info->K[4];
+            cx=info->K[2];
+            cy=info->K[5];
+        }
+
+        Instance instance;
+        memcpy(instance.pose,poses[idx].get(),sizeof(instance.pose));
+        instance.frustum[0]=-cx/fx;
+        instance.frustum[1]=-cy/fy;
+        instance.frustum[2]=(width-cx)/fx;
+        instance.frustum[3]=(height-cy)/fy;
+        instance.depth=m_distance*scaling_factor;
+        instance.layer=idx;
+        m_instances.push_back(instance);
+    }
+
+    entry.NumInstances=m_instances.size();
+    if(entry.NumInstances>0){
+        glBindBuffer( GL_ARRAY_BUFFER, entry.InstanceVB );
+        glBufferSubData( GL_ARRAY_BUFFER, 0, sizeof( Instance ) * entry.NumInstances, &m_instances[0] );
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    }
+}
+
+/*!
+ * \brief free the streamers and framebuffers. The mesh frees the texture array and instance buffer
+ */
+void CameraPlanes::Release()
+{
+    for(unsigned int idx=0;idx<m_cameras.size();idx++){
+        m_cameras[idx]->streamer.Release();
+        m_cameras[idx]->shown=false;
+    }
+    if(m_readFramebuffer){
+        glDeleteFramebuffers( 1, &m_readFramebuffer );
+        glDeleteFramebuffers( 1, &m_drawFramebuffer );
+        m_readFramebuffer=0;
+        m_drawFramebuffer=0;
+    }
+}
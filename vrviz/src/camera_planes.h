@@ -0,0 +1,81 @@
+#ifndef CAMERA_PLANES_H
+#define	CAMERA_PLANES_H
+
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+#include <sensor_msgs/CameraInfo.h>
+#include "image_streamer.h"
+#include "mesh.h"
+
+/*!
+ * \brief Camera images drawn in the world, each across the view of the camera it came from
+ *
+ * Every camera gets a quad at plane_distance in front of it, in its image's frame_id (the
+ * optical frame: z forward, x right, y down). The corners come from the camera_info
+ * intrinsics, or a 90 degree field of view until there is one.
+ *
+ * All of the images are layers of one texture array, so however many cameras there are,
+ * they are instances of a single draw. The layers all have to be the same size, which is
+ * the size of the first image that comes in unless one is given. Each camera streams its
+ * images through its own ImageStreamer, from pixel buffers. An RGB image that is already
+ * the layer size, like every image from cameras of the same model, goes straight into its
+ * layer. Anything else goes into the streamer's own texture first, where YUV is converted
+ * on the GPU, and is then blitted into the layer, scaled to the layer size.
+ *
+ * The mesh is frame_locked to the base frame, and SetPoses() puts every camera in it once
+ * a frame.
+ *
+ * Streamer(), SetFrame() and SetInfo() are for the subscribers, the rest for the render thread.
+ */
+class CameraPlanes
+{
+public:
+    CameraPlanes(const std::string& name, unsigned int count, unsigned int layer_width, unsigned int layer_height, float distance);
+
+    ~CameraPlanes();
+
+    unsigned int Count() const { return m_cameras.size(); }
+    ImageStreamer& Streamer(unsigned int camera) { return m_cameras[camera]->streamer; }
+    void SetFrame(unsigned int camera, const std::string& frame_id);
+    void SetInfo(unsigned int camera, const sensor_msgs::CameraInfo::ConstPtr& info);
+    std::string FrameId(unsigned int camera);
+
+    void Update(GLuint yuv_program, GLint yuv_layout_location, GLint yuv_rows_location, GLint yuv_color_space_location);
+    void SetPoses(const std::vector<Matrix4>& poses, float scaling_factor);
+    void Release();
+
+    Mesh* mesh;                         ///!< Goes in robot_meshes, which owns it
+
+private:
+    struct Camera {
+        Camera() : streamer(false), shown(false) {}
+
+        ImageStreamer streamer;         ///!< Its texture only gets copied into the layer, so no mipmaps
+        boost::mutex mutex;             ///!< Protects frame_id and info
+        std::string frame_id;
+        sensor_msgs::CameraInfo::ConstPtr info;
+        bool shown;                     ///!< Its layer has had an image, render thread only
+    };
+
+    /// Per-instance data, the camera's pose and where the corners of its image are
+    struct Instance {
+        float pose[16];                 ///!< Camera frame to mesh->frame_id, column major
+        float frustum[4];               ///!< Left, top, right and bottom edges of the image, at a depth of one
+        float depth;                    ///!< How far in front of the camera, in vr units
+        float layer;
+    };
+
+    void Allocate(unsigned int width, unsigned int height);
+
+    std::vector<Camera*> m_cameras;
+    unsigned int m_layerWidth;          ///!< Size of every layer, in texels
+    unsigned int m_layerHeight;
+    float m_distance;                   ///!< ROS units, from the camera to its plane
+    GLuint m_readFramebuffer;           ///!< For blitting a camera's texture...
+    GLuint m_drawFramebuffer;           ///!< ...into its layer
+    std::vector<Instance> m_instances;
+};
+
+
+#endif	/* CAMERA_PLANES_H */
@@ -0,0 +1,235 @@
+#include <cstddef>
+#include <algorithm>
+#include "geometry_pool.h"
+
+/// Smallest range we hand out, so tiny markers don't fragment the free lists
+#define MIN_SIZE_CLASS 64
+
+GeometryPool::GeometryPool(unsigned int block_vertices, unsigned int block_indices)
+    : m_blockVertices(block_vertices),
+      m_blockIndices(block_indices)
+{
+}
+
+/*!
+ * \brief The GL objects are not released here, since the pool can outlive the GL context.
+ *        Call Clear() while the context is still current.
+ */
+GeometryPool::~GeometryPool()
+{
+}
+
+/*!
+ * \brief round a count up to the size class it will be allocated with
+ * \param count number of vertices or indices requested
+ * \return the next power of two, but at least MIN_SIZE_CLASS
+ */
+unsigned int GeometryPool::SizeClass(unsigned int count)
+{
+    unsigned int size_class=MIN_SIZE_CLASS;
+    while(size_class<count){
+        size_class<<=1;
+    }
+    return size_class;
+}
+
+int GeometryPool::AddBlock(unsigned int num_vertices, unsigned int num_indices)
+{
+    Block block;
+    block.num_vertices=num_vertices;
+    block.num_indices=num_indices;
+    block.vertex_top=0;
+    block.index_top=0;
+
+    // create and bind a VAO that draws straight out of the whole block
+    glGenVertexArrays( 1, &block.VA );
+    glBindVertexArray( block.VA );
+
+    // Reserve the storage, ranges get filled in later with glBufferSubData
+    glGenBuffers( 1, &block.VB );
+    glBindBuffer( GL_ARRAY_BUFFER, block.VB );
+    glBufferData( GL_ARRAY_BUFFER, sizeof( vr::RenderModel_Vertex_t_rgb ) * num_vertices, NULL, GL_DYNAMIC_DRAW );
+
+    // Identify the components in the vertex buffer
+    glEnableVertexAttribArray( 0 );
+    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vPosition ) );
+    glEnableVertexAttribArray( 1 );
+    glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vNormal ) );
+    glEnableVertexAttribArray( 2 );
+    glVertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vColor ) );
+
+    glGenBuffers( 1, &block.IB );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, block.IB );
+    glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof( u_int32_t ) * num_indices, NULL, GL_DYNAMIC_DRAW );
+
+    glBindVertexArray( 0 );
+
+    m_Blocks.push_back(block);
+    return m_Blocks.size()-1;
+}
+
+bool GeometryPool::TakeVertices(Block &block, unsigned int size_class, unsigned int &offset)
+{
+    std::vector<unsigned int> &free_list=block.free_vertices[size_class];
+    if(!free_list.empty()){
+        offset=free_list.back();
+        free_list.pop_back();
+        return true;
+    }
+    if(block.vertex_top+size_class<=block.num_vertices){
+        offset=block.vertex_top;
+        block.vertex_top+=size_class;
+        return true;
+    }
+    return false;
+}
+
+bool GeometryPool::TakeIndices(Block &block, unsigned int size_class, unsigned int &offset)
+{
+    std::vector<unsigned int> &free_list=block.free_indices[size_class];
+    if(!free_list.empty()){
+        offset=free_list.back();
+        free_list.pop_back();
+        return true;
+    }
+    if(block.index_top+size_class<=block.num_indices){
+        offset=block.index_top;
+        block.index_top+=size_class;
+        return true;
+    }
+    return false;
+}
+
+/*!
+ * \brief reserve space for some geometry
+ *
+ * Reuses a freed range of the same size class if one exists, otherwise carves a
+ * new range off the top of a block. Requests too large for a normal block get a
+ * dedicated block of their own.
+ *
+ * \param num_vertices  how many vertices are needed
+ * \param num_indices   how many indices are needed
+ * \param range         filled in with where the geometry should go
+ * \return success
+ */
+bool GeometryPool::Allocate(unsigned int num_vertices, unsigned int num_indices, PoolRange &range)
+{
+    unsigned int vertex_class=SizeClass(num_vertices);
+    unsigned int index_class=SizeClass(num_indices);
+
+    for(size_t idx=0;idx<m_Blocks.size();idx++){
+        Block &block=m_Blocks[idx];
+        unsigned int vertex_offset,index_offset;
+        if(!TakeVertices(block,vertex_class,vertex_offset)){
+            continue;
+        }
+        if(!TakeIndices(block,index_class,index_offset)){
+            /// Give the vertices back, we'll try the next block
+            block.free_vertices[vertex_class].push_back(vertex_offset);
+            continue;
+        }
+        range.block=idx;
+        range.vertex_offset=vertex_offset;
+        range.vertex_capacity=vertex_class;
+        range.index_offset=index_offset;
+        range.index_capacity=index_class;
+        return true;
+    }
+
+    /// Nothing had room, so make a new block (bigger than usual if needed)
+    int idx=AddBlock(std::max(m_blockVertices,vertex_class),std::max(m_blockIndices,index_class));
+    Block &block=m_Blocks[idx];
+    unsigned int vertex_offset,index_offset;
+    if(!TakeVertices(block,vertex_class,vertex_offset) || !TakeIndices(block,index_class,index_offset)){
+        return false;
+    }
+    range.block=idx;
+    range.vertex_offset=vertex_offset;
+    range.vertex_capacity=vertex_class;
+    range.index_offset=index_offset;
+    range.index_capacity=index_class;
+    return true;
+}
+
+/*!
+ * \brief can this geometry be rewritten in place?
+ * \return true if the range is allocated and has the same size classes as the new geometry
+ */
+bool GeometryPool::Fits(const PoolRange &range, unsigned int num_vertices, unsigned int num_indices) const
+{
+    return range.valid()
+            && SizeClass(num_vertices)==range.vertex_capacity
+            && SizeClass(num_indices)==range.index_capacity;
+}
+
+void GeometryPool::Upload(const PoolRange &range,
+                          const std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices,
+                          const std::vector<u_int32_t>& Indices)
+{
+    if(!range.valid()){
+        return;
+    }
+    const Block &block=m_Blocks[range.block];
+    /// Don't bind the VAO, since binding the IB would change its state
+    if(Vertices.size()>0){
+        glBindBuffer( GL_ARRAY_BUFFER, block.VB );
+        glBufferSubData( GL_ARRAY_BUFFER,
+                         sizeof( vr::RenderModel_Vertex_t_rgb ) * range.vertex_offset,
+                         sizeof( vr::RenderModel_Vertex_t_rgb ) * std::min<size_t>(Vertices.size(),range.vertex_capacity),
+                         &Vertices[0] );
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    }
+    if(Indices.size()>0){
+        glBindVertexArray( 0 );
+        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, block.IB );
+        glBufferSubData( GL_ELEMENT_ARRAY_BUFFER,
+                         sizeof( u_int32_t ) * range.index_offset,
+                         sizeof( u_int32_t ) * std::min<size_t>(Indices.size(),range.index_capacity),
+                         &Indices[0] );
+        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+    }
+}
+
+/*!
+ * \brief put a range back on the free lists and mark it unallocated
+ */
+void GeometryPool::Free(PoolRange &range)
+{
+    if(!range.valid() || range.block>=int(m_Blocks.size())){
+        range=PoolRange();
+        return;
+    }
+    Block &block=m_Blocks[range.block];
+    block.free_vertices[range.vertex_capacity].push_back(range.vertex_offset);
+    block.free_indices[range.index_capacity].push_back(range.index_offset);
+    range=PoolRange();
+}
+
+/*!
+ * \brief release all of the GL objects
+ * \warning any outstanding ranges are invalid after this
+ */
+void GeometryPool::Clear()
+{
+    for(size_t idx=0;idx<m_Blocks.size();idx++){
+        glDeleteVertexArrays( 1, &m_Blocks[idx].VA );
+        glDeleteBuffers( 1, &m_Blocks[idx].VB );
+        glDeleteBuffers( 1, &m_Blocks[idx].IB );
+    }
+    m_Blocks.clear();
+}
+
+GLuint GeometryPool::GetVAO(const PoolRange &range) const
+{
+    return range.valid() ? m_Blocks[range.block].VA : 0;
+}
+
+GLuint GeometryPool::GetVertexBuffer(const PoolRange &range) const
+{
+    return range.valid() ? m_Blocks[range.block].VB : 0;
+}
+
+GLuint GeometryPool::GetIndexBuffer(const PoolRange &range) const
+{
+    return range.valid() ? m_Blocks[range.block].IB : 0;
+}
@@ -0,0 +1,95 @@
+#ifndef GEOMETRY_POOL_H
+#define	GEOMETRY_POOL_H
+
+#include <map>
+#include <vector>
+#include <sys/types.h>
+#include <GL/glew.h>
+#include "openvr.h"
+
+namespace vr
+{
+/** A single vertex in a render model */
+struct RenderModel_Vertex_t_rgb
+{
+    HmdVector3_t vPosition;		// position in meters in device space
+    HmdVector3_t vNormal;
+    HmdVector3_t vColor;
+};
+}
+
+/*!
+ * \brief A range of vertices and indices suballocated out of a GeometryPool
+ *
+ * Indices stored in the range are relative to vertex_offset, so they are drawn
+ * with glDrawElementsBaseVertex and never need to be rewritten when moved.
+ */
+struct PoolRange
+{
+    PoolRange() : block(-1), vertex_offset(0), vertex_capacity(0), index_offset(0), index_capacity(0) {}
+
+    bool valid() const { return block>=0; }
+
+    int block;                      ///!< Which block of the pool this lives in, -1 if unallocated
+    unsigned int vertex_offset;     ///!< First vertex, counted from the start of the block
+    unsigned int vertex_capacity;   ///!< Number of vertices reserved (always a size class)
+    unsigned int index_offset;      ///!< First index, counted from the start of the block
+    unsigned int index_capacity;    ///!< Number of indices reserved (always a size class)
+};
+
+/*!
+ * \brief Suballocates marker geometry out of a few large shared GL buffers
+ *
+ * Every marker used to create (and leak) its own VAO, VBO and IBO each time it was
+ * updated. Instead, we carve vertex and index ranges out of big blocks, rounding
+ * each request up to a power of two "size class". Freed ranges go onto a free list
+ * per size class, so a marker that changes but stays in the same size class is
+ * just rewritten in place with glBufferSubData.
+ *
+ * \note All of the functions that touch GL must be called from the render thread.
+ */
+class GeometryPool
+{
+public:
+    GeometryPool(unsigned int block_vertices=1<<18, unsigned int block_indices=1<<19);
+
+    ~GeometryPool();
+
+    bool Allocate(unsigned int num_vertices, unsigned int num_indices, PoolRange &range);
+    bool Fits(const PoolRange &range, unsigned int num_vertices, unsigned int num_indices) const;
+    void Upload(const PoolRange &range,
+                const std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices,
+                const std::vector<u_int32_t>& Indices);
+    void Free(PoolRange &range);
+    void Clear();
+
+    GLuint GetVAO(const PoolRange &range) const;
+    GLuint GetVertexBuffer(const PoolRange &range) const;
+    GLuint GetIndexBuffer(const PoolRange &range) const;
+
+    static unsigned int SizeClass(unsigned int count);
+
+private:
+    struct Block {
+        GLuint VA;
+        GLuint VB;
+        GLuint IB;
+        unsigned int num_vertices;
+        unsigned int num_indices;
+        unsigned int vertex_top;    ///!< Everything above this has never been handed out
+        unsigned int index_top;
+        std::map<unsigned int, std::vector<unsigned int> > free_vertices; ///!< size class -> offsets
+        std::map<unsigned int, std::vector<unsigned int> > free_indices;  ///!< size class -> offsets
+    };
+
+    int AddBlock(unsigned int num_vertices, unsigned int num_indices);
+    bool TakeVertices(Block &block, unsigned int size_class, unsigned int &offset);
+    bool TakeIndices(Block &block, unsigned int size_class, unsigned int &offset);
+
+    unsigned int m_blockVertices;
+    unsigned int m_blockIndices;
+    std::vector<Block> m_Blocks;
+};
+
+
+#endif	/* GEOMETRY_POOL_H */
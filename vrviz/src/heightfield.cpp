@@ -0,0 +1,217 @@
+#include <cstdio>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "heightfield.h"
+
+Heightfield::Rect::Rect()
+    : x0(std::numeric_limits<long>::max()),
+      y0(std::numeric_limits<long>::max()),
+      x1(0),
+      y1(0)
+{
+}
+
+void Heightfield::Rect::Add(long x, long y)
+{
+    x0=std::min(x0,x);
+    y0=std::min(y0,y);
+    x1=std::max(x1,x+1);
+    y1=std::max(y1,y+1);
+}
+
+Heightfield::Heightfield(const std::string& name)
+    : m_width(0),
+      m_height(0)
+{
+    mesh=new Mesh;
+    mesh->name=name;
+    mesh->m_Entries.resize(1);
+    mesh->m_Entries[0].MaterialIndex=HEIGHTFIELD;
+}
+
+/*!
+ * \brief make the texture the right size, which starts it over with no data
+ * \return false if it is too big to be a texture
+ */
+bool Heightfield::Resize(unsigned int width, unsigned int height)
+{
+    Mesh::MeshEntry& entry=mesh->m_Entries[0];
+    if(width==m_width && height==m_height && entry.DataTexture!=INVALID_OGL_VALUE){
+        return true;
+    }
+    GLint max_size=0;
+    glGetIntegerv( GL_MAX_TEXTURE_SIZE, &max_size );
+    if(width==0 || height==0 || width>(unsigned int)max_size || height>(unsigned int)max_size){
+        printf("Can't draw a %ux%u heightfield, the biggest texture is %d\n",width,height,max_size);
+        return false;
+    }
+
+    if(entry.VA==INVALID_OGL_VALUE){
+        /// Nothing to put in it, but drawing needs a VAO bound
+        glGenVertexArrays( 1, &entry.VA );
+    }
+    if(entry.DataTexture==INVALID_OGL_VALUE){
+        glGenTextures( 1, &entry.DataTexture );
+    }
+    m_width=width;
+    m_height=height;
+    m_heights.assign(size_t(width)*height,std::numeric_limits<float>::quiet_NaN());
+
+    glBindTexture( GL_TEXTURE_2D, entry.DataTexture );
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, &m_heights[0] );
+    /// Only ever read with texelFetch
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+    glBindTexture( GL_TEXTURE_2D, 0 );
+
+    /// Same number of quads the vertex shader lays out, see HEIGHTFIELD_MAX_SIDE
+    entry.NumIndices=0;
+    if(width>1 && height>1){
+        unsigned int step=std::max(1u,(std::max(width,height)+HEIGHTFIELD_MAX_SIDE-1)/HEIGHTFIELD_MAX_SIDE);
+        entry.NumIndices=6*((width-2)/step+1)*((height-2)/step+1);
+    }
+    return true;
+}
+
+void Heightfield::SetCell(long x, long y, float height, Rect& changed)
+{
+    float &cell=m_heights[y*m_width+x];
+    if(cell==height || (std::isnan(cell) && std::isnan(height))){
+        return;
+    }
+    cell=height;
+    changed.Add(x,y);
+}
+
+/*!
+ * \brief send the changed rectangle to the GPU, straight out of m_heights
+ */
+void Heightfield::Upload(const Rect& changed)
+{
+    if(changed.x1<=changed.x0 || changed.y1<=changed.y0){
+        return;
+    }
+    glBindTexture( GL_TEXTURE_2D, mesh->m_Entries[0].DataTexture );
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, m_width );
+    glTexSubImage2D( GL_TEXTURE_2D, 0, changed.x0, changed.y0, changed.x1-changed.x0, changed.y1-changed.y0,
+                     GL_RED, GL_FLOAT, &m_heights[changed.y0*m_width+changed.x0] );
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+    glBindTexture( GL_TEXTURE_2D, 0 );
+}
+
+/*!
+ * \brief show a costmap, lethal cost being max_height tall
+ */
+void Heightfield::SetCostmap(const nav_msgs::OccupancyGrid& grid, float scaling_factor, float max_height)
+{
+    if(grid.data.size()<size_t(grid.info.width)*grid.info.height || !Resize(grid.info.width,grid.info.height)){
+        return;
+    }
+    Rect changed;
+    for(long y=0;y<m_height;y++){
+        for(long x=0;x<m_width;x++){
+            int cost=grid.data[y*m_width+x];
+            SetCell(x,y,cost<0?std::numeric_limits<float>::quiet_NaN():cost*max_height/100.0f,changed);
+        }
+    }
+    Upload(changed);
+
+    Mesh::MeshEntry& entry=mesh->m_Entries[0];
+    entry.DataOffset[0]=0;
+    entry.DataOffset[1]=0;
+    entry.DataMin=0;
+    entry.DataMax=max_height;
+
+    /// The shader puts cell (x,y) at (x+0.5,y+0.5), so scale that to the cell size
+    float resolution=grid.info.resolution*scaling_factor;
+    Matrix4 cells;
+    cells.scale(resolution,resolution,scaling_factor);
+    mesh->trans=Mesh::PoseMatrix(grid.info.origin,scaling_factor)*cells;
+    mesh->frame_id=grid.header.frame_id;
+    mesh->initialized=true;
+    mesh->needs_update=false;
+}
+
+/*!
+ * \brief copy a costmap update over its rectangle, and upload just the cells that changed
+ */
+void Heightfield::ApplyCostmapUpdate(const map_msgs::OccupancyGridUpdate& update, float max_height)
+{
+    if(m_heights.empty() || update.data.size()<size_t(update.width)*update.height){
+        return;
+    }
+    long x0=std::max<long>(update.x,0);
+    long y0=std::max<long>(update.y,0);
+    long x1=std::min<long>(long(update.x)+update.width,m_width);
+    long y1=std::min<long>(long(update.y)+update.height,m_height);
+    Rect changed;
+    for(long y=y0;y<y1;y++){
+        for(long x=x0;x<x1;x++){
+            int cost=update.data[(y-update.y)*update.width+(x-update.x)];
+            SetCell(x,y,cost<0?std::numeric_limits<float>::quiet_NaN():cost*max_height/100.0f,changed);
+        }
+    }
+    Upload(changed);
+}
+
+#ifdef HAVE_GRID_MAP
+/*!
+ * \brief show one layer of a grid map, e.g. "elevation"
+ *
+ * The texture holds the circular buffer as it is, texel x being the grid map row (along
+ * x) and texel y the column (along y), and the shader starts reading at the start index.
+ */
+void Heightfield::SetGridMap(const grid_map_msgs::GridMap& map, const std::string& layer, float scaling_factor)
+{
+    size_t index=std::find(map.layers.begin(),map.layers.end(),layer)-map.layers.begin();
+    if(index>=map.layers.size() || index>=map.data.size()){
+        printf("Grid map has no '%s' layer\n",layer.c_str());
+        return;
+    }
+    const std_msgs::Float32MultiArray& array=map.data[index];
+    if(array.layout.dim.size()!=2){
+        printf("Grid map layer '%s' isn't two dimensional\n",layer.c_str());
+        return;
+    }
+    /// Eigen's default is column major, which lists the column index first
+    bool row_major=(array.layout.dim[0].label=="row_index");
+    unsigned int rows=row_major?array.layout.dim[0].size:array.layout.dim[1].size;
+    unsigned int cols=row_major?array.layout.dim[1].size:array.layout.dim[0].size;
+    if(array.data.size()<array.layout.data_offset+size_t(rows)*cols || !Resize(rows,cols)){
+        return;
+    }
+
+    const float* data=&array.data[array.layout.data_offset];
+    float lowest=std::numeric_limits<float>::max();
+    float highest=-std::numeric_limits<float>::max();
+    Rect changed;
+    for(long col=0;col<cols;col++){
+        for(long row=0;row<rows;row++){
+            float height=row_major?data[row*cols+col]:data[col*rows+row];
+            SetCell(row,col,height,changed);
+            if(std::isfinite(height)){
+                lowest=std::min(lowest,height);
+                highest=std::max(highest,height);
+            }
+        }
+    }
+    Upload(changed);
+
+    Mesh::MeshEntry& entry=mesh->m_Entries[0];
+    entry.DataOffset[0]=map.outer_start_index;
+    entry.DataOffset[1]=map.inner_start_index;
+    entry.DataMin=(lowest<=highest)?lowest:0.0f;
+    entry.DataMax=(lowest<=highest)?highest:1.0f;
+
+    /// Cell (0,0) is the +x +y corner of the map, and the indices count down from there
+    float resolution=map.info.resolution*scaling_factor;
+    Matrix4 cells;
+    cells.scale(-resolution,-resolution,scaling_factor);
+    cells.translate(map.info.length_x*0.5*scaling_factor,map.info.length_y*0.5*scaling_factor,0);
+    mesh->trans=Mesh::PoseMatrix(map.info.pose,scaling_factor)*cells;
+    mesh->frame_id=map.info.header.frame_id;
+    mesh->initialized=true;
+    mesh->needs_update=false;
+}
+#endif
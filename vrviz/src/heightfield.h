@@ -0,0 +1,59 @@
+#ifndef HEIGHTFIELD_H
+#define	HEIGHTFIELD_H
+
+#include <string>
+#include <vector>
+#include <nav_msgs/OccupancyGrid.h>
+#include <map_msgs/OccupancyGridUpdate.h>
+#ifdef HAVE_GRID_MAP
+#include <grid_map_msgs/GridMap.h>
+#endif
+#include "mesh.h"
+
+/// Heightfields bigger than this on a side get drawn with every n-th cell, the shader has the same number
+#define HEIGHTFIELD_MAX_SIDE 1024
+
+/*!
+ * \brief A costmap or grid_map layer, drawn as a 3D surface
+ *
+ * The heights go into a float (GL_R32F) texture, and the vertex shader builds the grid
+ * itself from gl_VertexID and moves each vertex up by fetching its height, so there is
+ * no geometry to regenerate, ever. Only the rectangle of cells that changed is uploaded:
+ * costmaps say which with OccupancyGridUpdate, and grid maps get compared against the
+ * last message. grid_map keeps its cells in a circular buffer, so when the map moves,
+ * only the start index (a shader uniform) and the cells that scrolled in change.
+ *
+ * Cells with no data (NaN, or -1 in a costmap) are left as holes. Render thread only.
+ */
+class Heightfield
+{
+public:
+    Heightfield(const std::string& name);
+
+    void SetCostmap(const nav_msgs::OccupancyGrid& grid, float scaling_factor, float max_height);
+    void ApplyCostmapUpdate(const map_msgs::OccupancyGridUpdate& update, float max_height);
+#ifdef HAVE_GRID_MAP
+    void SetGridMap(const grid_map_msgs::GridMap& map, const std::string& layer, float scaling_factor);
+#endif
+
+    Mesh* mesh;                         ///!< Goes in robot_meshes, which owns it
+
+private:
+    /// Cells that changed, x1 and y1 are one past the end
+    struct Rect {
+        Rect();
+        void Add(long x, long y);
+        long x0, y0, x1, y1;
+    };
+
+    bool Resize(unsigned int width, unsigned int height);
+    void SetCell(long x, long y, float height, Rect& changed);
+    void Upload(const Rect& changed);
+
+    unsigned int m_width;               ///!< Size of the texture, in cells
+    unsigned int m_height;
+    std::vector<float> m_heights;       ///!< What the texture holds, to tell what changed
+};
+
+
+#endif	/* HEIGHTFIELD_H */
@@ -0,0 +1,272 @@
+#include <cstring>
+#include <sensor_msgs/image_encodings.h>
+#include "image_convert.h"
+
+/// The vector kernels are built for their own instruction sets, and only used if the CPU has them
+#if defined(__GNUC__) && defined(__x86_64__)
+#define IMAGE_CONVERT_SIMD
+#include <immintrin.h>
+#endif
+
+namespace ImageConvert
+{
+
+typedef void (*RowKernel)(const unsigned char* src, unsigned char* dst, unsigned int width, Format format, bool big_endian);
+
+Format FormatFromEncoding(const std::string& encoding)
+{
+    namespace enc = sensor_msgs::image_encodings;
+    if(encoding==enc::BGR8){
+        return BGR8;
+    }else if(encoding==enc::RGB8){
+        return RGB8;
+    }else if(encoding==enc::BGRA8){
+        return BGRA8;
+    }else if(encoding==enc::RGBA8){
+        return RGBA8;
+    }else if(encoding==enc::MONO8 || encoding==enc::TYPE_8UC1){
+        return MONO8;
+    }else if(encoding==enc::MONO16 || encoding==enc::TYPE_16UC1){
+        return MONO16;
+    }
+    return UNSUPPORTED;
+}
+
+unsigned int BytesPerPixel(Format format)
+{
+    switch(format){
+    case BGR8:
+    case RGB8:
+        return 3;
+    case BGRA8:
+    case RGBA8:
+        return 4;
+    case MONO8:
+        return 1;
+    case MONO16:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+/*!
+ * \brief one row, a pixel at a time. The vector kernels finish their rows with this
+ * \param first     pixel to start at
+ */
+static void RowScalar(const unsigned char* src, unsigned char* dst, unsigned int width, Format format, bool big_endian, unsigned int first)
+{
+    unsigned int x;
+    switch(format){
+    case BGR8:
+        for(x=first;x<width;x++){
+            dst[4*x+0]=src[3*x+2];
+            dst[4*x+1]=src[3*x+1];
+            dst[4*x+2]=src[3*x+0];
+            dst[4*x+3]=255;
+        }
+        break;
+    case RGB8:
+        for(x=first;x<width;x++){
+            dst[4*x+0]=src[3*x+0];
+            dst[4*x+1]=src[3*x+1];
+            dst[4*x+2]=src[3*x+2];
+            dst[4*x+3]=255;
+        }
+        break;
+    case BGRA8:
+        for(x=first;x<width;x++){
+            dst[4*x+0]=src[4*x+2];
+            dst[4*x+1]=src[4*x+1];
+            dst[4*x+2]=src[4*x+0];
+            dst[4*x+3]=src[4*x+3];
+        }
+        break;
+    case RGBA8:
+        if(first<width){
+            memcpy(dst+4*first,src+4*first,4*(width-first));
+        }
+        break;
+    case MONO8:
+        for(x=first;x<width;x++){
+            dst[4*x+0]=dst[4*x+1]=dst[4*x+2]=src[x];
+            dst[4*x+3]=255;
+        }
+        break;
+    case MONO16:
+        /// Just the top 8 bits
+        for(x=first;x<width;x++){
+            dst[4*x+0]=dst[4*x+1]=dst[4*x+2]=src[2*x+(big_endian?0:1)];
+            dst[4*x+3]=255;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void RowPlain(const unsigned char* src, unsigned char* dst, unsigned int width, Format format, bool big_endian)
+{
+    RowScalar(src,dst,width,format,big_endian,0);
+}
+
+#ifdef IMAGE_CONVERT_SIMD
+/*!
+ * \brief four pixels at a time (16 for mono8) with SSSE3's byte shuffle
+ */
+__attribute__((target("ssse3")))
+static void RowSSSE3(const unsigned char* src, unsigned char* dst, unsigned int width, Format format, bool big_endian)
+{
+    const __m128i alpha=_mm_set1_epi32(0xFF000000);
+    unsigned int x=0;
+    switch(format){
+    case BGR8:
+    case RGB8:{
+        const __m128i mask=(format==BGR8)?_mm_setr_epi8(2,1,0,-1,5,4,3,-1,8,7,6,-1,11,10,9,-1)
+                                         :_mm_setr_epi8(0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,-1);
+        /// 16 bytes get loaded for the 12 that are used, so don't read past the end of the row
+        for(;x+6<=width;x+=4){
+            __m128i px=_mm_loadu_si128((const __m128i*)(src+3*x));
+            _mm_storeu_si128((__m128i*)(dst+4*x),_mm_or_si128(_mm_shuffle_epi8(px,mask),alpha));
+        }
+        break;
+    }
+    case BGRA8:{
+        const __m128i mask=_mm_setr_epi8(2,1,0,3,6,5,4,7,10,9,8,11,14,13,12,15);
+        for(;x+4<=width;x+=4){
+            __m128i px=_mm_loadu_si128((const __m128i*)(src+4*x));
+            _mm_storeu_si128((__m128i*)(dst+4*x),_mm_shuffle_epi8(px,mask));
+        }
+        break;
+    }
+    case MONO8:{
+        const __m128i mask=_mm_setr_epi8(0,0,0,-1,1,1,1,-1,2,2,2,-1,3,3,3,-1);
+        const __m128i four=_mm_setr_epi8(4,4,4,0,4,4,4,0,4,4,4,0,4,4,4,0);
+        for(;x+16<=width;x+=16){
+            __m128i px=_mm_loadu_si128((const __m128i*)(src+x));
+            __m128i m=mask;
+            for(int quarter=0;quarter<4;quarter++){
+                _mm_storeu_si128((__m128i*)(dst+4*x+16*quarter),_mm_or_si128(_mm_shuffle_epi8(px,m),alpha));
+                m=_mm_add_epi8(m,four);
+            }
+        }
+        break;
+    }
+    case MONO16:{
+        /// Pick the top byte of each pixel
+        const __m128i low=big_endian?_mm_setr_epi8(0,0,0,-1,2,2,2,-1,4,4,4,-1,6,6,6,-1)
+                                    :_mm_setr_epi8(1,1,1,-1,3,3,3,-1,5,5,5,-1,7,7,7,-1);
+        const __m128i high=_mm_add_epi8(low,_mm_setr_epi8(8,8,8,0,8,8,8,0,8,8,8,0,8,8,8,0));
+        for(;x+8<=width;x+=8){
+            __m128i px=_mm_loadu_si128((const __m128i*)(src+2*x));
+            _mm_storeu_si128((__m128i*)(dst+4*x),_mm_or_si128(_mm_shuffle_epi8(px,low),alpha));
+            _mm_storeu_si128((__m128i*)(dst+4*x+16),_mm_or_si128(_mm_shuffle_epi8(px,high),alpha));
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    RowScalar(src,dst,width,format,big_endian,(format==RGBA8)?0:x);
+}
+
+/*!
+ * \brief eight pixels at a time with AVX2
+ *
+ * The 256 bit shuffle only works within each 128 bit half, so the three byte formats load
+ * four pixels into each half.
+ */
+__attribute__((target("avx2")))
+static void RowAVX2(const unsigned char* src, unsigned char* dst, unsigned int width, Format format, bool big_endian)
+{
+    const __m256i alpha=_mm256_set1_epi32(0xFF000000);
+    const __m256i gray=_mm256_set1_epi32(0x00010101);
+    unsigned int x=0;
+    switch(format){
+    case BGR8:
+    case RGB8:{
+        const __m256i mask=(format==BGR8)?_mm256_setr_epi8(2,1,0,-1,5,4,3,-1,8,7,6,-1,11,10,9,-1,
+                                                           2,1,0,-1,5,4,3,-1,8,7,6,-1,11,10,9,-1)
+                                         :_mm256_setr_epi8(0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,-1,
+                                                           0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,-1);
+        /// The second half loads 16 bytes from pixel 4, so stay that far from the end of the row
+        for(;x+10<=width;x+=8){
+            __m128i lo=_mm_loadu_si128((const __m128i*)(src+3*x));
+            __m128i hi=_mm_loadu_si128((const __m128i*)(src+3*x+12));
+            __m256i px=_mm256_inserti128_si256(_mm256_castsi128_si256(lo),hi,1);
+            _mm256_storeu_si256((__m256i*)(dst+4*x),_mm256_or_si256(_mm256_shuffle_epi8(px,mask),alpha));
+        }
+        break;
+    }
+    case BGRA8:{
+        const __m256i mask=_mm256_setr_epi8(2,1,0,3,6,5,4,7,10,9,8,11,14,13,12,15,
+                                            2,1,0,3,6,5,4,7,10,9,8,11,14,13,12,15);
+        for(;x+8<=width;x+=8){
+            __m256i px=_mm256_loadu_si256((const __m256i*)(src+4*x));
+            _mm256_storeu_si256((__m256i*)(dst+4*x),_mm256_shuffle_epi8(px,mask));
+        }
+        break;
+    }
+    case MONO8:
+        /// Widen each byte to 32 bits, then copy it into r, g and b with one multiply
+        for(;x+8<=width;x+=8){
+            __m256i px=_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src+x)));
+            _mm256_storeu_si256((__m256i*)(dst+4*x),_mm256_or_si256(_mm256_mullo_epi32(px,gray),alpha));
+        }
+        break;
+    case MONO16:
+        for(;x+8<=width;x+=8){
+            __m256i px=_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src+2*x)));
+            px=big_endian?_mm256_and_si256(px,_mm256_set1_epi32(0xFF)):_mm256_srli_epi32(px,8);
+            _mm256_storeu_si256((__m256i*)(dst+4*x),_mm256_or_si256(_mm256_mullo_epi32(px,gray),alpha));
+        }
+        break;
+    default:
+        break;
+    }
+    RowScalar(src,dst,width,format,big_endian,(format==RGBA8)?0:x);
+}
+#endif
+
+/// Pick the best kernel once, the first time it's needed
+static RowKernel ChooseKernel(const char** name)
+{
+#ifdef IMAGE_CONVERT_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        *name="avx2";
+        return RowAVX2;
+    }
+    if(__builtin_cpu_supports("ssse3")){
+        *name="ssse3";
+        return RowSSSE3;
+    }
+#endif
+    *name="scalar";
+    return RowPlain;
+}
+
+static const char* kernel_name="scalar";
+static RowKernel GetKernel()
+{
+    static RowKernel kernel=ChooseKernel(&kernel_name);
+    return kernel;
+}
+
+const char* KernelName()
+{
+    GetKernel();
+    return kernel_name;
+}
+
+void ToRGBA(const unsigned char* src, size_t src_step, unsigned int width, unsigned int height,
+            Format format, bool big_endian, unsigned char* dst, size_t dst_step, bool flip)
+{
+    RowKernel kernel=GetKernel();
+    for(unsigned int y=0;y<height;y++){
+        const unsigned char* row=src+(flip?height-1-y:y)*src_step;
+        kernel(row,dst+y*dst_step,width,format,big_endian);
+    }
+}
+
+}
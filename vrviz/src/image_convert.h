@@ -0,0 +1,40 @@
+#ifndef IMAGE_CONVERT_H
+#define	IMAGE_CONVERT_H
+
+#include <string>
+#include <cstddef>
+
+/*!
+ * \brief Turns camera images into the RGBA the overlay texture wants, flipping them
+ *        upside down (OpenGL's first row is the bottom one) in the same pass.
+ *
+ * The rows are done with SSSE3 or AVX2 shuffles when the CPU has them, picked at run
+ * time, with a plain loop for everything else.
+ */
+namespace ImageConvert
+{
+
+enum Format { BGR8, RGB8, BGRA8, RGBA8, MONO8, MONO16, UNSUPPORTED };
+
+/// Which Format a sensor_msgs/Image encoding is, or UNSUPPORTED
+Format FormatFromEncoding(const std::string& encoding);
+
+/// Bytes per pixel of the source format
+unsigned int BytesPerPixel(Format format);
+
+/*!
+ * \brief convert a whole image to RGBA, with alpha set to opaque
+ * \param src,src_step      the source image, and the bytes from one row to the next
+ * \param big_endian        only matters for MONO16, which keeps the top 8 bits
+ * \param dst,dst_step      where the RGBA goes, at least 4*width bytes per row
+ * \param flip              write the rows bottom to top
+ */
+void ToRGBA(const unsigned char* src, size_t src_step, unsigned int width, unsigned int height,
+            Format format, bool big_endian, unsigned char* dst, size_t dst_step, bool flip);
+
+/// Which kernel ToRGBA() ends up using on this CPU: "avx2", "ssse3" or "scalar"
+const char* KernelName();
+
+}
+
+#endif	/* IMAGE_CONVERT_H */
@@ -0,0 +1,176 @@
+#include <cstdio>
+#include <cstring>
+#include <sensor_msgs/image_encodings.h>
+#include <opencv2/highgui/highgui.hpp>
+#include "image_convert.h"
+#include "image_decoder.h"
+
+ImageDecoder::ImageDecoder()
+    : m_stop(false),
+      m_dropped(0),
+      m_streamer(NULL)
+{
+#ifdef HAVE_TURBOJPEG
+    m_turbo=NULL;
+#endif
+}
+
+ImageDecoder::~ImageDecoder()
+{
+    Stop();
+}
+
+/*!
+ * \brief spin up the worker thread
+ * \param streamer  where the decoded images go. Nothing else may write to it while this runs
+ */
+void ImageDecoder::Start(ImageStreamer* streamer)
+{
+    m_streamer=streamer;
+#ifdef HAVE_TURBOJPEG
+    m_turbo=tjInitDecompress();
+    if(!m_turbo){
+        printf("Could not start libjpeg-turbo, JPEGs will be decoded with OpenCV\n");
+    }
+#endif
+    m_stop=false;
+    m_thread=boost::thread(&ImageDecoder::WorkerLoop,this);
+}
+
+/*!
+ * \brief stop the worker, after whatever it is decoding now
+ */
+void ImageDecoder::Stop()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_stop=true;
+        m_pending.reset();
+    }
+    m_imageReady.notify_all();
+    if(m_thread.joinable()){
+        m_thread.join();
+    }
+#ifdef HAVE_TURBOJPEG
+    if(m_turbo){
+        tjDestroy(m_turbo);
+        m_turbo=NULL;
+    }
+#endif
+}
+
+void ImageDecoder::Submit(const sensor_msgs::CompressedImage::ConstPtr& image)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        if(m_pending){
+            m_dropped++;
+        }
+        m_pending=image;
+    }
+    m_imageReady.notify_one();
+}
+
+void ImageDecoder::WorkerLoop()
+{
+    while(true){
+        sensor_msgs::CompressedImage::ConstPtr image;
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex);
+            while(!m_stop && !m_pending){
+                m_imageReady.wait(lock);
+            }
+            if(m_stop){
+                return;
+            }
+            image.swap(m_pending);
+        }
+
+        /// Go by the magic bytes rather than the format string, which varies between publishers
+        const std::vector<unsigned char>& data=image->data;
+        bool jpeg=(data.size()>=2 && data[0]==0xFF && data[1]==0xD8);
+        if(!(jpeg && DecodeJPEG(*image)) && !DecodeOpenCV(*image)){
+            printf("Could not decode a %s compressed image\n",image->format.c_str());
+        }
+    }
+}
+
+/*!
+ * \brief decode a JPEG with libjpeg-turbo, straight into the streamer
+ * \return false if it couldn't, so OpenCV should try
+ */
+bool ImageDecoder::DecodeJPEG(const sensor_msgs::CompressedImage& image)
+{
+#ifdef HAVE_TURBOJPEG
+    if(!m_turbo){
+        return false;
+    }
+    unsigned char* jpeg=const_cast<unsigned char*>(&image.data[0]);
+    int width, height, subsampling, colorspace;
+    if(tjDecompressHeader3(m_turbo,jpeg,image.data.size(),&width,&height,&subsampling,&colorspace)!=0 ||
+       width<=0 || height<=0){
+        return false;
+    }
+    unsigned int step=3*width;
+    unsigned char* dst=m_streamer->Begin(sensor_msgs::image_encodings::RGB8,width,height,step);
+    if(tjDecompress2(m_turbo,jpeg,image.data.size(),dst,width,step,height,TJPF_RGB,TJFLAG_FASTDCT)!=0){
+        printf("libjpeg-turbo: %s\n",tjGetErrorStr());
+        return false;
+    }
+    m_streamer->Commit();
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*!
+ * \brief decode anything OpenCV can, and copy it into the streamer
+ */
+bool ImageDecoder::DecodeOpenCV(const sensor_msgs::CompressedImage& image)
+{
+    if(image.data.empty()){
+        return false;
+    }
+    cv::Mat decoded=cv::imdecode(cv::Mat(1,image.data.size(),CV_8UC1,const_cast<unsigned char*>(&image.data[0])),CV_LOAD_IMAGE_UNCHANGED);
+    if(decoded.empty()){
+        return false;
+    }
+
+    ImageConvert::Format format;
+    std::string encoding;
+    switch(decoded.channels()){
+    case 3:
+        format=ImageConvert::BGR8;
+        encoding=sensor_msgs::image_encodings::BGR8;
+        break;
+    case 4:
+        format=ImageConvert::BGRA8;
+        encoding=sensor_msgs::image_encodings::BGRA8;
+        break;
+    case 1:
+        /// The streamer only takes color, so gray gets converted on the way in
+        format=(decoded.depth()==CV_16U)?ImageConvert::MONO16:ImageConvert::MONO8;
+        encoding=sensor_msgs::image_encodings::RGBA8;
+        break;
+    default:
+        return false;
+    }
+    if(decoded.depth()!=CV_8U && format!=ImageConvert::MONO16){
+        return false;
+    }
+
+    if(format==ImageConvert::BGR8 || format==ImageConvert::BGRA8){
+        unsigned int step=decoded.cols*ImageConvert::BytesPerPixel(format);
+        unsigned char* dst=m_streamer->Begin(encoding,decoded.cols,decoded.rows,step);
+        for(int row=0;row<decoded.rows;row++){
+            memcpy(dst+row*step,decoded.ptr(row),step);
+        }
+    }else{
+        unsigned char* dst=m_streamer->Begin(encoding,decoded.cols,decoded.rows,4*decoded.cols);
+        /// OpenCV's 16 bit pixels are in the machine's byte order
+        ImageConvert::ToRGBA(decoded.data,decoded.step,decoded.cols,decoded.rows,format,false,dst,4*decoded.cols,false);
+    }
+    m_streamer->Commit();
+    return true;
+}
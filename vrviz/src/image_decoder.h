@@ -0,0 +1,57 @@
+#ifndef IMAGE_DECODER_H
+#define	IMAGE_DECODER_H
+
+#include <boost/thread.hpp>
+#include <sensor_msgs/CompressedImage.h>
+#include "image_streamer.h"
+
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+/*!
+ * \brief Decodes compressed camera images on a worker thread, straight into the ImageStreamer
+ *
+ * JPEGs are decoded by libjpeg-turbo (if it was found at build time) as rgb8, its own
+ * output format, right into the pixel buffer the render thread will upload from. PNGs,
+ * and JPEGs without libjpeg-turbo, go through cv::imdecode and are copied in.
+ *
+ * Only the newest image is kept: if one comes in while the last is still being decoded,
+ * whatever was waiting is dropped.
+ *
+ * Submit() can be called from any thread, Start() and Stop() from the one that owns it.
+ */
+class ImageDecoder
+{
+public:
+    ImageDecoder();
+
+    ~ImageDecoder();
+
+    void Start(ImageStreamer* streamer);
+    void Stop();
+
+    void Submit(const sensor_msgs::CompressedImage::ConstPtr& image);
+
+    unsigned long Dropped() const { return m_dropped; }
+
+private:
+    void WorkerLoop();
+    bool DecodeJPEG(const sensor_msgs::CompressedImage& image);
+    bool DecodeOpenCV(const sensor_msgs::CompressedImage& image);
+
+    boost::thread m_thread;
+    boost::mutex m_mutex;                   ///!< Protects m_stop and m_pending
+    boost::condition_variable m_imageReady;
+    bool m_stop;
+    sensor_msgs::CompressedImage::ConstPtr m_pending;
+    unsigned long m_dropped;                ///!< Images replaced before they were decoded
+
+    ImageStreamer* m_streamer;              ///!< Only the worker writes to it
+#ifdef HAVE_TURBOJPEG
+    tjhandle m_turbo;
+#endif
+};
+
+
+#endif	/* IMAGE_DECODER_H */
@@ -0,0 +1,447 @@
+#include <cstring>
+#include <algorithm>
+#include <sensor_msgs/image_encodings.h>
+#include "image_streamer.h"
+
+/// Set in m_middle along with the slot index
+#define IMAGE_STREAMER_FRESH 0x100
+
+/// How an image goes into a texture as it is
+struct Packing {
+    ImageStreamer::Layout layout;
+    GLenum format;
+    unsigned int bytes_per_texel;
+    unsigned int cols;
+    unsigned int rows;
+};
+
+/*!
+ * \brief how an image can be uploaded without converting it on the CPU
+ * \return false if it can't be
+ */
+static bool Pack(const std::string& encoding, unsigned int width, unsigned int height, Packing* packing)
+{
+    namespace enc = sensor_msgs::image_encodings;
+    packing->layout=ImageStreamer::RGB;
+    packing->cols=width;
+    packing->rows=height;
+    if(encoding==enc::BGR8){
+        packing->format=GL_BGR;
+        packing->bytes_per_texel=3;
+    }else if(encoding==enc::RGB8){
+        packing->format=GL_RGB;
+        packing->bytes_per_texel=3;
+    }else if(encoding==enc::BGRA8){
+        packing->format=GL_BGRA;
+        packing->bytes_per_texel=4;
+    }else if(encoding==enc::RGBA8){
+        packing->format=GL_RGBA;
+        packing->bytes_per_texel=4;
+    }else if(encoding=="yuv422" || encoding=="uyvy" || encoding=="yuv422_yuy2" || encoding=="yuyv"){
+        /// Four bytes for every two pixels, which share their U and V
+        packing->layout=(encoding=="yuv422" || encoding=="uyvy")?ImageStreamer::UYVY:ImageStreamer::YUYV;
+        packing->format=GL_RGBA;
+        packing->bytes_per_texel=4;
+        packing->cols=width/2;
+        if(width%2!=0){
+            return false;
+        }
+    }else if(encoding=="nv12" || encoding=="nv21"){
+        /// The luma, then half as many rows of interleaved chroma
+        packing->layout=(encoding=="nv12")?ImageStreamer::NV12:ImageStreamer::NV21;
+        packing->format=GL_RED;
+        packing->bytes_per_texel=1;
+        packing->rows=height+height/2;
+        if(width%2!=0 || height%2!=0){
+            return false;
+        }
+    }else{
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * \param mipmaps  generate them for the texture after every image
+ */
+ImageStreamer::ImageStreamer(bool mipmaps)
+    : m_back(0),
+      m_front(1),
+      m_middle(2),
+      m_written(0),
+      m_dropped(0),
+      m_texture(0),
+      m_mipmaps(mipmaps),
+      m_width(0),
+      m_height(0),
+      m_yuvTexture(0),
+      m_yuvFormat(0),
+      m_yuvCols(0),
+      m_yuvRows(0),
+      m_framebuffer(0),
+      m_vertexArray(0),
+      m_size(0),
+      m_imageWidth(0),
+      m_imageHeight(0),
+      m_layerTexture(0),
+      m_layer(0),
+      m_layerWidth(0),
+      m_layerHeight(0),
+      m_inLayer(false)
+{
+    for(int idx=0;idx<IMAGE_STREAMER_SLOTS;idx++){
+        Slot& slot=m_slots[idx];
+        slot.pbo=0;
+        slot.capacity=0;
+        slot.mapped=NULL;
+        slot.fence=0;
+        slot.width=0;
+        slot.height=0;
+        slot.cols=0;
+        slot.rows=0;
+        slot.row_length=0;
+        slot.size=0;
+        slot.format=0;
+        slot.layout=RGB;
+        slot.color_space=BT601;
+    }
+}
+
+/*!
+ * \brief whether Write() takes this image as it is, otherwise it needs converting first
+ */
+bool ImageStreamer::CanUpload(const sensor_msgs::Image& image)
+{
+    Packing packing;
+    if(!Pack(image.encoding,image.width,image.height,&packing) || image.width==0 || image.height==0){
+        return false;
+    }
+    return image.step>=packing.cols*packing.bytes_per_texel && image.step%packing.bytes_per_texel==0 &&
+           image.data.size()>=size_t(image.step)*packing.rows;
+}
+
+/*!
+ * \brief hand the render thread a new image, replacing the last one if it hasn't got to it
+ * \param image     one CanUpload() said yes to
+ */
+void ImageStreamer::Write(const sensor_msgs::Image::ConstPtr& image)
+{
+    Slot& slot=m_slots[m_back];
+    Describe(slot,image->encoding,image->width,image->height,image->step);
+    if(slot.mapped && slot.capacity>=slot.size){
+        memcpy(slot.mapped,&image->data[0],slot.size);
+        slot.image.reset();
+    }else{
+        slot.image=image;
+    }
+    Commit();
+}
+
+/*!
+ * \brief somewhere to put an image, for a decoder to write it straight into
+ *
+ * That's the mapped buffer if it fits, otherwise a message that will be uploaded from.
+ * Call Commit() once it's written.
+ *
+ * \param encoding     one that CanUpload() takes
+ * \param step         bytes from one row to the next
+ * \param color_space  how to turn YUV into RGB. ROS images are always BT.601 video range
+ * \return step times the rows bytes to write the image into
+ */
+unsigned char* ImageStreamer::Begin(const std::string& encoding, unsigned int width, unsigned int height, unsigned int step,
+                                    ColorSpace color_space)
+{
+    Slot& slot=m_slots[m_back];
+    Describe(slot,encoding,width,height,step);
+    slot.color_space=color_space;
+    if(slot.mapped && slot.capacity>=slot.size){
+        slot.image.reset();
+        return slot.mapped;
+    }
+    sensor_msgs::Image::Ptr image(new sensor_msgs::Image);
+    image->encoding=encoding;
+    image->width=width;
+    image->height=height;
+    image->step=step;
+    image->data.resize(slot.size);
+    slot.image=image;
+    return &image->data[0];
+}
+
+void ImageStreamer::Describe(Slot& slot, const std::string& encoding, unsigned int width, unsigned int height, unsigned int step)
+{
+    Packing packing;
+    Pack(encoding,width,height,&packing);
+    slot.layout=packing.layout;
+    slot.color_space=BT601;
+    slot.format=packing.format;
+    slot.width=width;
+    slot.height=height;
+    slot.cols=packing.cols;
+    slot.rows=packing.rows;
+    slot.row_length=step/packing.bytes_per_texel;
+    slot.size=size_t(step)*packing.rows;
+}
+
+/*!
+ * \brief hand the image written since Begin() (or by Write()) to the render thread
+ */
+void ImageStreamer::Commit()
+{
+    /// Releases the slot to the render thread, and takes back whatever was in the middle
+    unsigned int previous=m_middle.exchange(m_back|IMAGE_STREAMER_FRESH,std::memory_order_acq_rel);
+    if(previous&IMAGE_STREAMER_FRESH){
+        m_dropped++;
+    }
+    m_back=previous&~IMAGE_STREAMER_FRESH;
+    m_written++;
+}
+
+/*!
+ * \brief start uploading the newest image, if there is one. Never waits on the GPU
+ * \param yuv_program,yuv_layout_location,yuv_rows_location,yuv_color_space_location   the shader that converts YUV images
+ * \return true if the texture is getting a new image
+ */
+bool ImageStreamer::Update(GLuint yuv_program, GLint yuv_layout_location, GLint yuv_rows_location, GLint yuv_color_space_location)
+{
+    Slot& mine=m_slots[m_front];
+    if(mine.fence){
+        if(glClientWaitSync(mine.fence,0,0)==GL_TIMEOUT_EXPIRED){
+            /// Still uploading, anything new can wait in the middle slot for the next frame
+            return false;
+        }
+        glDeleteSync(mine.fence);
+        mine.fence=0;
+    }
+    if(m_size>0 && (!mine.mapped || mine.capacity<m_size)){
+        Map(mine,m_size);
+    }
+
+    /// Only the subscriber sets the flag, so if it's there it stays there until we swap
+    if(!(m_middle.load(std::memory_order_relaxed)&IMAGE_STREAMER_FRESH)){
+        return false;
+    }
+    m_front=m_middle.exchange(m_front,std::memory_order_acq_rel)&~IMAGE_STREAMER_FRESH;
+    Upload(m_slots[m_front],yuv_program,yuv_layout_location,yuv_rows_location,yuv_color_space_location);
+    return true;
+}
+
+/*!
+ * \brief send RGB images of exactly the layers' size into a layer of texture_array instead
+ *
+ * Anything else still goes into Texture(), for the owner of the array to copy in itself.
+ * InLayer() says which one the last image went to.
+ */
+void ImageStreamer::SetLayer(GLuint texture_array, unsigned int layer, unsigned int layer_width, unsigned int layer_height)
+{
+    m_layerTexture=texture_array;
+    m_layer=layer;
+    m_layerWidth=layer_width;
+    m_layerHeight=layer_height;
+}
+
+/*!
+ * \brief map a slot's buffer for the subscriber to write into, growing it if need be
+ */
+void ImageStreamer::Map(Slot& slot, size_t size)
+{
+    if(slot.pbo==0){
+        glGenBuffers( 1, &slot.pbo );
+    }
+    glBindBuffer( GL_PIXEL_UNPACK_BUFFER, slot.pbo );
+    if(slot.mapped){
+        glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+        slot.mapped=NULL;
+    }
+    if(slot.capacity<size){
+        glBufferData( GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW );
+        slot.capacity=size;
+    }
+    /// The upload from it is done, so there is nothing for the driver to wait on here
+    slot.mapped=(unsigned char*)glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, slot.capacity, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT );
+    glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+}
+
+void ImageStreamer::Upload(Slot& slot, GLuint yuv_program, GLint yuv_layout_location, GLint yuv_rows_location, GLint yuv_color_space_location)
+{
+    m_inLayer=(m_layerTexture!=0 && slot.layout==RGB && slot.width==m_layerWidth && slot.height==m_layerHeight);
+    m_imageWidth=slot.width;
+    m_imageHeight=slot.height;
+    m_size=slot.size;
+    if(m_inLayer){
+        UploadToLayer(slot);
+        return;
+    }
+
+    if(m_texture==0){
+        glGenTextures( 1, &m_texture );
+    }
+    glBindTexture( GL_TEXTURE_2D, m_texture );
+    if(slot.width!=m_width || slot.height!=m_height){
+        /// This allocates memory for the texture, so only when the size changes
+        glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, slot.width, slot.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+        m_width=slot.width;
+        m_height=slot.height;
+
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, m_mipmaps?GL_LINEAR_MIPMAP_LINEAR:GL_LINEAR );
+
+        GLfloat fLargest;
+        glGetFloatv( GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &fLargest );
+        glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, fLargest );
+    }
+
+    if(slot.layout!=RGB){
+        if(m_yuvTexture==0){
+            glGenTextures( 1, &m_yuvTexture );
+        }
+        glBindTexture( GL_TEXTURE_2D, m_yuvTexture );
+        if(slot.format!=m_yuvFormat || slot.cols!=m_yuvCols || slot.rows!=m_yuvRows){
+            glTexImage2D( GL_TEXTURE_2D, 0, (slot.format==GL_RED)?GL_R8:GL_RGBA8, slot.cols, slot.rows, 0, slot.format, GL_UNSIGNED_BYTE, NULL );
+            m_yuvFormat=slot.format;
+            m_yuvCols=slot.cols;
+            m_yuvRows=slot.rows;
+            /// Only ever read with texelFetch
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+        }
+    }
+
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, slot.row_length );
+    if(slot.image){
+        /// It didn't fit in the buffer, so this one goes straight from the message
+        glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, slot.cols, slot.rows, slot.format, GL_UNSIGNED_BYTE, &slot.image->data[0] );
+        slot.image.reset();
+    }else{
+        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, slot.pbo );
+        glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+        slot.mapped=NULL;
+        glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, slot.cols, slot.rows, slot.format, GL_UNSIGNED_BYTE, 0 );
+        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+        slot.fence=glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+    }
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+    glBindTexture( GL_TEXTURE_2D, 0 );
+
+    if(slot.layout!=RGB){
+        ConvertYUV(slot,yuv_program,yuv_layout_location,yuv_rows_location,yuv_color_space_location);
+    }
+
+    if(m_mipmaps){
+        glBindTexture( GL_TEXTURE_2D, m_texture );
+        glGenerateMipmap( GL_TEXTURE_2D );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+    }
+}
+
+/*!
+ * \brief upload an RGB image the size of the layer straight into it
+ */
+void ImageStreamer::UploadToLayer(Slot& slot)
+{
+    glBindTexture( GL_TEXTURE_2D_ARRAY, m_layerTexture );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, slot.row_length );
+    if(slot.image){
+        glTexSubImage3D( GL_TEXTURE_2D_ARRAY, 0, 0, 0, m_layer, slot.cols, slot.rows, 1, slot.format, GL_UNSIGNED_BYTE, &slot.image->data[0] );
+        slot.image.reset();
+    }else{
+        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, slot.pbo );
+        glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+        slot.mapped=NULL;
+        glTexSubImage3D( GL_TEXTURE_2D_ARRAY, 0, 0, 0, m_layer, slot.cols, slot.rows, 1, slot.format, GL_UNSIGNED_BYTE, 0 );
+        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+        slot.fence=glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+    }
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+    glBindTexture( GL_TEXTURE_2D_ARRAY, 0 );
+}
+
+/*!
+ * \brief draw the YUV texture into the overlay texture, converting it to RGB
+ */
+void ImageStreamer::ConvertYUV(const Slot& slot, GLuint yuv_program, GLint yuv_layout_location, GLint yuv_rows_location, GLint yuv_color_space_location)
+{
+    if(yuv_program==0){
+        return;
+    }
+    if(m_framebuffer==0){
+        glGenFramebuffers( 1, &m_framebuffer );
+        glGenVertexArrays( 1, &m_vertexArray );
+    }
+    glBindFramebuffer( GL_FRAMEBUFFER, m_framebuffer );
+    /// Attached every time, since the texture is reallocated when the size changes
+    glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texture, 0 );
+    glViewport( 0, 0, m_width, m_height );
+    glDisable( GL_DEPTH_TEST );
+
+    glUseProgram( yuv_program );
+    glUniform1i( yuv_layout_location, slot.layout );
+    glUniform1i( yuv_rows_location, slot.height );
+    glUniform1i( yuv_color_space_location, slot.color_space );
+    glActiveTexture( GL_TEXTURE0 );
+    glBindTexture( GL_TEXTURE_2D, m_yuvTexture );
+    glBindVertexArray( m_vertexArray );
+    glDrawArrays( GL_TRIANGLES, 0, 3 );
+
+    glBindVertexArray( 0 );
+    glBindTexture( GL_TEXTURE_2D, 0 );
+    glUseProgram( 0 );
+    glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+}
+
+/*!
+ * \brief free the buffers and the texture. Nothing can be written after this
+ */
+void ImageStreamer::Release()
+{
+    for(int idx=0;idx<IMAGE_STREAMER_SLOTS;idx++){
+        Slot& slot=m_slots[idx];
+        if(slot.fence){
+            glDeleteSync(slot.fence);
+            slot.fence=0;
+        }
+        if(slot.pbo){
+            if(slot.mapped){
+                glBindBuffer( GL_PIXEL_UNPACK_BUFFER, slot.pbo );
+                glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+                glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+            }
+            glDeleteBuffers( 1, &slot.pbo );
+        }
+        slot.pbo=0;
+        slot.capacity=0;
+        slot.mapped=NULL;
+        slot.image.reset();
+    }
+    m_middle.fetch_and(~IMAGE_STREAMER_FRESH);
+    if(m_texture){
+        glDeleteTextures( 1, &m_texture );
+        m_texture=0;
+    }
+    if(m_yuvTexture){
+        glDeleteTextures( 1, &m_yuvTexture );
+        m_yuvTexture=0;
+    }
+    if(m_framebuffer){
+        glDeleteFramebuffers( 1, &m_framebuffer );
+        glDeleteVertexArrays( 1, &m_vertexArray );
+        m_framebuffer=0;
+        m_vertexArray=0;
+    }
+    m_yuvFormat=0;
+    m_yuvCols=0;
+    m_yuvRows=0;
+    m_width=0;
+    m_height=0;
+    m_size=0;
+    m_imageWidth=0;
+    m_imageHeight=0;
+    m_layerTexture=0;
+    m_inLayer=false;
+}
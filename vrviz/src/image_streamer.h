@@ -0,0 +1,122 @@
+#ifndef IMAGE_STREAMER_H
+#define	IMAGE_STREAMER_H
+
+#include <atomic>
+#include <GL/glew.h>
+#include <sensor_msgs/Image.h>
+
+/// Pixel buffers cycled between the subscriber and the render thread
+#define IMAGE_STREAMER_SLOTS 3
+
+/*!
+ * \brief Streams camera images into a texture without the render thread waiting on them
+ *
+ * The slots are a triple buffer: each side owns one, and the third is swapped in and out
+ * of the middle with a single atomic exchange, so neither side ever takes a lock and the
+ * render thread always gets the newest complete image.
+ *
+ * Each slot is a pixel buffer object. The subscriber copies the image into the slot it
+ * holds, which the render thread mapped for it, then swaps it for the middle slot. The
+ * render thread swaps the middle slot for its own, unmaps it and starts the texture
+ * upload from it, which the driver does as a DMA while the frame goes on. A fence tells
+ * it when that is done, and only then is the buffer mapped again and handed back, so
+ * neither side ever waits for the GPU.
+ *
+ * Until the buffers are mapped at the right size (the first image, or when the size
+ * changes) the slot carries the message itself, and it is uploaded straight from that.
+ *
+ * YUV images go up as they are, into a texture of their own: 4:2:2 as one RGBA texel per
+ * pair of pixels, NV12/NV21 as one red texel per byte, the chroma rows under the luma.
+ * The yuv shader then draws them into the overlay texture, so the CPU never touches the
+ * pixels.
+ *
+ * With SetLayer(), RGB images that are exactly the layers' size skip the texture and are
+ * uploaded from the buffer straight into that layer of a texture array.
+ *
+ * Write(), or Begin() and Commit(), are for one thread (the subscriber or a decoder),
+ * Update() and Release() for the render thread.
+ */
+class ImageStreamer
+{
+public:
+    /// How the pixels are laid out. The YUV ones are the iLayout values of the yuv shader
+    enum Layout { RGB=0, UYVY=1, YUYV=2, NV12=3, NV21=4 };
+    /// What the YUV values mean, the iColorSpace values of the yuv shader: bit 0 is full range, bit 1 BT.709
+    enum ColorSpace { BT601=0, BT601_FULL=1, BT709=2, BT709_FULL=3 };
+
+    explicit ImageStreamer(bool mipmaps=true);
+
+    static bool CanUpload(const sensor_msgs::Image& image);
+
+    void Write(const sensor_msgs::Image::ConstPtr& image);
+    unsigned char* Begin(const std::string& encoding, unsigned int width, unsigned int height, unsigned int step,
+                         ColorSpace color_space=BT601);
+    void Commit();
+    bool Update(GLuint yuv_program, GLint yuv_layout_location, GLint yuv_rows_location, GLint yuv_color_space_location);
+    void SetLayer(GLuint texture_array, unsigned int layer, unsigned int layer_width, unsigned int layer_height);
+    void Release();
+
+    GLuint Texture() const { return m_texture; }
+    unsigned int Width() const { return m_imageWidth; }
+    unsigned int Height() const { return m_imageHeight; }
+    bool InLayer() const { return m_inLayer; }
+    unsigned long Written() const { return m_written; }
+    unsigned long Dropped() const { return m_dropped; }
+
+private:
+    struct Slot {
+        GLuint pbo;
+        size_t capacity;                ///!< Bytes allocated for the buffer
+        unsigned char* mapped;          ///!< Where the subscriber writes, or NULL if it isn't mapped
+        GLsync fence;                   ///!< Signaled once the texture upload from it is done
+
+        /// What the subscriber put in it
+        sensor_msgs::Image::ConstPtr image;     ///!< Set if it didn't fit in the buffer
+        unsigned int width;
+        unsigned int height;
+        unsigned int cols;              ///!< Texels uploaded, which for YUV isn't the same as the pixels
+        unsigned int rows;
+        unsigned int row_length;        ///!< Texels from one row to the next
+        size_t size;
+        GLenum format;
+        Layout layout;
+        ColorSpace color_space;
+    };
+
+    void Describe(Slot& slot, const std::string& encoding, unsigned int width, unsigned int height, unsigned int step);
+    void Map(Slot& slot, size_t size);
+    void Upload(Slot& slot, GLuint yuv_program, GLint yuv_layout_location, GLint yuv_rows_location, GLint yuv_color_space_location);
+    void UploadToLayer(Slot& slot);
+    void ConvertYUV(const Slot& slot, GLuint yuv_program, GLint yuv_layout_location, GLint yuv_rows_location, GLint yuv_color_space_location);
+
+    Slot m_slots[IMAGE_STREAMER_SLOTS];
+    unsigned int m_back;                ///!< The subscriber's slot
+    unsigned int m_front;               ///!< The render thread's slot
+    std::atomic<unsigned int> m_middle; ///!< The other slot, with IMAGE_STREAMER_FRESH set if it has an image the render thread hasn't had
+    std::atomic<unsigned long> m_written;   ///!< Images handed to Write()
+    std::atomic<unsigned long> m_dropped;   ///!< Images that were replaced before the render thread got to them
+
+    GLuint m_texture;
+    bool m_mipmaps;                     ///!< Off if the texture only gets copied somewhere else
+    unsigned int m_width;               ///!< Size the texture was allocated at
+    unsigned int m_height;
+
+    GLuint m_yuvTexture;                ///!< YUV images as they came, before the shader converts them
+    GLenum m_yuvFormat;                 ///!< What it was allocated as
+    unsigned int m_yuvCols;
+    unsigned int m_yuvRows;
+    GLuint m_framebuffer;               ///!< For drawing into m_texture
+    GLuint m_vertexArray;               ///!< Empty, the shader's triangle comes from gl_VertexID
+    size_t m_size;                      ///!< Bytes in the last image, which the buffers get mapped at
+    unsigned int m_imageWidth;          ///!< Size of the last image, wherever it went
+    unsigned int m_imageHeight;
+
+    GLuint m_layerTexture;              ///!< Texture array that matching images go straight into, or 0
+    unsigned int m_layer;
+    unsigned int m_layerWidth;          ///!< Size of its layers
+    unsigned int m_layerHeight;
+    bool m_inLayer;                     ///!< The last image went into the layer, not m_texture
+};
+
+
+#endif	/* IMAGE_STREAMER_H */
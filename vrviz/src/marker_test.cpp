@@ -1,5 +1,7 @@
 #include "ros/ros.h"
 
+#include <sstream>
+
 #include "visualization_msgs/Marker.h"
 #include "visualization_msgs/MarkerArray.h"
 
@@ -54,6 +56,35 @@ void publishCallback(const ros::TimerEvent&)
         marker.text="USE WAND TRIGGER TO DRIVE";
         msg.markers.push_back(marker);
     }
+    {
+        /// A status line on the HUD (with hud_text on), that changes every time but stays the
+        /// same length, so the HUD layer has to notice the text itself changed
+        static int battery=99;
+        std::stringstream ss;
+        ss << "BATTERY " << battery << "%";
+        battery=(battery>10)?battery-1:99;
+        visualization_msgs::Marker marker;
+        marker.header.frame_id = "/vrviz_base_hmd";
+        marker.header.stamp = ros::Time::now();
+        marker.ns = "marker_hud";
+        marker.id = 0;
+        marker.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
+        marker.action = visualization_msgs::Marker::ADD;
+        marker.pose.position.x = 0.0;
+        marker.pose.position.y =-0.3;
+        marker.pose.position.z =-1.0;
+        marker.scale.z = 0.030;
+        marker.pose.orientation.x = 0.0;
+        marker.pose.orientation.y = 0.0;
+        marker.pose.orientation.z = 0.0;
+        marker.pose.orientation.w = 1.0;
+        marker.color.r=1.0;
+        marker.color.g=1.0;
+        marker.color.b=1.0;
+        marker.color.a=1.0;
+        marker.text=ss.str();
+        msg.markers.push_back(marker);
+    }
 //    {
 //        /// Add some silly shapes
 //        visualization_msgs::Marker marker;
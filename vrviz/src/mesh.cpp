@@ -19,32 +19,116 @@
 
 
 #include "mesh.h"
+#include "mesh_tools.h"
 #include <tf/transform_broadcaster.h>
 
+GeometryPool Mesh::geometry_pool;
+TextAtlas Mesh::text_atlas;
+unsigned int Mesh::text_generations=0;
+AssetCache Mesh::asset_cache;
+Mesh::PrimitiveTemplate Mesh::templates[Mesh::NUM_TEMPLATES];
+
 Mesh::MeshEntry::MeshEntry()
 {
     VB = INVALID_OGL_VALUE;
+    VA = INVALID_OGL_VALUE;
     IB = INVALID_OGL_VALUE;
     NumIndices  = 0;
     MaterialIndex = INVALID_MATERIAL;
+    BaseVertex = 0;
+    FirstIndex = 0;
+    Mode = GL_TRIANGLES;
+    Width = 1.0;
+    InstanceVA = INVALID_OGL_VALUE;
+    InstanceVB = INVALID_OGL_VALUE;
+    NumInstances = 0;
+    InstanceCapacity = 0;
+    Template = -1;
+    BoundRadius = 0;
+    ElementRadius = 0;
+    DataTexture = INVALID_OGL_VALUE;
+    DataOffset[0] = 0;
+    DataOffset[1] = 0;
+    DataMin = 0;
+    DataMax = 1;
 };
 
+/// Entries get copied around by std::vector, so the GL objects are released in Release() instead
 Mesh::MeshEntry::~MeshEntry()
 {
+}
+
+/*!
+ * \brief give the GL buffers back, either to the driver or to the geometry_pool
+ */
+void Mesh::MeshEntry::Release()
+{
+    if (Template >= 0)
+    {
+        /// Template geometry is shared by everybody, so it isn't ours to free
+        VA = INVALID_OGL_VALUE;
+        VB = INVALID_OGL_VALUE;
+        IB = INVALID_OGL_VALUE;
+        Template = -1;
+    }
+
+    if (range.valid())
+    {
+        /// The buffers belong to the pool, just hand the range back
+        geometry_pool.Free(range);
+        VA = INVALID_OGL_VALUE;
+        VB = INVALID_OGL_VALUE;
+        IB = INVALID_OGL_VALUE;
+    }
+
+    if (VA != INVALID_OGL_VALUE)
+    {
+        glDeleteVertexArrays(1, &VA);
+        VA = INVALID_OGL_VALUE;
+    }
+
     if (VB != INVALID_OGL_VALUE)
     {
         glDeleteBuffers(1, &VB);
+        VB = INVALID_OGL_VALUE;
     }
 
     if (IB != INVALID_OGL_VALUE)
     {
         glDeleteBuffers(1, &IB);
+        IB = INVALID_OGL_VALUE;
     }
+
+    if (InstanceVA != INVALID_OGL_VALUE)
+    {
+        glDeleteVertexArrays(1, &InstanceVA);
+        InstanceVA = INVALID_OGL_VALUE;
+    }
+
+    if (InstanceVB != INVALID_OGL_VALUE)
+    {
+        glDeleteBuffers(1, &InstanceVB);
+        InstanceVB = INVALID_OGL_VALUE;
+    }
+
+    if (DataTexture != INVALID_OGL_VALUE)
+    {
+        glDeleteTextures(1, &DataTexture);
+        DataTexture = INVALID_OGL_VALUE;
+    }
+    NumInstances = 0;
+    InstanceCapacity = 0;
+    NumIndices = 0;
+    BaseVertex = 0;
+    FirstIndex = 0;
 }
 
 void Mesh::MeshEntry::Init(const std::vector<vr::RenderModel_Vertex_t>& Vertices,
                           const std::vector<u_int32_t>& Indices)
 {
+    /// Textured meshes are loaded once, but don't leak if they get reloaded
+    Release();
+
     NumIndices = Indices.size();
 
     // create and bind a VAO to hold state for this model
@@ -74,35 +158,143 @@ void Mesh::MeshEntry::Init(const std::vector<vr::RenderModel_Vertex_t>& Vertices
 }
 
 
+/*!
+ * \brief put colored geometry into the shared geometry_pool
+ *
+ * Markers get re-initialized every time they change, so if the new geometry lands in
+ * the same size class as the old we just overwrite it in place. Otherwise the old range
+ * goes back on the free list and we grab a new one.
+ */
 void Mesh::MeshEntry::Init(const std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices,
                           const std::vector<u_int32_t>& Indices)
 {
+    if(!geometry_pool.Fits(range,Vertices.size(),Indices.size())){
+        Release();
+        if(Vertices.empty() || Indices.empty()){
+            return;
+        }
+        if(!geometry_pool.Allocate(Vertices.size(),Indices.size(),range)){
+            printf("Could not allocate %lu vertices in geometry pool\n",Vertices.size());
+            return;
+        }
+    }
+
     NumIndices = Indices.size();
+    BaseVertex = range.vertex_offset;
+    FirstIndex = range.index_offset;
+    VA = geometry_pool.GetVAO(range);
+    VB = geometry_pool.GetVertexBuffer(range);
+    IB = geometry_pool.GetIndexBuffer(range);
 
-    // create and bind a VAO to hold state for this model
-    glGenVertexArrays( 1, &VA );
-    glBindVertexArray( VA );
+    geometry_pool.Upload(range,Vertices,Indices);
+}
 
-    // Populate a vertex buffer
-    glGenBuffers( 1, &VB );
-    glBindBuffer( GL_ARRAY_BUFFER, VB );
-    glBufferData( GL_ARRAY_BUFFER, sizeof( vr::RenderModel_Vertex_t_rgb ) * Vertices.size(), &Vertices[0], GL_STATIC_DRAW );
 
-    // Identify the components in the vertex buffer
+/*!
+ * \brief set up per-instance data, so the pooled geometry gets drawn once per instance
+ *
+ * This has to be called after Init(), since the pooled geometry may have moved to a
+ * different block. An empty list turns instancing off again.
+ */
+void Mesh::MeshEntry::InitInstances(const std::vector<vr::RenderModel_Instance_t_rgb>& Instances)
+{
+    NumInstances = Instances.size();
+    if(NumInstances==0 || VB == INVALID_OGL_VALUE){
+        NumInstances = 0;
+        return;
+    }
+
+    /// Bounding sphere of the whole set, and the biggest single instance, for picking the level of detail
+    Vector3 center(0,0,0);
+    for(unsigned int idx=0;idx<NumInstances;idx++){
+        center+=Vector3(Instances[idx].vOffset.v[0],Instances[idx].vOffset.v[1],Instances[idx].vOffset.v[2]);
+    }
+    BoundCenter = center/float(NumInstances);
+    BoundRadius = 0;
+    ElementRadius = 0;
+    for(unsigned int idx=0;idx<NumInstances;idx++){
+        Vector3 offset(Instances[idx].vOffset.v[0],Instances[idx].vOffset.v[1],Instances[idx].vOffset.v[2]);
+        BoundRadius = std::max(BoundRadius,(offset-BoundCenter).length());
+        ElementRadius = std::max(ElementRadius,std::max(Instances[idx].vScale.v[0],std::max(Instances[idx].vScale.v[1],Instances[idx].vScale.v[2])));
+    }
+
+    if(InstanceVA == INVALID_OGL_VALUE){
+        glGenVertexArrays( 1, &InstanceVA );
+        glGenBuffers( 1, &InstanceVB );
+    }
+    glBindVertexArray( InstanceVA );
+
+    // Point at the shared geometry, same layout as the pool's own VAO
+    glBindBuffer( GL_ARRAY_BUFFER, VB );
     glEnableVertexAttribArray( 0 );
     glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vPosition ) );
     glEnableVertexAttribArray( 1 );
     glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vNormal ) );
     glEnableVertexAttribArray( 2 );
     glVertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vColor ) );
-
-    // Create and populate the index buffer
-    glGenBuffers( 1, &IB );
     glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, IB );
-    glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof( u_int32_t ) * NumIndices, &Indices[0], GL_STATIC_DRAW );
+
+    // Populate the instance buffer, only reallocating when it grows
+    glBindBuffer( GL_ARRAY_BUFFER, InstanceVB );
+    if(NumInstances > InstanceCapacity){
+        InstanceCapacity = NumInstances;
+        glBufferData( GL_ARRAY_BUFFER, sizeof( vr::RenderModel_Instance_t_rgb ) * InstanceCapacity, &Instances[0], GL_DYNAMIC_DRAW );
+    }else{
+        glBufferSubData( GL_ARRAY_BUFFER, 0, sizeof( vr::RenderModel_Instance_t_rgb ) * NumInstances, &Instances[0] );
+    }
+    glEnableVertexAttribArray( 3 );
+    glVertexAttribPointer( 3, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Instance_t_rgb ), (void *)offsetof( vr::RenderModel_Instance_t_rgb, vOffset ) );
+    glVertexAttribDivisor( 3, 1 );
+    glEnableVertexAttribArray( 4 );
+    glVertexAttribPointer( 4, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Instance_t_rgb ), (void *)offsetof( vr::RenderModel_Instance_t_rgb, vColor ) );
+    glVertexAttribDivisor( 4, 1 );
+    glEnableVertexAttribArray( 5 );
+    glVertexAttribPointer( 5, 4, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Instance_t_rgb ), (void *)offsetof( vr::RenderModel_Instance_t_rgb, vRotation ) );
+    glVertexAttribDivisor( 5, 1 );
+    glEnableVertexAttribArray( 6 );
+    glVertexAttribPointer( 6, 4, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Instance_t_rgb ), (void *)offsetof( vr::RenderModel_Instance_t_rgb, vScale ) );
+    glVertexAttribDivisor( 6, 1 );
 
     glBindVertexArray( 0 );
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
 
+/*!
+ * \brief draw one of the shared primitive templates instead of our own geometry
+ *
+ * Defaults to the finest level of detail, RenderScene picks the actual level each frame.
+ */
+void Mesh::MeshEntry::InitTemplate(int template_type)
+{
+    if(Template!=template_type || range.valid()){
+        Release();
+    }
+    Template = template_type;
+    const PrimitiveTemplate &prim = templates[template_type];
+    VA = geometry_pool.GetVAO(prim.range);
+    VB = geometry_pool.GetVertexBuffer(prim.range);
+    IB = geometry_pool.GetIndexBuffer(prim.range);
+    NumIndices = prim.NumIndices[NUM_LODS-1];
+    FirstIndex = prim.FirstIndex[NUM_LODS-1];
+    BaseVertex = prim.BaseVertex[NUM_LODS-1];
+}
+
+/*!
+ * \brief pick a level of detail for a template primitive
+ * \param projected_radius roughly how many pixels the primitive's radius covers
+ * \return 0 (coarsest) to NUM_LODS-1 (finest)
+ */
+int Mesh::ChooseLOD(float projected_radius)
+{
+    if(projected_radius<4.0){
+        return 0;
+    }else if(projected_radius<16.0){
+        return 1;
+    }else if(projected_radius<64.0){
+        return 2;
+    }
+    return NUM_LODS-1;
 }
 
 
@@ -113,6 +305,15 @@ Mesh::Mesh()
     scale.y=1.0;
     scale.z=1.0;
     Z_UP=false;
+    text_run_height=0.0;
+    text_generation=0;
+    needs_delete=false;
+    frame_locked=true;
+    pose_stale=true;
+    hud=false;
+    fixed_pose=Matrix4().identity();
+    pose=Matrix4().identity();
+    asset=NULL;
 }
 
 
@@ -127,6 +328,10 @@ void Mesh::Clear()
     for (unsigned int i = 0 ; i < m_Textures.size() ; i++) {
         SAFE_DELETE(m_Textures[i]);
     }
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        m_Entries[i].Release();
+    }
+    m_Entries.clear();
 }
 
 
@@ -174,7 +379,7 @@ Vector4 Mesh::sphere2cart(float azimuth, float elevation, float radius)
     return cart;
 }
 
-void Mesh::AddColorVertex(Vector4 pt,Vector4 normal,Vector3 color, std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices)
+static vr::RenderModel_Vertex_t_rgb ColorVertex(Vector4 pt,Vector4 normal,Vector3 color)
 {
     vr::RenderModel_Vertex_t_rgb v;
     v.vPosition.v[0]=pt.x;
@@ -186,10 +391,14 @@ void Mesh::AddColorVertex(Vector4 pt,Vector4 normal,Vector3 color, std::vector<v
     v.vNormal.v[0]=normal.x;
     v.vNormal.v[1]=normal.y;
     v.vNormal.v[2]=normal.z;
+    return v;
+}
 
+void Mesh::AddColorVertex(Vector4 pt,Vector4 normal,Vector3 color, std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices)
+{
     /// We are being inefficient and adding indices redundantly.
     Indices.push_back(Vertices.size());
-    Vertices.push_back(v);
+    Vertices.push_back(ColorVertex(pt,normal,color));
 
 }
 
@@ -205,12 +414,64 @@ void Mesh::AddColorTri(Vector4 pt1, Vector4 pt2, Vector4 pt3, Vector3 color, std
     AddColorVertex(pt3,normal,color,Vertices,Indices);
 }
 
+/*!
+ * \brief the transform from a marker's frame to its pose, scaled into vr units
+ */
+Matrix4 Mesh::PoseMatrix(const geometry_msgs::Pose& pose, float scaling_factor)
+{
+    Matrix4 mat4;
+    mat4.translate(pose.position.x*scaling_factor,pose.position.y*scaling_factor,pose.position.z*scaling_factor);
+
+    Matrix4 mat5;
+    tf::Quaternion q(pose.orientation.x,
+                     pose.orientation.y,
+                     pose.orientation.z,
+                     pose.orientation.w);
+    tf::Matrix3x3 m(q);
+    mat5.set(m.getColumn(0).getX(),
+             m.getColumn(0).getY(),
+             m.getColumn(0).getZ(),0,
+             m.getColumn(1).getX(),
+             m.getColumn(1).getY(),
+             m.getColumn(1).getZ(),0,
+             m.getColumn(2).getX(),
+             m.getColumn(2).getY(),
+             m.getColumn(2).getZ(),0,
+             0,0,0,1);
+
+    //mat5.rotate(q.getAngle(),q.getAxis().getX(),q.getAxis().getY(),q.getAxis().getZ());
+    return mat4*mat5;
+}
+
+/*!
+ * \brief tessellate part of a TRIANGLE_LIST marker
+ *
+ * Doesn't touch any Mesh state, so it is safe to call from a worker thread.
+ *
+ * \param first_triangle   first triangle of the marker to include
+ * \param num_triangles    how many triangles to include
+ */
+void Mesh::TessellateTriangles(const visualization_msgs::Marker& marker, float scaling_factor,
+                               size_t first_triangle, size_t num_triangles,
+                               std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices)
+{
+    Vector3 color(marker.color.r,marker.color.g,marker.color.b);
+    Vector3 radius(marker.scale.x/2.0*scaling_factor,marker.scale.y/2.0*scaling_factor,marker.scale.z/2.0*scaling_factor);
+    InitTriangles(Vertices,Indices,PoseMatrix(marker.pose,scaling_factor),radius,marker.points,marker.colors,color,first_triangle,num_triangles);
+}
+
 void Mesh::InitMarker(float scaling_factor)
 {
+    /// Streamed markers can have several entries, marker types built here only ever have one
+    for(size_t idx=1;idx<m_Entries.size();idx++){
+        m_Entries[idx].Release();
+    }
     m_Entries.resize(1);
     m_Entries[0].MaterialIndex=NO_TEXTURE;
     std::vector<vr::RenderModel_Vertex_t_rgb> Vertices;
     std::vector<u_int32_t> Indices;
+    std::vector<vr::RenderModel_Instance_t_rgb> Instances;
+    GLenum mode=GL_TRIANGLES;
 
     Vector4 pt;
     /// We scale up from real world units to 'vr units'
@@ -219,55 +480,153 @@ void Mesh::InitMarker(float scaling_factor)
     pt.z=marker.pose.position.z*scaling_factor;
     pt.w=1.f;
 
-    Matrix4 mat4;
-    mat4.translate(pt.x,pt.y,pt.z);
-
     Vector3 color(marker.color.r,
                   marker.color.g,
                   marker.color.b);
-    Matrix4 mat5;
     tf::Quaternion q(marker.pose.orientation.x,
                      marker.pose.orientation.y,
                      marker.pose.orientation.z,
                      marker.pose.orientation.w);
-    tf::Matrix3x3 m(q);
-    mat5.set(m.getColumn(0).getX(),
-             m.getColumn(0).getY(),
-             m.getColumn(0).getZ(),0,
-             m.getColumn(1).getX(),
-             m.getColumn(1).getY(),
-             m.getColumn(1).getZ(),0,
-             m.getColumn(2).getX(),
-             m.getColumn(2).getY(),
-             m.getColumn(2).getZ(),0,
-             0,0,0,1);
-
-    //mat5.rotate(q.getAngle(),q.getAxis().getX(),q.getAxis().getY(),q.getAxis().getZ());
-    Matrix4 mat6 = mat4*mat5;
+    Matrix4 mat6 = PoseMatrix(marker.pose,scaling_factor);
 
     Vector3 radius(marker.scale.x/2.0*scaling_factor,marker.scale.y/2.0*scaling_factor,marker.scale.z/2.0*scaling_factor);
 
-    if(marker.type==visualization_msgs::Marker::ARROW){
-
+    Vector4 rotation(q.x(),q.y(),q.z(),q.w());
+    int template_type=-1;
 
+    if(marker.type==visualization_msgs::Marker::ARROW){
+        template_type=TEMPLATE_ARROW;
+        Instances.resize(1);
+        if(marker.points.size()==2){
+            /// From the first point to the second. scale.x is the shaft diameter, scale.y the head diameter,
+            /// and scale.z the head length, or 0 for the default
+            Vector4 start = mat6 * Vector4( marker.points[0].x*scaling_factor, marker.points[0].y*scaling_factor, marker.points[0].z*scaling_factor, 1.0 );
+            Vector4 end   = mat6 * Vector4( marker.points[1].x*scaling_factor, marker.points[1].y*scaling_factor, marker.points[1].z*scaling_factor, 1.0 );
+            SetArrowInstance(Instances[0],start,end,color,marker.scale.x*scaling_factor,marker.scale.y*scaling_factor,marker.scale.z*scaling_factor);
+        }else{
+            /// Along the pose's x axis. scale.x is the length, scale.y and scale.z the width and height of the
+            /// shaft, with the head twice as wide. Arrows are round, so those two get averaged.
+            float shaft_radius=(radius.y+radius.z)/2.0;
+            SetInstance(Instances[0],pt,color,rotation,Vector3(marker.scale.x*scaling_factor,shaft_radius,shaft_radius*2.0),0.23);
+        }
     }else if(marker.type==visualization_msgs::Marker::CUBE){
-
-        InitCube(Vertices,Indices,radius,color,mat6);
+        /// The cube template is 1 on a side
+        template_type=TEMPLATE_CUBE;
+        Instances.resize(1);
+        SetInstance(Instances[0],pt,color,rotation,radius*2.0f);
     }else if(marker.type==visualization_msgs::Marker::SPHERE){
-        /// scale.x should be diameter, so radius.x is radius
-        InitSphere(Vertices,Indices,radius.x,color,pt);
+        /// scale is the diameter along each axis, and the sphere template has a radius of 1
+        template_type=TEMPLATE_SPHERE;
+        Instances.resize(1);
+        SetInstance(Instances[0],pt,color,rotation,radius);
     }else if(marker.type==visualization_msgs::Marker::CYLINDER){
-        /// scale.x is diameter in x direction (currently don't support ellipse)
-        float length=marker.scale.z*scaling_factor; /// Use scale.z to specify the height.
-        InitCylinder(Vertices,Indices,mat6,radius.x,length,color);
+        /// scale.x and scale.y are the diameters, scale.z is the height. The template is radius 1, height 1.
+        template_type=TEMPLATE_CYLINDER;
+        Instances.resize(1);
+        SetInstance(Instances[0],pt,color,rotation,Vector3(radius.x,radius.y,marker.scale.z*scaling_factor));
     }else if(marker.type==visualization_msgs::Marker::TEXT_VIEW_FACING){
         float height=marker.scale.z*scaling_factor; /// Only scale.z is used. scale.z specifies the height of an uppercase "A".
-        //pVRVizApplication->AddTextToScene(mat4,texturedvertdataarray,marker.text,height);
+        /// The glyphs are placed relative to the anchor and turned to face the viewer in the shader,
+        /// so moving the marker doesn't mean rebuilding the text
+        text_anchor=Vector3(pt.x,pt.y,pt.z);
+        m_Entries[0].MaterialIndex=SDF_TEXT;
+        if(m_Entries[0].NumIndices>0 && text_run==marker.text && text_run_height==height){
+            initialized=true;
+            needs_update=false;
+            return;
+        }
+        text_atlas.BuildRun(marker.text,height,Vertices,Indices);
+        text_run=marker.text;
+        text_run_height=height;
+        text_generation=++text_generations;
     }else if(marker.type==visualization_msgs::Marker::TRIANGLE_LIST){
-        InitTriangles(Vertices,Indices,mat6,radius,marker.points,marker.colors,color);
+        InitTriangles(Vertices,Indices,mat6,radius,marker.points,marker.colors,color,0,marker.points.size()/3);
+    }else if(marker.type==visualization_msgs::Marker::LINE_LIST){
+        mode=GL_LINES;
+        InitLines(Vertices,Indices,mat6,scaling_factor,marker.points,marker.colors,color,false);
+    }else if(marker.type==visualization_msgs::Marker::LINE_STRIP){
+        mode=GL_LINES;
+        InitLines(Vertices,Indices,mat6,scaling_factor,marker.points,marker.colors,color,true);
+    }else if(marker.type==visualization_msgs::Marker::POINTS){
+        mode=GL_POINTS;
+        InitPoints(Vertices,Indices,mat6,scaling_factor,marker.points,marker.colors,color);
+    }else if(marker.type==visualization_msgs::Marker::CUBE_LIST){
+        /// Every element is an instance of the cube template
+        template_type=TEMPLATE_CUBE;
+        InitInstances(Instances,mat6,scaling_factor,marker.points,marker.colors,color,rotation,radius*2.0f);
+    }else if(marker.type==visualization_msgs::Marker::SPHERE_LIST){
+        template_type=TEMPLATE_SPHERE;
+        InitInstances(Instances,mat6,scaling_factor,marker.points,marker.colors,color,rotation,radius);
+    }else if(marker.type==visualization_msgs::Marker::MESH_RESOURCE){
+        /// No geometry of our own, RenderScene draws the shared asset with this transform
+        asset=asset_cache.Acquire(marker.mesh_resource);
+        Matrix4 mesh_scale;
+        mesh_scale.scale(marker.scale.x*scaling_factor,marker.scale.y*scaling_factor,marker.scale.z*scaling_factor);
+        trans=mat6*mesh_scale;
+    }
+
+    if(marker.type!=visualization_msgs::Marker::TEXT_VIEW_FACING){
+        text_run.clear();
+    }
+    if(marker.type!=visualization_msgs::Marker::MESH_RESOURCE){
+        asset=NULL;
     }
 
-    m_Entries[0].Init(Vertices,Indices);
+    m_Entries[0].Mode=mode;
+    m_Entries[0].Width=marker.scale.x*scaling_factor;
+    if(template_type>=0 && !Instances.empty()){
+        InitTemplateInstances(template_type,Instances);
+    }else{
+        /// An empty list ends up here too, and just draws nothing
+        m_Entries[0].Init(Vertices,Indices);
+        m_Entries[0].InitInstances(Instances);
+    }
+    initialized=true;
+    needs_update=false;
+}
+
+/*!
+ * \brief draw copies of one of the shared templates, as one of this mesh's entries
+ */
+void Mesh::InitTemplateInstances(int template_type, const std::vector<vr::RenderModel_Instance_t_rgb> &Instances, unsigned int entry)
+{
+    InitTemplates();
+    m_Entries[entry].InitTemplate(template_type);
+    m_Entries[entry].InitInstances(Instances);
+}
+
+/*!
+ * \brief an arrow at every pose of a PoseArray, drawn like AMCL's particle cloud in rviz
+ *
+ * They are all instances of the arrow template, so even thousands of particles are one draw call.
+ *
+ * \param poses          the poses, in frame_id
+ * \param color          color of every arrow
+ * \param arrow_length   in ROS units
+ */
+void Mesh::InitPoseArray(const std::vector<geometry_msgs::Pose>& poses, float scaling_factor, Vector3 color, float arrow_length)
+{
+    for(size_t idx=1;idx<m_Entries.size();idx++){
+        m_Entries[idx].Release();
+    }
+    m_Entries.resize(1);
+    m_Entries[0].MaterialIndex=NO_TEXTURE;
+    m_Entries[0].Mode=GL_TRIANGLES;
+
+    /// Same proportions as rviz's PoseArray arrows
+    float length=arrow_length*scaling_factor;
+    std::vector<vr::RenderModel_Instance_t_rgb> Instances(poses.size());
+    for(size_t idx=0;idx<poses.size();idx++){
+        const geometry_msgs::Pose &pose=poses[idx];
+        Vector4 pt(pose.position.x*scaling_factor,pose.position.y*scaling_factor,pose.position.z*scaling_factor,1.0);
+        Vector4 rotation(pose.orientation.x,pose.orientation.y,pose.orientation.z,pose.orientation.w);
+        SetInstance(Instances[idx],pt,color,rotation,Vector3(length,length/30.0,length/10.0),0.23);
+    }
+    if(Instances.empty()){
+        m_Entries[0].Release();
+    }else{
+        InitTemplateInstances(TEMPLATE_ARROW,Instances);
+    }
     initialized=true;
     needs_update=false;
 }
@@ -304,112 +663,369 @@ void Mesh::InitCube(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::ve
     AddColorTri(C,G,F,color,Vertices,Indices);
 }
 
-void Mesh::InitSphere(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, float radius, Vector3 color, Vector4 center, int num_lat, int num_lon )
+/*!
+ * \brief unit sphere with shared vertices and smooth normals, for the sphere template
+ * \param num_lat number of rings from pole to pole
+ * \param num_lon number of segments around, defaults to twice num_lat
+ */
+void Mesh::InitSphere(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, int num_lat, int num_lon )
 {
-    bool smooth=false; //!< If we compute normals per vert, we could get nice smooth shapes.
     if(num_lon<=0){
         /// Default to twice the latitudes, since longitude goes -180 to +180 and latitude only goes -90 to +90
         num_lon=num_lat*2;
     }
+    u_int32_t start=Vertices.size();
+    Vector3 white(1,1,1);
+    /// One extra column so the seam gets its own vertices and the ring closes
+    for(int lat=0;lat<=num_lat;lat++)
+    {
+        for(int lon=0;lon<=num_lon;lon++)
+        {
+            /// The normal is just the point on the unit sphere. Weird, huh?
+            Vector4 pt=sphere2cart(lon/float(num_lon)*M_PI*2,lat/float(num_lat)*M_PI,1.0);
+            Vertices.push_back(ColorVertex(pt,Vector4(pt.x,pt.y,pt.z,0.0),white));
+        }
+    }
+    int row=num_lon+1;
     for(int lat=0;lat<num_lat;lat++)
     {
         for(int lon=0;lon<num_lon;lon++)
         {
-            float azimuth1=(lon  )/float(num_lon)*M_PI*2;
-            float azimuth2=(lon+1)/float(num_lon)*M_PI*2;
-            float elevation1=(lat  )/float(num_lat)*M_PI;
-            float elevation2=(lat+1)/float(num_lat)*M_PI;
-
-            Vector4 p1=center+sphere2cart(azimuth1,elevation1,radius);
-            Vector4 p2=center+sphere2cart(azimuth2,elevation1,radius);
-            Vector4 p3=center+sphere2cart(azimuth2,elevation2,radius);
-            Vector4 p4=center+sphere2cart(azimuth1,elevation2,radius);
-
-            if(smooth){
-                /// The normal could actually just be the point (normalized). Weird, huh?
-                Vector4 n1=sphere2cart(azimuth1,elevation1,1.0);
-                Vector4 n2=sphere2cart(azimuth2,elevation1,1.0);
-                Vector4 n3=sphere2cart(azimuth2,elevation2,1.0);
-                Vector4 n4=sphere2cart(azimuth1,elevation2,1.0);
-                /// The top and bottom ring have zero size elements. Skip those.
-                if(lat!=0){
-                    AddColorVertex( p1, n1, color, Vertices, Indices );
-                    AddColorVertex( p2, n2, color, Vertices, Indices );
-                    AddColorVertex( p3, n3, color, Vertices, Indices );
-                }
-                if(lat!=num_lat-1){
-                    AddColorVertex( p3, n3, color, Vertices, Indices );
-                    AddColorVertex( p1, n1, color, Vertices, Indices );
-                    AddColorVertex( p4, n4, color, Vertices, Indices );
-                }
-            }else{
-                /// The top and bottom ring have zero size elements. Skip those.
-                if(lat!=0){
-                    AddColorTri( p3,p2,p1,color,Vertices,Indices);
-                }
-                if(lat!=num_lat-1){
-                    AddColorTri( p3,p1,p4,color,Vertices,Indices);
-                }
+            u_int32_t a=start+lat*row+lon;
+            u_int32_t b=a+1;
+            u_int32_t c=a+row;
+            u_int32_t d=c+1;
+            /// The top and bottom ring have zero size elements. Skip those.
+            if(lat!=0){
+                Indices.push_back(a);
+                Indices.push_back(c);
+                Indices.push_back(b);
+            }
+            if(lat!=num_lat-1){
+                Indices.push_back(b);
+                Indices.push_back(c);
+                Indices.push_back(d);
             }
-
-
         }
     }
 }
 
 //-----------------------------------------------------------------------------
-// Purpose:
+// Purpose: Cylinder of radius 1 and height 1 along z, centered on the origin.
+//          The sides get smooth normals, the caps get flat ones.
 //-----------------------------------------------------------------------------
-void Mesh::InitCylinder( std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, Matrix4 mat, float radius, float length, Vector3 color, int num_facets )
+void Mesh::InitCylinder( std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, int num_facets )
 {
+    Vector3 white(1,1,1);
 
-    Vector4 Top = mat * Vector4( 0, 0, -length/2, 1 );
-    Vector4 Bot = mat * Vector4( 0, 0,  length/2, 1 );
-    std::vector<Vector4> Top_Ring;
-    std::vector<Vector4> Bot_Ring;
-    for(int ii=0;ii<num_facets;ii++){
+    //Side, one extra pair so the seam closes
+    u_int32_t side=Vertices.size();
+    for(int ii=0;ii<=num_facets;ii++){
         float angle = ii*M_PI*2.0/num_facets;
-        Vector4 top_vert = mat * Vector4( radius*sin(angle), radius*cos(angle), -length/2, 1 );
-        Top_Ring.push_back(top_vert);
-        Vector4 bot_vert = mat * Vector4( radius*sin(angle), radius*cos(angle),  length/2, 1 );
-        Bot_Ring.push_back(bot_vert);
+        Vector4 normal( cos(angle), sin(angle), 0, 0 );
+        Vertices.push_back(ColorVertex(Vector4( cos(angle), sin(angle), -0.5, 1 ),normal,white));
+        Vertices.push_back(ColorVertex(Vector4( cos(angle), sin(angle),  0.5, 1 ),normal,white));
+    }
+    for(int ii=0;ii<num_facets;ii++){
+        u_int32_t b0=side+2*ii;
+        u_int32_t t0=b0+1;
+        u_int32_t b1=b0+2;
+        u_int32_t t1=b0+3;
+        Indices.push_back(b0);
+        Indices.push_back(b1);
+        Indices.push_back(t0);
+        Indices.push_back(t0);
+        Indices.push_back(b1);
+        Indices.push_back(t1);
+    }
+
+    //Top and bottom pinwheels
+    for(int cap=0;cap<2;cap++){
+        float z = cap ? 0.5 : -0.5;
+        Vector4 normal( 0, 0, cap ? 1.0 : -1.0, 0 );
+        u_int32_t center=Vertices.size();
+        Vertices.push_back(ColorVertex(Vector4( 0, 0, z, 1 ),normal,white));
+        for(int ii=0;ii<=num_facets;ii++){
+            float angle = ii*M_PI*2.0/num_facets;
+            Vertices.push_back(ColorVertex(Vector4( cos(angle), sin(angle), z, 1 ),normal,white));
+        }
+        for(int ii=0;ii<num_facets;ii++){
+            Indices.push_back(center);
+            Indices.push_back(cap ? center+1+ii : center+2+ii);
+            Indices.push_back(cap ? center+2+ii : center+1+ii);
+        }
     }
+}
 
+/*!
+ * \brief arrow along +x, for the arrow template
+ *
+ * The shaft runs from x=0 to 1 and the head from x=2 to 3, both with a radius of 1.
+ * The gap tells the instanced shader which part a vertex belongs to. It scales the
+ * shaft and head separately, so one template covers any arrow proportions.
+ */
+void Mesh::InitArrow( std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, int num_facets )
+{
+    Vector3 white(1,1,1);
 
+    //Shaft, one extra pair so the seam closes
+    u_int32_t side=Vertices.size();
+    for(int ii=0;ii<=num_facets;ii++){
+        float angle = ii*M_PI*2.0/num_facets;
+        Vector4 normal( 0, cos(angle), sin(angle), 0 );
+        Vertices.push_back(ColorVertex(Vector4( 0, cos(angle), sin(angle), 1 ),normal,white));
+        Vertices.push_back(ColorVertex(Vector4( 1, cos(angle), sin(angle), 1 ),normal,white));
+    }
     for(int ii=0;ii<num_facets;ii++){
-        int idx1=ii;
-        int idx2=(ii+1)%num_facets;
+        u_int32_t b0=side+2*ii;
+        u_int32_t t0=b0+1;
+        u_int32_t b1=b0+2;
+        u_int32_t t1=b0+3;
+        Indices.push_back(b0);
+        Indices.push_back(b1);
+        Indices.push_back(t0);
+        Indices.push_back(t0);
+        Indices.push_back(b1);
+        Indices.push_back(t1);
+    }
 
-        //Top Pinwheel
-        AddColorTri( Top,Top_Ring[idx1],Top_Ring[idx2],color,Vertices,Indices);
+    //Head, with the tip split per facet so each side gets its own normal
+    u_int32_t head=Vertices.size();
+    for(int ii=0;ii<=num_facets;ii++){
+        float angle = ii*M_PI*2.0/num_facets;
+        float mid = (ii+0.5)*M_PI*2.0/num_facets;
+        Vertices.push_back(ColorVertex(Vector4( 2, cos(angle), sin(angle), 1 ),Vector4( M_SQRT1_2, cos(angle)*M_SQRT1_2, sin(angle)*M_SQRT1_2, 0 ),white));
+        Vertices.push_back(ColorVertex(Vector4( 3, 0, 0, 1 ),Vector4( M_SQRT1_2, cos(mid)*M_SQRT1_2, sin(mid)*M_SQRT1_2, 0 ),white));
+    }
+    for(int ii=0;ii<num_facets;ii++){
+        Indices.push_back(head+2*ii);
+        Indices.push_back(head+2*ii+2);
+        Indices.push_back(head+2*ii+1);
+    }
 
-        //Bottom Pinwheel
-        AddColorTri( Bot,Bot_Ring[idx1],Bot_Ring[idx2],color,Vertices,Indices);
+    //Back of the shaft and back of the head
+    for(int cap=0;cap<2;cap++){
+        float x = cap ? 2.0 : 0.0;
+        Vector4 normal( -1, 0, 0, 0 );
+        u_int32_t center=Vertices.size();
+        Vertices.push_back(ColorVertex(Vector4( x, 0, 0, 1 ),normal,white));
+        for(int ii=0;ii<=num_facets;ii++){
+            float angle = ii*M_PI*2.0/num_facets;
+            Vertices.push_back(ColorVertex(Vector4( x, cos(angle), sin(angle), 1 ),normal,white));
+        }
+        for(int ii=0;ii<num_facets;ii++){
+            Indices.push_back(center);
+            Indices.push_back(center+2+ii);
+            Indices.push_back(center+1+ii);
+        }
+    }
+}
 
-        //Side
-        AddColorTri( Bot_Ring[idx1],Bot_Ring[idx2],Top_Ring[idx2],color,Vertices,Indices);
-        AddColorTri( Top_Ring[idx2],Top_Ring[idx1],Bot_Ring[idx1],color,Vertices,Indices);
+/*!
+ * \brief tessellate the unit primitives at every level of detail, once
+ *
+ * The pool only gets cleared at shutdown, so once the sphere template is there they all are.
+ */
+void Mesh::InitTemplates()
+{
+    if(templates[TEMPLATE_SPHERE].range.valid()){
+        return;
+    }
+    for(int type=0;type<NUM_TEMPLATES;type++){
+        PrimitiveTemplate &prim = templates[type];
+        std::vector<vr::RenderModel_Vertex_t_rgb> Vertices;
+        std::vector<u_int32_t> Indices;
+        for(int lod=0;lod<NUM_LODS;lod++){
+            u_int32_t first_vertex=Vertices.size();
+            u_int32_t first_index=Indices.size();
+            /// Each level's indices count from the start of that level, BaseVertex takes care of the rest
+            std::vector<vr::RenderModel_Vertex_t_rgb> LodVertices;
+            std::vector<u_int32_t> LodIndices;
+            if(type==TEMPLATE_SPHERE){
+                InitSphere(LodVertices,LodIndices,3<<lod);
+            }else if(type==TEMPLATE_CYLINDER){
+                InitCylinder(LodVertices,LodIndices,6<<lod);
+            }else if(type==TEMPLATE_ARROW){
+                InitArrow(LodVertices,LodIndices,4<<lod);
+            }else if(lod==0){
+                InitCube(LodVertices,LodIndices,Vector3(0.5,0.5,0.5),Vector3(1,1,1),Matrix4().identity());
+            }else{
+                /// A cube is a cube at any distance
+                prim.NumIndices[lod]=prim.NumIndices[0];
+                prim.FirstIndex[lod]=prim.FirstIndex[0];
+                prim.BaseVertex[lod]=prim.BaseVertex[0];
+                continue;
+            }
+            Vertices.insert(Vertices.end(),LodVertices.begin(),LodVertices.end());
+            Indices.insert(Indices.end(),LodIndices.begin(),LodIndices.end());
+            prim.NumIndices[lod]=LodIndices.size();
+            prim.FirstIndex[lod]=first_index;
+            prim.BaseVertex[lod]=first_vertex;
+        }
+        if(!geometry_pool.Allocate(Vertices.size(),Indices.size(),prim.range)){
+            printf("Could not allocate template %d in geometry pool\n",type);
+            continue;
+        }
+        geometry_pool.Upload(prim.range,Vertices,Indices);
+        for(int lod=0;lod<NUM_LODS;lod++){
+            prim.FirstIndex[lod]+=prim.range.index_offset;
+            prim.BaseVertex[lod]+=prim.range.vertex_offset;
+        }
+    }
+}
 
+/*!
+ * \brief fill in one instance of a template
+ * \param arrow_head   for the arrow template, the head's share of the length. Then scale is (length, shaft radius, head radius)
+ */
+void Mesh::SetInstance(vr::RenderModel_Instance_t_rgb &instance, Vector4 offset, Vector3 color, Vector4 rotation, Vector3 scale, float arrow_head)
+{
+    instance.vOffset.v[0]=offset.x;
+    instance.vOffset.v[1]=offset.y;
+    instance.vOffset.v[2]=offset.z;
+    instance.vColor.v[0]=color.x;
+    instance.vColor.v[1]=color.y;
+    instance.vColor.v[2]=color.z;
+    instance.vRotation.v[0]=rotation.x;
+    instance.vRotation.v[1]=rotation.y;
+    instance.vRotation.v[2]=rotation.z;
+    instance.vRotation.v[3]=rotation.w;
+    instance.vScale.v[0]=scale.x;
+    instance.vScale.v[1]=scale.y;
+    instance.vScale.v[2]=scale.z;
+    instance.vScale.v[3]=arrow_head;
+}
+
+/*!
+ * \brief an arrow instance from one point to another, like the two point form of ARROW in rviz
+ * \param head_length  0 for rviz's default of 23% of the length
+ */
+void Mesh::SetArrowInstance(vr::RenderModel_Instance_t_rgb &instance, Vector4 start, Vector4 end, Vector3 color, float shaft_diameter, float head_diameter, float head_length)
+{
+    Vector3 dir(end.x-start.x,end.y-start.y,end.z-start.z);
+    float length=dir.length();
+    if(length<1e-6){
+        /// Nothing to point along, so draw nothing
+        SetInstance(instance,start,color,Vector4(0,0,0,1),Vector3(0,0,0),0.23);
+        return;
+    }
+    dir/=length;
+    float head=0.23;
+    if(head_length>0){
+        head=std::min(head_length,length)/length;
+    }
+    /// Shortest rotation from +x onto the direction
+    Vector4 rotation(0,-dir.z,dir.y,1.0+dir.x);
+    if(rotation.w<1e-6){
+        rotation=Vector4(0,0,1,0);
+    }else{
+        rotation/=sqrt(rotation.y*rotation.y+rotation.z*rotation.z+rotation.w*rotation.w);
     }
+    SetInstance(instance,start,color,rotation,Vector3(length,shaft_diameter/2.0,head_diameter/2.0),head);
 }
 
-void Mesh::InitTriangles(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices,Matrix4 mat, Vector3 radius,std::vector<geometry_msgs::Point> &points,std::vector<std_msgs::ColorRGBA> &colors, Vector3 default_color){
+/*!
+ * \brief build an indexed mesh out of a TRIANGLE_LIST, smooth shaded except across creases
+ *
+ * The message is triangle soup, so corners with the same position and color are
+ * welded back together, unless their faces meet at more than TRIANGLE_CREASE_ANGLE.
+ * So curved surfaces come out smooth, and boxes and CAD parts keep their flat faces
+ * the way rviz draws them. Then the triangles are reordered for the vertex cache.
+ */
+void Mesh::InitTriangles(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices,Matrix4 mat, Vector3 radius,const std::vector<geometry_msgs::Point> &points,const std::vector<std_msgs::ColorRGBA> &colors, Vector3 default_color, size_t first_triangle, size_t num_triangles){
     /// If the points aren't a multiple of 3, something is wrong
     assert(points.size()%3==0);
+    num_triangles=std::min(num_triangles,points.size()/3-std::min(first_triangle,points.size()/3));
     Vector4 scale(radius.x*2.0,radius.y*2.0,radius.z*2.0,1.0);
-    for(int idx=0;idx<points.size()/3;idx++){
+    /// rviz takes one color per point, or one per triangle
+    bool per_point_color=(colors.size()==points.size());
+    bool per_triangle_color=(colors.size()==points.size()/3);
+    std::vector<vr::RenderModel_Vertex_t_rgb> Corners;
+    Corners.reserve(num_triangles*3);
+    for(size_t idx=first_triangle*3;idx<(first_triangle+num_triangles)*3;idx+=3){
+        Vector4 pts[3];
+        for(int corner=0;corner<3;corner++){
+            const geometry_msgs::Point &point=points[idx+corner];
+            pts[corner] = mat * (Vector4( point.x, point.y, point.z, 1.0 )*scale);
+        }
+        /// The face normal, for the welding to tell where the creases are
+        Vector3 face=Vector3(pts[1].x-pts[0].x,pts[1].y-pts[0].y,pts[1].z-pts[0].z).cross(
+                     Vector3(pts[2].x-pts[0].x,pts[2].y-pts[0].y,pts[2].z-pts[0].z));
+        if(face.length()>0){
+            face.normalize();
+        }
+        for(int corner=0;corner<3;corner++){
+            Vector3 color=default_color;
+            if(per_point_color){
+                color=Vector3(colors[idx+corner].r,colors[idx+corner].g,colors[idx+corner].b);
+            }else if(per_triangle_color){
+                color=Vector3(colors[idx/3].r,colors[idx/3].g,colors[idx/3].b);
+            }
+            Corners.push_back(ColorVertex(pts[corner],Vector4(face.x,face.y,face.z,0),color));
+        }
+    }
+
+    std::vector<vr::RenderModel_Vertex_t_rgb> Welded;
+    std::vector<u_int32_t> WeldedIndices;
+    MeshTools::WeldVertices(Corners,Welded,WeldedIndices,cosf(TRIANGLE_CREASE_ANGLE*M_PI/180.0));
+    MeshTools::ComputeSmoothNormals(Welded,WeldedIndices);
+    MeshTools::OptimizeVertexCache(WeldedIndices,Welded.size());
+    MeshTools::OptimizeVertexFetch(Welded,WeldedIndices);
+
+    u_int32_t base=Vertices.size();
+    Vertices.insert(Vertices.end(),Welded.begin(),Welded.end());
+    Indices.reserve(Indices.size()+WeldedIndices.size());
+    for(int idx=0;idx<WeldedIndices.size();idx++){
+        Indices.push_back(base+WeldedIndices[idx]);
+    }
+}
+
+/*!
+ * \brief line segments, each with its own vertices so per-point colors work
+ * \param strip if true, connect every point to the next (LINE_STRIP), otherwise take them in pairs (LINE_LIST)
+ */
+void Mesh::InitLines(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, Matrix4 mat, float scaling_factor, std::vector<geometry_msgs::Point> &points, std::vector<std_msgs::ColorRGBA> &colors, Vector3 default_color, bool strip){
+    InitPoints(Vertices,Indices,mat,scaling_factor,points,colors,default_color);
+    Indices.clear();
+    if(strip){
+        for(int idx=1;idx<Vertices.size();idx++){
+            Indices.push_back(idx-1);
+            Indices.push_back(idx);
+        }
+    }else{
+        /// An odd point out at the end doesn't make a line, so drop it
+        for(int idx=1;idx<Vertices.size();idx+=2){
+            Indices.push_back(idx-1);
+            Indices.push_back(idx);
+        }
+    }
+}
+
+void Mesh::InitPoints(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, Matrix4 mat, float scaling_factor, std::vector<geometry_msgs::Point> &points, std::vector<std_msgs::ColorRGBA> &colors, Vector3 default_color){
+    /// Per-point colors only count if there is one for every point
+    bool per_point_color=(colors.size()==points.size());
+    Vertices.reserve(points.size());
+    Indices.reserve(points.size());
+    for(int idx=0;idx<points.size();idx++){
         Vector3 color=default_color;
-//        if(colors.size()>idx*3){
-//            /// Only grabbing one color
-//            color.x=colors[idx*3].r;
-//            color.y=colors[idx*3].g;
-//            color.z=colors[idx*3].b;
-//        }
-        Vector4 p1 = mat * (Vector4( points[idx*3+0].x, points[idx*3+0].y, points[idx*3+0].z, 1.0 )*scale);
-        Vector4 p2 = mat * (Vector4( points[idx*3+1].x, points[idx*3+1].y, points[idx*3+1].z, 1.0 )*scale);
-        Vector4 p3 = mat * (Vector4( points[idx*3+2].x, points[idx*3+2].y, points[idx*3+2].z, 1.0 )*scale);
+        if(per_point_color){
+            color=Vector3(colors[idx].r,colors[idx].g,colors[idx].b);
+        }
+        Vector4 pt = mat * Vector4( points[idx].x*scaling_factor, points[idx].y*scaling_factor, points[idx].z*scaling_factor, 1.0 );
+        AddColorVertex(pt,Vector4(0,0,0,0),color,Vertices,Indices);
+    }
+}
 
-        AddColorTri( p1,p2,p3,color,Vertices,Indices);
+void Mesh::InitInstances(std::vector<vr::RenderModel_Instance_t_rgb> &Instances, Matrix4 mat, float scaling_factor, std::vector<geometry_msgs::Point> &points, std::vector<std_msgs::ColorRGBA> &colors, Vector3 default_color, Vector4 rotation, Vector3 scale){
+    bool per_point_color=(colors.size()==points.size());
+    Instances.resize(points.size());
+    for(int idx=0;idx<points.size();idx++){
+        Vector4 pt = mat * Vector4( points[idx].x*scaling_factor, points[idx].y*scaling_factor, points[idx].z*scaling_factor, 1.0 );
+        Vector3 color=default_color;
+        if(per_point_color){
+            color=Vector3(colors[idx].r,colors[idx].g,colors[idx].b);
+        }
+        SetInstance(Instances[idx],pt,color,rotation,scale);
     }
 }
 
@@ -635,6 +1251,18 @@ void Mesh::Render()
 
     for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
 
+        if (m_Entries[i].NumIndices == 0) {
+            continue;
+        }
+
+        if (m_Entries[i].NumInstances > 0) {
+            glBindVertexArray( m_Entries[i].InstanceVA );
+            glDrawElementsInstancedBaseVertex(m_Entries[i].Mode, m_Entries[i].NumIndices, GL_UNSIGNED_INT,
+                                              (void*)(sizeof(u_int32_t)*m_Entries[i].FirstIndex),
+                                              m_Entries[i].NumInstances, m_Entries[i].BaseVertex);
+            continue;
+        }
+
         glBindVertexArray( m_Entries[i].VA );
 
 
@@ -644,7 +1272,8 @@ void Mesh::Render()
             m_Textures[MaterialIndex]->Bind(GL_TEXTURE0);
         }
 
-        glDrawElements(GL_TRIANGLES, m_Entries[i].NumIndices, GL_UNSIGNED_INT, 0);
+        glDrawElementsBaseVertex(m_Entries[i].Mode, m_Entries[i].NumIndices, GL_UNSIGNED_INT,
+                                 (void*)(sizeof(u_int32_t)*m_Entries[i].FirstIndex), m_Entries[i].BaseVertex);
     }
 
 }
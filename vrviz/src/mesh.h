@@ -28,21 +28,28 @@
 #include "shared/Matrices.h"
 #include "texture.h"
 #include "openvr.h"
+#include "geometry_pool.h"
+#include "text_atlas.h"
+#include "asset_cache.h"
 #include "visualization_msgs/Marker.h"
 
 #define SAFE_DELETE(p) if (p) { delete p; p = NULL; }
+#define NUM_LODS 4
+/// Degrees. TRIANGLE_LIST faces meeting at more than this keep separate normals, like the edges of a box
+#define TRIANGLE_CREASE_ANGLE 30.0
 #define ASSIMP_LOAD_FLAGS (aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices | aiProcess_PreTransformVertices)
 #define INVALID_OGL_VALUE 0xffffffff
 
 
 namespace vr
 {
-/** A single vertex in a render model */
-struct RenderModel_Vertex_t_rgb
+/** Per-instance data for drawing many copies of one mesh (CUBE_LIST, SPHERE_LIST, template primitives) */
+struct RenderModel_Instance_t_rgb
 {
-    HmdVector3_t vPosition;		// position in meters in device space
-    HmdVector3_t vNormal;
+    HmdVector3_t vOffset;		// position of this copy, added to every vertex
     HmdVector3_t vColor;
+    HmdVector4_t vRotation;		// quaternion (x,y,z,w) applied before the offset
+    HmdVector4_t vScale;		// applied before the rotation. w is only used by arrows, see Mesh::InitArrow
 };
 }
 
@@ -72,6 +79,12 @@ public:
 
     bool LoadMesh(const std::string& Filename);
     void InitMarker(float scaling_factor=1.0);
+    void InitPoseArray(const std::vector<geometry_msgs::Pose>& poses, float scaling_factor, Vector3 color, float arrow_length);
+    static void TessellateTriangles(const visualization_msgs::Marker& marker, float scaling_factor,
+                                    size_t first_triangle, size_t num_triangles,
+                                    std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices);
+    static Matrix4 PoseMatrix(const geometry_msgs::Pose& pose, float scaling_factor);
+    void InitTemplateInstances(int template_type, const std::vector<vr::RenderModel_Instance_t_rgb> &Instances, unsigned int entry=0);
 
     void Render();
 
@@ -81,6 +94,10 @@ public:
     bool has_texture;
     bool initialized;
     bool needs_update;
+    bool needs_delete;          ///!< Set when the marker is deleted, the render thread frees it
+    bool frame_locked;          ///!< Follow frame_id every frame. Robot links always do, markers only if they ask to
+    bool pose_stale;            ///!< Set when a new marker arrives, so fixed_pose gets resolved at its stamp again
+    bool hud;                   ///!< Text attached to the HMD, drawn into the HUD layer instead of the world
 
     visualization_msgs::Marker marker;
 
@@ -89,21 +106,42 @@ public:
     Matrix4 trans;
     bool Z_UP;
 
+    Matrix4 fixed_pose;         ///!< frame_id in the base frame at header.stamp, for markers that aren't frame_locked
+    Matrix4 pose;               ///!< frame_id to vr world, set once a frame by UpdateMarkerPoses
+
+    Vector3 text_anchor;        ///!< Where TEXT_VIEW_FACING markers are centered, in vr units in frame_id
+    std::string text_run;       ///!< Text the current glyph run was built from
+    float text_run_height;
+    unsigned int text_generation;   ///!< Changes every time the glyph run is rebuilt, so the HUD knows to redraw
+
+    AssetCache::Asset* asset;   ///!< Shared mesh for MESH_RESOURCE markers, drawn instanced with everyone else using it
+
 private:
     bool InitFromScene(const aiScene* pScene, const std::string& Filename);
     Vector4 sphere2cart(float azimuth, float elevation, float radius);
     void AddColorVertex(Vector4 pt,Vector4 normal,Vector3 color, std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices);
     void AddColorTri(Vector4 pt1, Vector4 pt2, Vector4 pt3, Vector3 color, std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices);
     void InitCube(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, Vector3 radius, Vector3 color, Matrix4 mat );
-    void InitSphere(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, float radius, Vector3 color, Vector4 center, int num_lat=8, int num_lon=0 );
-    void InitCylinder( std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, Matrix4 mat, float radius, float length, Vector3 color, int num_facets=16 );
-    void InitTriangles(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices,Matrix4 mat,Vector3 radius, std::vector<geometry_msgs::Point> &points,std::vector<std_msgs::ColorRGBA> &colors, Vector3 default_color);
+    void InitSphere(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, int num_lat=8, int num_lon=0 );
+    void InitCylinder( std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, int num_facets=16 );
+    void InitArrow( std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, int num_facets=16 );
+    void InitTemplates();
+    void SetInstance(vr::RenderModel_Instance_t_rgb &instance, Vector4 offset, Vector3 color, Vector4 rotation, Vector3 scale, float arrow_head=0.0f);
+    void SetArrowInstance(vr::RenderModel_Instance_t_rgb &instance, Vector4 start, Vector4 end, Vector3 color, float shaft_diameter, float head_diameter, float head_length);
+    static void InitTriangles(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices,Matrix4 mat,Vector3 radius, const std::vector<geometry_msgs::Point> &points,const std::vector<std_msgs::ColorRGBA> &colors, Vector3 default_color, size_t first_triangle, size_t num_triangles);
+    void InitLines(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, Matrix4 mat, float scaling_factor, std::vector<geometry_msgs::Point> &points, std::vector<std_msgs::ColorRGBA> &colors, Vector3 default_color, bool strip);
+    void InitPoints(std::vector<vr::RenderModel_Vertex_t_rgb> &Vertices, std::vector<u_int32_t> &Indices, Matrix4 mat, float scaling_factor, std::vector<geometry_msgs::Point> &points, std::vector<std_msgs::ColorRGBA> &colors, Vector3 default_color);
+    void InitInstances(std::vector<vr::RenderModel_Instance_t_rgb> &Instances, Matrix4 mat, float scaling_factor, std::vector<geometry_msgs::Point> &points, std::vector<std_msgs::ColorRGBA> &colors, Vector3 default_color, Vector4 rotation, Vector3 scale);
     void InitMesh(unsigned int Index, const aiMesh* paiMesh, const aiNode* node);
     bool InitMaterials(const aiScene* pScene, const std::string& Filename);
     void Clear();
 
 #define INVALID_MATERIAL 0xFFFFFFFF
 #define NO_TEXTURE 0xFFFFFFFE
+#define SDF_TEXT 0xFFFFFFFD
+#define OCCUPANCY_GRID 0xFFFFFFFC
+#define HEIGHTFIELD 0xFFFFFFFB
+#define CAMERA_PLANE 0xFFFFFFFA
 
 public:
     struct MeshEntry {
@@ -115,14 +153,60 @@ public:
                   const std::vector<u_int32_t>& Indices);
         void Init(const std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices,
                   const std::vector<u_int32_t>& Indices);
+        void InitTemplate(int Template);
+        void InitInstances(const std::vector<vr::RenderModel_Instance_t_rgb>& Instances);
+        void Release();
 
         GLuint VB;
         GLuint VA;
         GLuint IB;
         unsigned int NumIndices;
         unsigned int MaterialIndex;
+        unsigned int BaseVertex;    ///!< Added to every index when drawing (nonzero for pooled geometry)
+        unsigned int FirstIndex;    ///!< Offset into the index buffer, in indices
+        PoolRange range;            ///!< Where in the geometry_pool this lives, if it is pooled
+        GLenum Mode;                ///!< GL_TRIANGLES, GL_LINES or GL_POINTS
+        float Width;                ///!< Width of lines, or diameter of points, in vr units
+        GLuint InstanceVA;          ///!< VAO binding the geometry plus the per-instance buffer
+        GLuint InstanceVB;
+        unsigned int NumInstances;  ///!< If nonzero, draw this many instances instead of one plain copy
+        unsigned int InstanceCapacity;
+        int Template;               ///!< Which of the shared templates this draws, or -1 for its own geometry
+        Vector3 BoundCenter;        ///!< Bounding sphere of all the instances, in vr units in frame_id
+        float BoundRadius;
+        float ElementRadius;        ///!< Size of one instance, for picking a level of detail
+        GLuint DataTexture;         ///!< Raw data the shader turns into color (e.g. an occupancy grid), owned by the entry
+        int DataOffset[2];          ///!< Texel where the data starts, it wraps around from there (grid_map's circular buffer)
+        float DataMin;              ///!< Range of the data, for coloring it
+        float DataMax;
     };
 
+    /// Shared buffers for all of the colored marker geometry
+    static GeometryPool geometry_pool;
+    /// Font for all of the text markers
+    static TextAtlas text_atlas;
+    /// Last text_generation handed out, unique across all meshes
+    static unsigned int text_generations;
+    /// Every mesh file a MESH_RESOURCE marker has asked for
+    static AssetCache asset_cache;
+
+    enum PrimitiveTemplateType { TEMPLATE_SPHERE, TEMPLATE_CYLINDER, TEMPLATE_CUBE, TEMPLATE_ARROW, NUM_TEMPLATES };
+
+    /*!
+     * \brief Unit primitive tessellated at several levels of detail, shared by all markers
+     *
+     * All of the levels live in one range of the geometry_pool, level 0 being the coarsest.
+     */
+    struct PrimitiveTemplate {
+        PoolRange range;
+        unsigned int NumIndices[NUM_LODS];
+        unsigned int FirstIndex[NUM_LODS];
+        unsigned int BaseVertex[NUM_LODS];
+    };
+    static PrimitiveTemplate templates[NUM_TEMPLATES];
+
+    static int ChooseLOD(float projected_radius);
+
     std::vector<MeshEntry> m_Entries;
     std::vector<Texture*> m_Textures;
 };
@@ -0,0 +1,230 @@
+#include <cstdio>
+#include <algorithm>
+#include "mesh_streamer.h"
+
+MeshStreamer::MeshStreamer()
+    : m_stop(false),
+      m_chunkTriangles(1<<16),
+      m_uploadBudget(4<<20)
+{
+}
+
+MeshStreamer::~MeshStreamer()
+{
+    Stop();
+}
+
+/*!
+ * \brief spin up the worker thread
+ * \param chunk_triangles   markers with more triangles than this get streamed, in chunks this big
+ * \param upload_budget     bytes of geometry uploaded per frame
+ */
+void MeshStreamer::Start(unsigned int chunk_triangles, unsigned int upload_budget)
+{
+    m_chunkTriangles=std::max(chunk_triangles,1u);
+    m_uploadBudget=upload_budget;
+    m_stop=false;
+    m_thread=boost::thread(&MeshStreamer::WorkerLoop,this);
+}
+
+/*!
+ * \brief stop the worker and forget about any work in flight
+ *
+ * The staged entries aren't released, since the geometry pool is about to be cleared anyway.
+ */
+void MeshStreamer::Stop()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_stop=true;
+        m_jobs.clear();
+        m_ready.clear();
+    }
+    m_jobReady.notify_all();
+    if(m_thread.joinable()){
+        m_thread.join();
+    }
+    m_staging.clear();
+}
+
+bool MeshStreamer::ShouldStream(const visualization_msgs::Marker& marker) const
+{
+    return marker.type==visualization_msgs::Marker::TRIANGLE_LIST && marker.points.size()/3>m_chunkTriangles;
+}
+
+/*!
+ * \brief queue a new version of a marker to be built in the background
+ *
+ * Anything still queued or in progress for the same mesh is superseded.
+ */
+void MeshStreamer::Submit(Mesh* mesh, const visualization_msgs::Marker& marker, float scaling_factor)
+{
+    /// Copy the marker before taking the lock, it can be big
+    Job job;
+    job.mesh=mesh;
+    job.marker=marker;
+    job.scaling_factor=scaling_factor;
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        job.generation=++m_generation[mesh];
+        for(std::deque<Job>::iterator it=m_jobs.begin();it!=m_jobs.end();){
+            if(it->mesh==mesh){
+                it=m_jobs.erase(it);
+            }else{
+                ++it;
+            }
+        }
+        m_jobs.push_back(job);
+    }
+    m_jobReady.notify_one();
+}
+
+/*!
+ * \brief drop any background work for a mesh, e.g. because it is now built the normal way
+ */
+void MeshStreamer::Cancel(Mesh* mesh)
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    std::map<Mesh*, unsigned int>::iterator found=m_generation.find(mesh);
+    if(found!=m_generation.end()){
+        found->second++;
+    }
+}
+
+bool MeshStreamer::IsCurrent(Mesh* mesh, unsigned int generation)
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    std::map<Mesh*, unsigned int>::const_iterator found=m_generation.find(mesh);
+    return found!=m_generation.end() && found->second==generation;
+}
+
+void MeshStreamer::WorkerLoop()
+{
+    while(true){
+        Job job;
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex);
+            while(!m_stop && m_jobs.empty()){
+                m_jobReady.wait(lock);
+            }
+            if(m_stop){
+                return;
+            }
+            job=m_jobs.front();
+            m_jobs.pop_front();
+        }
+
+        size_t num_triangles=job.marker.points.size()/3;
+        unsigned int num_chunks=(num_triangles+m_chunkTriangles-1)/m_chunkTriangles;
+        for(unsigned int idx=0;idx<num_chunks;idx++){
+            /// Give up as soon as a newer version shows up
+            if(!IsCurrent(job.mesh,job.generation)){
+                break;
+            }
+            Chunk chunk;
+            chunk.mesh=job.mesh;
+            chunk.generation=job.generation;
+            chunk.index=idx;
+            chunk.num_chunks=num_chunks;
+            size_t first=size_t(idx)*m_chunkTriangles;
+            Mesh::TessellateTriangles(job.marker,job.scaling_factor,first,std::min<size_t>(m_chunkTriangles,num_triangles-first),
+                                      chunk.Vertices,chunk.Indices);
+
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+            if(m_stop){
+                return;
+            }
+            m_ready.push_back(Chunk());
+            m_ready.back().mesh=chunk.mesh;
+            m_ready.back().generation=chunk.generation;
+            m_ready.back().index=chunk.index;
+            m_ready.back().num_chunks=chunk.num_chunks;
+            m_ready.back().Vertices.swap(chunk.Vertices);
+            m_ready.back().Indices.swap(chunk.Indices);
+        }
+    }
+}
+
+void MeshStreamer::ReleaseStaging(Staging& staging)
+{
+    for(size_t idx=0;idx<staging.entries.size();idx++){
+        staging.entries[idx].Release();
+    }
+    staging.entries.clear();
+    staging.num_uploaded=0;
+}
+
+/*!
+ * \brief upload finished chunks, and swap in any marker that is now complete
+ *
+ * Call once a frame from the render thread.
+ */
+void MeshStreamer::Upload()
+{
+    std::map<Mesh*, unsigned int> generation;
+    std::deque<Chunk> chunks;
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        if(m_ready.empty() && m_staging.empty()){
+            return;
+        }
+        /// Take chunks until the budget is used up, but always at least one
+        size_t bytes=0;
+        while(!m_ready.empty() && (chunks.empty() || bytes<m_uploadBudget)){
+            const Chunk& next=m_ready.front();
+            size_t next_bytes=next.Vertices.size()*sizeof(vr::RenderModel_Vertex_t_rgb)+next.Indices.size()*sizeof(u_int32_t);
+            if(!chunks.empty() && bytes+next_bytes>m_uploadBudget){
+                break;
+            }
+            bytes+=next_bytes;
+            chunks.push_back(Chunk());
+            chunks.back().mesh=next.mesh;
+            chunks.back().generation=next.generation;
+            chunks.back().index=next.index;
+            chunks.back().num_chunks=next.num_chunks;
+            chunks.back().Vertices.swap(m_ready.front().Vertices);
+            chunks.back().Indices.swap(m_ready.front().Indices);
+            m_ready.pop_front();
+        }
+        generation=m_generation;
+    }
+
+    /// Throw away anything that has been superseded or cancelled
+    for(std::map<Mesh*, Staging>::iterator it=m_staging.begin();it!=m_staging.end();){
+        if(generation[it->first]!=it->second.generation){
+            ReleaseStaging(it->second);
+            m_staging.erase(it++);
+        }else{
+            ++it;
+        }
+    }
+
+    for(size_t idx=0;idx<chunks.size();idx++){
+        Chunk& chunk=chunks[idx];
+        if(generation[chunk.mesh]!=chunk.generation){
+            continue;
+        }
+        Staging& staging=m_staging[chunk.mesh];
+        if(staging.entries.empty()){
+            staging.generation=chunk.generation;
+            staging.num_uploaded=0;
+            staging.entries.resize(chunk.num_chunks);
+        }
+        Mesh::MeshEntry& entry=staging.entries[chunk.index];
+        entry.MaterialIndex=NO_TEXTURE;
+        entry.Mode=GL_TRIANGLES;
+        entry.Init(chunk.Vertices,chunk.Indices);
+        staging.num_uploaded++;
+
+        if(staging.num_uploaded==staging.entries.size()){
+            /// Every chunk is up, so swap the whole thing in at once
+            Mesh* mesh=chunk.mesh;
+            for(size_t jj=0;jj<mesh->m_Entries.size();jj++){
+                mesh->m_Entries[jj].Release();
+            }
+            mesh->m_Entries.swap(staging.entries);
+            mesh->initialized=true;
+            m_staging.erase(mesh);
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef MESH_STREAMER_H
+#define	MESH_STREAMER_H
+
+#include <deque>
+#include <map>
+#include <vector>
+#include <boost/thread.hpp>
+#include "mesh.h"
+
+/*!
+ * \brief Builds very large TRIANGLE_LIST markers in the background
+ *
+ * Big reconstruction meshes used to be tessellated and uploaded in one go on the render
+ * thread, which dropped frames. Instead, the marker is split into chunks of a fixed
+ * number of triangles, each tessellated on a worker thread. The render thread uploads
+ * the finished chunks a few at a time, under a per-frame byte budget, into entries that
+ * aren't drawn yet. Once every chunk is up, they are swapped in all at once, so the old
+ * version of the marker stays visible until the new one is complete.
+ *
+ * Submit() and Cancel() can be called from any thread, Upload() and Stop() only from
+ * the render thread.
+ */
+class MeshStreamer
+{
+public:
+    MeshStreamer();
+
+    ~MeshStreamer();
+
+    void Start(unsigned int chunk_triangles, unsigned int upload_budget);
+    void Stop();
+
+    bool ShouldStream(const visualization_msgs::Marker& marker) const;
+    void Submit(Mesh* mesh, const visualization_msgs::Marker& marker, float scaling_factor);
+    void Cancel(Mesh* mesh);
+    void Upload();
+
+private:
+    struct Job {
+        Mesh* mesh;
+        visualization_msgs::Marker marker;
+        float scaling_factor;
+        unsigned int generation;
+    };
+
+    struct Chunk {
+        Mesh* mesh;
+        unsigned int generation;
+        unsigned int index;
+        unsigned int num_chunks;
+        std::vector<vr::RenderModel_Vertex_t_rgb> Vertices;
+        std::vector<u_int32_t> Indices;
+    };
+
+    /// Chunks that have been uploaded but aren't being drawn yet
+    struct Staging {
+        unsigned int generation;
+        unsigned int num_uploaded;
+        std::vector<Mesh::MeshEntry> entries;
+    };
+
+    void WorkerLoop();
+    bool IsCurrent(Mesh* mesh, unsigned int generation);
+    void ReleaseStaging(Staging& staging);
+
+    boost::thread m_thread;
+    boost::mutex m_mutex;                   ///!< Protects everything below up to m_staging
+    boost::condition_variable m_jobReady;
+    bool m_stop;
+    std::deque<Job> m_jobs;
+    std::deque<Chunk> m_ready;
+    std::map<Mesh*, unsigned int> m_generation;     ///!< Newest submission per mesh, older work gets dropped
+
+    std::map<Mesh*, Staging> m_staging;     ///!< Render thread only
+
+    unsigned int m_chunkTriangles;
+    unsigned int m_uploadBudget;            ///!< Bytes per frame, at least one chunk always goes up
+};
+
+
+#endif	/* MESH_STREAMER_H */
@@ -0,0 +1,264 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include "mesh_tools.h"
+#include "shared/Vectors.h"
+
+/// Post-transform cache size we optimize for. Real hardware varies, 32 is a safe middle ground.
+#define VERTEX_CACHE_SIZE 32
+
+namespace MeshTools
+{
+
+/// Position and color of a corner, as raw bits so identical floats hash identically
+struct CornerKey
+{
+    u_int32_t bits[6];
+
+    bool operator==(const CornerKey& other) const
+    {
+        return memcmp(bits,other.bits,sizeof(bits))==0;
+    }
+};
+
+struct CornerKeyHash
+{
+    size_t operator()(const CornerKey& key) const
+    {
+        /// FNV-1a over the six words
+        size_t hash=2166136261u;
+        for(int idx=0;idx<6;idx++){
+            hash=(hash^key.bits[idx])*16777619u;
+        }
+        return hash;
+    }
+};
+
+static CornerKey MakeKey(const vr::RenderModel_Vertex_t_rgb& v)
+{
+    CornerKey key;
+    float values[6]={v.vPosition.v[0],v.vPosition.v[1],v.vPosition.v[2],
+                     v.vColor.v[0],v.vColor.v[1],v.vColor.v[2]};
+    for(int idx=0;idx<6;idx++){
+        /// Adding zero turns -0.0 into 0.0, so they weld together
+        float value=values[idx]+0.0f;
+        memcpy(&key.bits[idx],&value,sizeof(float));
+    }
+    return key;
+}
+
+/// Whether two face normals are close enough to share a vertex. Degenerate faces have none, so go anywhere
+static bool SameSide(const float* a, const float* b, float crease_cos)
+{
+    float dot=a[0]*b[0]+a[1]*b[1]+a[2]*b[2];
+    bool degenerate=(a[0]==0 && a[1]==0 && a[2]==0) || (b[0]==0 && b[1]==0 && b[2]==0);
+    return degenerate || dot>=crease_cos;
+}
+
+void WeldVertices(const std::vector<vr::RenderModel_Vertex_t_rgb>& Corners,
+                  std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices,
+                  std::vector<u_int32_t>& Indices,
+                  float crease_cos)
+{
+    Vertices.clear();
+    Indices.clear();
+    Indices.reserve(Corners.size());
+    /// The first vertex at each position and color, the rest are chained from it in next
+    std::unordered_map<CornerKey,u_int32_t,CornerKeyHash> unique;
+    unique.reserve(Corners.size());
+    std::vector<u_int32_t> next;
+    const u_int32_t end=u_int32_t(-1);
+    for(size_t idx=0;idx<Corners.size();idx++){
+        std::pair<std::unordered_map<CornerKey,u_int32_t,CornerKeyHash>::iterator,bool> found=
+                unique.insert(std::make_pair(MakeKey(Corners[idx]),u_int32_t(Vertices.size())));
+        u_int32_t vertex=found.first->second;
+        if(!found.second){
+            /// Look for one across no crease, or add another to the chain
+            u_int32_t last=vertex;
+            while(vertex!=end && !SameSide(Vertices[vertex].vNormal.v,Corners[idx].vNormal.v,crease_cos)){
+                last=vertex;
+                vertex=next[vertex];
+            }
+            if(vertex==end){
+                vertex=Vertices.size();
+                next[last]=vertex;
+            }
+        }
+        if(vertex==Vertices.size()){
+            Vertices.push_back(Corners[idx]);
+            next.push_back(end);
+        }
+        Indices.push_back(vertex);
+    }
+}
+
+void ComputeSmoothNormals(std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices,
+                          const std::vector<u_int32_t>& Indices)
+{
+    std::vector<Vector3> normals(Vertices.size(),Vector3(0,0,0));
+    for(size_t idx=0;idx+2<Indices.size();idx+=3){
+        const float *p0=Vertices[Indices[idx+0]].vPosition.v;
+        const float *p1=Vertices[Indices[idx+1]].vPosition.v;
+        const float *p2=Vertices[Indices[idx+2]].vPosition.v;
+        /// The cross product is twice the area, so big faces count for more
+        Vector3 face=Vector3(p1[0]-p0[0],p1[1]-p0[1],p1[2]-p0[2]).cross(Vector3(p2[0]-p0[0],p2[1]-p0[1],p2[2]-p0[2]));
+        for(int corner=0;corner<3;corner++){
+            normals[Indices[idx+corner]]+=face;
+        }
+    }
+    for(size_t idx=0;idx<Vertices.size();idx++){
+        float length=normals[idx].length();
+        if(length>0){
+            normals[idx]/=length;
+        }
+        Vertices[idx].vNormal.v[0]=normals[idx].x;
+        Vertices[idx].vNormal.v[1]=normals[idx].y;
+        Vertices[idx].vNormal.v[2]=normals[idx].z;
+    }
+}
+
+/*!
+ * \brief how much we want to draw a triangle that uses this vertex next
+ * \param cache_position where the vertex is in the simulated cache, -1 if it isn't
+ * \param remaining_valence how many triangles that haven't been drawn still use it
+ */
+static float VertexScore(int cache_position, int remaining_valence)
+{
+    if(remaining_valence<=0){
+        return -1.0f;
+    }
+    float score=0;
+    if(cache_position>=0){
+        if(cache_position<3){
+            /// Used by the last triangle, so deliberately not the best, to avoid long thin strips
+            score=0.75f;
+        }else{
+            score=powf(1.0f-(cache_position-3)*(1.0f/(VERTEX_CACHE_SIZE-3)),1.5f);
+        }
+    }
+    /// Boost vertices with few triangles left, so they get finished off instead of left stranded
+    score+=2.0f*powf(float(remaining_valence),-0.5f);
+    return score;
+}
+
+/*!
+ * See Tom Forsyth, "Linear-Speed Vertex Cache Optimisation". Greedily picks the triangle
+ * with the best score among those touching the simulated cache, and only falls back to
+ * a linear scan when none are left.
+ */
+void OptimizeVertexCache(std::vector<u_int32_t>& Indices, unsigned int num_vertices)
+{
+    size_t num_tris=Indices.size()/3;
+    if(num_tris<2){
+        return;
+    }
+
+    /// Triangles using each vertex, packed into one array
+    std::vector<int> valence(num_vertices,0);
+    for(size_t idx=0;idx<num_tris*3;idx++){
+        valence[Indices[idx]]++;
+    }
+    std::vector<u_int32_t> adjacency_offset(num_vertices+1,0);
+    for(unsigned int vv=0;vv<num_vertices;vv++){
+        adjacency_offset[vv+1]=adjacency_offset[vv]+valence[vv];
+    }
+    std::vector<u_int32_t> adjacency(num_tris*3);
+    std::vector<u_int32_t> fill(adjacency_offset.begin(),adjacency_offset.end()-1);
+    for(size_t tri=0;tri<num_tris;tri++){
+        for(int corner=0;corner<3;corner++){
+            adjacency[fill[Indices[tri*3+corner]]++]=tri;
+        }
+    }
+
+    std::vector<int> cache_position(num_vertices,-1);
+    std::vector<float> score(num_vertices);
+    for(unsigned int vv=0;vv<num_vertices;vv++){
+        score[vv]=VertexScore(-1,valence[vv]);
+    }
+    std::vector<bool> drawn(num_tris,false);
+    std::vector<u_int32_t> cache,new_cache;
+    cache.reserve(VERTEX_CACHE_SIZE+3);
+    new_cache.reserve(VERTEX_CACHE_SIZE+3);
+
+    std::vector<u_int32_t> Reordered;
+    Reordered.reserve(num_tris*3);
+    size_t scan=0;
+    long best=-1;
+    while(Reordered.size()<num_tris*3){
+        if(best<0){
+            while(drawn[scan]){
+                scan++;
+            }
+            best=scan;
+        }
+        drawn[best]=true;
+        new_cache.clear();
+        for(int corner=0;corner<3;corner++){
+            u_int32_t vv=Indices[best*3+corner];
+            Reordered.push_back(vv);
+            /// Take the triangle out of this vertex's list of remaining triangles
+            u_int32_t *list=adjacency.data()+adjacency_offset[vv];
+            for(int ii=0;ii<valence[vv];ii++){
+                if(list[ii]==u_int32_t(best)){
+                    list[ii]=list[valence[vv]-1];
+                    break;
+                }
+            }
+            valence[vv]--;
+            if(std::find(new_cache.begin(),new_cache.end(),vv)==new_cache.end()){
+                new_cache.push_back(vv);
+            }
+        }
+        for(size_t ii=0;ii<cache.size();ii++){
+            if(std::find(new_cache.begin(),new_cache.end(),cache[ii])==new_cache.end()){
+                new_cache.push_back(cache[ii]);
+            }
+        }
+        for(size_t ii=0;ii<new_cache.size();ii++){
+            u_int32_t vv=new_cache[ii];
+            cache_position[vv]=(ii<VERTEX_CACHE_SIZE) ? int(ii) : -1;
+            score[vv]=VertexScore(cache_position[vv],valence[vv]);
+        }
+        if(new_cache.size()>VERTEX_CACHE_SIZE){
+            new_cache.resize(VERTEX_CACHE_SIZE);
+        }
+        cache.swap(new_cache);
+
+        /// Next triangle is the best one touching the cache
+        best=-1;
+        float best_score=-1.0f;
+        for(size_t ii=0;ii<cache.size();ii++){
+            u_int32_t vv=cache[ii];
+            const u_int32_t *list=adjacency.data()+adjacency_offset[vv];
+            for(int jj=0;jj<valence[vv];jj++){
+                u_int32_t tri=list[jj];
+                float tri_score=score[Indices[tri*3+0]]+score[Indices[tri*3+1]]+score[Indices[tri*3+2]];
+                if(tri_score>best_score){
+                    best_score=tri_score;
+                    best=tri;
+                }
+            }
+        }
+    }
+    Indices.swap(Reordered);
+}
+
+void OptimizeVertexFetch(std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices,
+                         std::vector<u_int32_t>& Indices)
+{
+    std::vector<u_int32_t> remap(Vertices.size(),u_int32_t(-1));
+    std::vector<vr::RenderModel_Vertex_t_rgb> Reordered;
+    Reordered.reserve(Vertices.size());
+    for(size_t idx=0;idx<Indices.size();idx++){
+        u_int32_t &old_index=Indices[idx];
+        if(remap[old_index]==u_int32_t(-1)){
+            remap[old_index]=Reordered.size();
+            Reordered.push_back(Vertices[old_index]);
+        }
+        old_index=remap[old_index];
+    }
+    Vertices.swap(Reordered);
+}
+
+}
@@ -0,0 +1,44 @@
+#ifndef MESH_TOOLS_H
+#define	MESH_TOOLS_H
+
+#include <vector>
+#include <sys/types.h>
+#include "geometry_pool.h"
+
+/*!
+ * \brief Helpers for turning triangle soup (like a TRIANGLE_LIST marker) into a
+ *        compact indexed mesh that is cheap to upload and to shade.
+ */
+namespace MeshTools
+{
+
+/*!
+ * \brief merge corners with the same position and color into one vertex, unless there is a crease between them
+ *
+ * Each corner's normal is its face's. A corner only joins a vertex whose (first) face is
+ * within the crease angle of its own, so hard edges stay hard once the normals are smoothed.
+ *
+ * \param Corners       three per triangle, in triangle order, with unit (or zero) face normals
+ * \param Vertices      output, the unique vertices (normals are left as they came in)
+ * \param Indices       output, three per triangle, into Vertices
+ * \param crease_cos    cosine of the crease angle, faces further apart than that aren't welded
+ */
+void WeldVertices(const std::vector<vr::RenderModel_Vertex_t_rgb>& Corners,
+                  std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices,
+                  std::vector<u_int32_t>& Indices,
+                  float crease_cos);
+
+/// Replace the normals with the area weighted average of the faces around each vertex
+void ComputeSmoothNormals(std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices,
+                          const std::vector<u_int32_t>& Indices);
+
+/// Reorder triangles so the GPU's post-transform cache gets reused (Forsyth's algorithm)
+void OptimizeVertexCache(std::vector<u_int32_t>& Indices, unsigned int num_vertices);
+
+/// Reorder vertices to the order they are first used, so fetches walk through memory
+void OptimizeVertexFetch(std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices,
+                         std::vector<u_int32_t>& Indices);
+
+}
+
+#endif	/* MESH_TOOLS_H */
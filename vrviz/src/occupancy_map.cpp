@@ -0,0 +1,104 @@
+#include <cstdio>
+#include <algorithm>
+#include "occupancy_map.h"
+
+OccupancyMap::OccupancyMap(const std::string& name)
+    : m_width(0),
+      m_height(0)
+{
+    mesh=new Mesh;
+    mesh->name=name;
+    mesh->m_Entries.resize(1);
+    mesh->m_Entries[0].MaterialIndex=OCCUPANCY_GRID;
+}
+
+/*!
+ * \brief upload a whole map, reusing the texture if the size hasn't changed
+ */
+void OccupancyMap::SetMap(const nav_msgs::OccupancyGrid& grid, float scaling_factor)
+{
+    unsigned int width=grid.info.width;
+    unsigned int height=grid.info.height;
+    if(width==0 || height==0 || grid.data.size()<size_t(width)*height){
+        printf("Ignoring occupancy grid with %lu cells for %ux%u\n",grid.data.size(),width,height);
+        return;
+    }
+    GLint max_size=0;
+    glGetIntegerv( GL_MAX_TEXTURE_SIZE, &max_size );
+    if(width>(unsigned int)max_size || height>(unsigned int)max_size){
+        printf("Occupancy grid of %ux%u is bigger than the biggest texture (%d)\n",width,height,max_size);
+        return;
+    }
+
+    Mesh::MeshEntry& entry=mesh->m_Entries[0];
+    if(entry.VA==INVALID_OGL_VALUE){
+        /// Nothing to put in it, but drawing needs a VAO bound
+        glGenVertexArrays( 1, &entry.VA );
+    }
+    if(entry.DataTexture==INVALID_OGL_VALUE){
+        glGenTextures( 1, &entry.DataTexture );
+    }
+
+    /// The cells are signed, so unknown (-1) arrives as 255, and the shader sorts it out
+    const GLubyte* cells=reinterpret_cast<const GLubyte*>(&grid.data[0]);
+    glBindTexture( GL_TEXTURE_2D, entry.DataTexture );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+    if(width!=m_width || height!=m_height){
+        glTexImage2D( GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, cells );
+        /// Cells should look like cells up close, not blurred together
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        m_width=width;
+        m_height=height;
+    }else{
+        glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RED, GL_UNSIGNED_BYTE, cells );
+    }
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+    glBindTexture( GL_TEXTURE_2D, 0 );
+
+    /// The quad goes from 0 to 1, so stretch it over the map, starting at the origin cell
+    float resolution=grid.info.resolution*scaling_factor;
+    Matrix4 size;
+    size.scale(width*resolution,height*resolution,1.0);
+    mesh->trans=Mesh::PoseMatrix(grid.info.origin,scaling_factor)*size;
+    mesh->frame_id=grid.header.frame_id;
+
+    entry.NumIndices=4;
+    mesh->initialized=true;
+    mesh->needs_update=false;
+}
+
+/*!
+ * \brief copy an OccupancyGridUpdate over its rectangle of the map
+ *
+ * Only that rectangle gets uploaded. Anything hanging off the edge of the map is dropped.
+ */
+void OccupancyMap::ApplyUpdate(const map_msgs::OccupancyGridUpdate& update)
+{
+    const Mesh::MeshEntry& entry=mesh->m_Entries[0];
+    if(entry.DataTexture==INVALID_OGL_VALUE || update.data.size()<size_t(update.width)*update.height){
+        return;
+    }
+    long x0=std::max<long>(update.x,0);
+    long y0=std::max<long>(update.y,0);
+    long x1=std::min<long>(long(update.x)+update.width,m_width);
+    long y1=std::min<long>(long(update.y)+update.height,m_height);
+    if(x1<=x0 || y1<=y0){
+        return;
+    }
+
+    glBindTexture( GL_TEXTURE_2D, entry.DataTexture );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, update.width );
+    glPixelStorei( GL_UNPACK_SKIP_PIXELS, x0-update.x );
+    glPixelStorei( GL_UNPACK_SKIP_ROWS, y0-update.y );
+    glTexSubImage2D( GL_TEXTURE_2D, 0, x0, y0, x1-x0, y1-y0, GL_RED, GL_UNSIGNED_BYTE,
+                     reinterpret_cast<const GLubyte*>(&update.data[0]) );
+    glPixelStorei( GL_UNPACK_SKIP_ROWS, 0 );
+    glPixelStorei( GL_UNPACK_SKIP_PIXELS, 0 );
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+    glBindTexture( GL_TEXTURE_2D, 0 );
+}
@@ -0,0 +1,35 @@
+#ifndef OCCUPANCY_MAP_H
+#define	OCCUPANCY_MAP_H
+
+#include <string>
+#include <nav_msgs/OccupancyGrid.h>
+#include <map_msgs/OccupancyGridUpdate.h>
+#include "mesh.h"
+
+/*!
+ * \brief A nav_msgs/OccupancyGrid, drawn as one textured quad
+ *
+ * The cells go straight into a single channel (GL_R8) texture, and the shader turns them
+ * into colors, so even a 4000x4000 map is one draw. OccupancyGridUpdate messages only
+ * replace the rectangle they cover with glTexSubImage2D. The quad itself has no vertex
+ * buffer, its corners come from gl_VertexID, and mesh->trans stretches it over the map.
+ *
+ * Render thread only.
+ */
+class OccupancyMap
+{
+public:
+    OccupancyMap(const std::string& name);
+
+    void SetMap(const nav_msgs::OccupancyGrid& grid, float scaling_factor);
+    void ApplyUpdate(const map_msgs::OccupancyGridUpdate& update);
+
+    Mesh* mesh;                         ///!< Goes in robot_meshes, which owns it
+
+private:
+    unsigned int m_width;               ///!< Size of the texture, in cells
+    unsigned int m_height;
+};
+
+
+#endif	/* OCCUPANCY_MAP_H */
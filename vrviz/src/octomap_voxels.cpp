@@ -0,0 +1,360 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "octomap_voxels.h"
+
+#ifdef HAVE_OCTOMAP
+
+/// octomap's trees are always this deep, the smallest voxels being at the bottom
+#define TREE_DEPTH 16
+/// Subtrees this deep are decoded and uploaded on their own, up to 8^CHUNK_DEPTH of them
+#define CHUNK_DEPTH 4
+
+OctomapVoxels::OctomapVoxels(const std::string& name)
+    : m_format(BINARY),
+      m_resolution(0),
+      m_scalingFactor(0),
+      m_minZ(0),
+      m_maxZ(0),
+      m_generation(0)
+{
+    mesh=new Mesh;
+    mesh->name=name;
+    /// It goes in robot_meshes before there is anything to draw
+    mesh->initialized=false;
+    mesh->needs_update=false;
+    mesh->m_Entries.resize(1);
+    mesh->m_Entries[0].MaterialIndex=NO_TEXTURE;
+    mesh->m_Entries[0].Mode=GL_TRIANGLES;
+}
+
+/*!
+ * \brief throw away every chunk, because something they were all built from changed
+ */
+void OctomapVoxels::Reset()
+{
+    m_chunks.clear();
+    m_coarse.clear();
+    m_decoded.reset=true;
+}
+
+/*!
+ * \brief decode a new octomap, and leave the subtrees that changed for Upload()
+ * \param min_z,max_z   heights (ROS units) the colors go from blue to red over
+ */
+void OctomapVoxels::SetOctomap(const octomap_msgs::Octomap& msg, float scaling_factor, float min_z, float max_z)
+{
+    Format format;
+    if(msg.binary){
+        format=BINARY;
+    }else if(msg.id=="OcTree"){
+        format=FULL;
+    }else if(msg.id=="ColorOcTree"){
+        format=FULL_COLOR;
+    }else{
+        if(msg.id!=m_id){
+            printf("Can't draw a full %s octomap, only binary ones, OcTree or ColorOcTree\n",msg.id.c_str());
+            m_id=msg.id;
+        }
+        return;
+    }
+    m_decoded=Changes();
+    if(format!=m_format || msg.resolution!=m_resolution || scaling_factor!=m_scalingFactor ||
+       min_z!=m_minZ || max_z!=m_maxZ || msg.header.frame_id!=m_frameId){
+        Reset();
+    }
+    m_format=format;
+    m_id=msg.id;
+    m_frameId=msg.header.frame_id;
+    m_resolution=msg.resolution;
+    m_scalingFactor=scaling_factor;
+    m_minZ=min_z;
+    m_maxZ=max_z;
+    m_generation++;
+
+    Cursor cursor;
+    cursor.data=reinterpret_cast<const unsigned char*>(msg.data.empty()?NULL:&msg.data[0]);
+    cursor.size=msg.data.size();
+    cursor.pos=0;
+    std::vector<vr::RenderModel_Instance_t_rgb> coarse;
+    if(cursor.size>0 && !ReadNode(cursor,0,Vector3(0,0,0),0,&coarse)){
+        printf("Octomap message ended in the middle of the tree\n");
+    }
+
+    if(coarse.size()!=m_coarse.size() ||
+       (!coarse.empty() && memcmp(&coarse[0],&m_coarse[0],sizeof(coarse[0])*coarse.size())!=0)){
+        m_decoded.coarse_changed=true;
+        m_decoded.coarse=coarse;
+        m_coarse.swap(coarse);
+    }
+
+    /// Anything that wasn't in this message is gone
+    for(std::map<unsigned int, Chunk>::iterator it=m_chunks.begin();it!=m_chunks.end();){
+        if(it->second.generation!=m_generation){
+            m_decoded.chunks[it->first].clear();
+            m_chunks.erase(it++);
+        }else{
+            ++it;
+        }
+    }
+    m_decoded.frame_id=msg.header.frame_id;
+
+    /// Fold it into whatever the render thread hasn't got to yet
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    if(m_decoded.reset){
+        std::swap(m_pending,m_decoded);
+    }else{
+        if(m_decoded.coarse_changed){
+            m_pending.coarse_changed=true;
+            m_pending.coarse.swap(m_decoded.coarse);
+        }
+        for(std::map<unsigned int, std::vector<vr::RenderModel_Instance_t_rgb> >::iterator it=m_decoded.chunks.begin();it!=m_decoded.chunks.end();++it){
+            m_pending.chunks[it->first].swap(it->second);
+        }
+        m_pending.frame_id=m_decoded.frame_id;
+    }
+    m_pending.fresh=true;
+}
+
+/*!
+ * \brief upload whatever changed in the octomaps since the last frame
+ *
+ * Call once a frame from the render thread.
+ */
+void OctomapVoxels::Upload()
+{
+    Changes changes;
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        if(!m_pending.fresh){
+            return;
+        }
+        std::swap(changes,m_pending);
+    }
+
+    if(changes.reset){
+        ReleaseEntries();
+    }
+    if(changes.coarse_changed){
+        UploadEntry(0,changes.coarse);
+    }
+    for(std::map<unsigned int, std::vector<vr::RenderModel_Instance_t_rgb> >::iterator it=changes.chunks.begin();it!=changes.chunks.end();++it){
+        std::map<unsigned int, unsigned int>::iterator found=m_entries.find(it->first);
+        if(it->second.empty()){
+            if(found!=m_entries.end()){
+                mesh->m_Entries[found->second].Release();
+                m_freeEntries.push_back(found->second);
+                m_entries.erase(found);
+            }
+            continue;
+        }
+        if(found==m_entries.end()){
+            unsigned int entry;
+            if(m_freeEntries.empty()){
+                entry=mesh->m_Entries.size();
+                mesh->m_Entries.push_back(Mesh::MeshEntry());
+                mesh->m_Entries.back().MaterialIndex=NO_TEXTURE;
+                mesh->m_Entries.back().Mode=GL_TRIANGLES;
+            }else{
+                entry=m_freeEntries.back();
+                m_freeEntries.pop_back();
+            }
+            found=m_entries.insert(std::make_pair(it->first,entry)).first;
+        }
+        UploadEntry(found->second,it->second);
+    }
+
+    mesh->frame_id=changes.frame_id;
+    mesh->initialized=true;
+    mesh->needs_update=false;
+}
+
+/*!
+ * \brief free every entry, the chunks are all coming again
+ */
+void OctomapVoxels::ReleaseEntries()
+{
+    for(size_t idx=0;idx<mesh->m_Entries.size();idx++){
+        mesh->m_Entries[idx].Release();
+    }
+    mesh->m_Entries.resize(1);
+    m_entries.clear();
+    m_freeEntries.clear();
+}
+
+bool OctomapVoxels::ReadNode(Cursor& cursor, int depth, Vector3 center, unsigned int key, std::vector<vr::RenderModel_Instance_t_rgb>* out)
+{
+    if(m_format==BINARY){
+        return ReadBinaryNode(cursor,depth,center,key,out);
+    }
+    return ReadFullNode(cursor,depth,center,key,out);
+}
+
+/*!
+ * \brief read an inner node of the binary format, and everything under it
+ *
+ * Two bytes hold two bits per child: 00 unknown, 10 free, 01 occupied, 11 has children
+ * (lowest bit first). The children that have children come after, in order.
+ *
+ * \param out   where occupied leaves go, or NULL to just skip over the bytes
+ * \return false if the data ran out
+ */
+bool OctomapVoxels::ReadBinaryNode(Cursor& cursor, int depth, Vector3 center, unsigned int key, std::vector<vr::RenderModel_Instance_t_rgb>* out)
+{
+    if(cursor.pos+2>cursor.size || depth>=TREE_DEPTH){
+        return false;
+    }
+    unsigned int codes=cursor.data[cursor.pos] | (cursor.data[cursor.pos+1]<<8);
+    cursor.pos+=2;
+
+    for(int child=0;child<8;child++){
+        if(((codes>>(2*child))&3)==2 && out){
+            AddVoxel(ChildCenter(center,depth+1,child),depth+1,NULL,out);
+        }
+    }
+    for(int child=0;child<8;child++){
+        if(((codes>>(2*child))&3)!=3){
+            continue;
+        }
+        bool ok;
+        if(depth+1==CHUNK_DEPTH){
+            ok=ReadChunk(cursor,depth+1,ChildCenter(center,depth+1,child),(key<<3)|child);
+        }else{
+            ok=ReadBinaryNode(cursor,depth+1,ChildCenter(center,depth+1,child),(key<<3)|child,out);
+        }
+        if(!ok){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * \brief read a node of the full format, and everything under it
+ *
+ * Each node is its log odds (a float), then for ColorOcTree its r,g,b, then a byte with a
+ * bit for each child that follows. Nodes with no children are leaves, occupied if the log
+ * odds are positive.
+ *
+ * \param out   where occupied leaves go, or NULL to just skip over the bytes
+ * \return false if the data ran out
+ */
+bool OctomapVoxels::ReadFullNode(Cursor& cursor, int depth, Vector3 center, unsigned int key, std::vector<vr::RenderModel_Instance_t_rgb>* out)
+{
+    size_t value_size=(m_format==FULL_COLOR)?sizeof(float)+3:sizeof(float);
+    if(cursor.pos+value_size+1>cursor.size || depth>TREE_DEPTH){
+        return false;
+    }
+    const unsigned char* value=cursor.data+cursor.pos;
+    cursor.pos+=value_size;
+    unsigned char children=cursor.data[cursor.pos++];
+
+    if(children==0){
+        float log_odds;
+        memcpy(&log_odds,value,sizeof(log_odds));
+        if(log_odds>0 && out){
+            AddVoxel(center,depth,(m_format==FULL_COLOR)?value+sizeof(float):NULL,out);
+        }
+        return true;
+    }
+    for(int child=0;child<8;child++){
+        if(!(children&(1<<child))){
+            continue;
+        }
+        bool ok;
+        if(depth+1==CHUNK_DEPTH){
+            ok=ReadChunk(cursor,depth+1,ChildCenter(center,depth+1,child),(key<<3)|child);
+        }else{
+            ok=ReadFullNode(cursor,depth+1,ChildCenter(center,depth+1,child),(key<<3)|child,out);
+        }
+        if(!ok){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * \brief skip over a subtree at CHUNK_DEPTH, and only decode it if its bytes changed
+ */
+bool OctomapVoxels::ReadChunk(Cursor& cursor, int depth, Vector3 center, unsigned int key)
+{
+    size_t start=cursor.pos;
+    if(!ReadNode(cursor,depth,center,key,NULL)){
+        return false;
+    }
+
+    /// FNV-1a
+    u_int64_t hash=14695981039346656037ULL;
+    for(size_t idx=start;idx<cursor.pos;idx++){
+        hash=(hash^cursor.data[idx])*1099511628211ULL;
+    }
+
+    Chunk& chunk=m_chunks[key];
+    if(chunk.generation!=0 && chunk.hash==hash){
+        chunk.generation=m_generation;
+        return true;
+    }
+    chunk.hash=hash;
+    chunk.generation=m_generation;
+
+    Cursor again=cursor;
+    again.pos=start;
+    std::vector<vr::RenderModel_Instance_t_rgb>& instances=m_decoded.chunks[key];
+    instances.clear();
+    ReadNode(again,depth,center,key,&instances);
+    return true;
+}
+
+/*!
+ * \brief center of a child node, in ROS units. Bit 0 of the child index is +x, bit 1 +y, bit 2 +z
+ */
+Vector3 OctomapVoxels::ChildCenter(Vector3 center, int child_depth, int child) const
+{
+    float offset=m_resolution*std::ldexp(1.0,TREE_DEPTH-child_depth)*0.5;
+    return Vector3(center.x+((child&1)?offset:-offset),
+                   center.y+((child&2)?offset:-offset),
+                   center.z+((child&4)?offset:-offset));
+}
+
+void OctomapVoxels::AddVoxel(Vector3 center, int depth, const unsigned char* color, std::vector<vr::RenderModel_Instance_t_rgb>* out) const
+{
+    float size=m_resolution*std::ldexp(1.0,TREE_DEPTH-depth)*m_scalingFactor;
+    vr::RenderModel_Instance_t_rgb instance;
+    instance.vOffset.v[0]=center.x*m_scalingFactor;
+    instance.vOffset.v[1]=center.y*m_scalingFactor;
+    instance.vOffset.v[2]=center.z*m_scalingFactor;
+    if(color){
+        instance.vColor.v[0]=color[0]/255.0f;
+        instance.vColor.v[1]=color[1]/255.0f;
+        instance.vColor.v[2]=color[2]/255.0f;
+    }else{
+        /// Blue at the bottom to red at the top, like rviz's rainbow
+        float t=(m_maxZ>m_minZ)?std::min(std::max((center.z-m_minZ)/(m_maxZ-m_minZ),0.0f),1.0f):0.5f;
+        instance.vColor.v[0]=std::min(std::max(1.5f-fabsf(4.0f*t-3.0f),0.0f),1.0f);
+        instance.vColor.v[1]=std::min(std::max(1.5f-fabsf(4.0f*t-2.0f),0.0f),1.0f);
+        instance.vColor.v[2]=std::min(std::max(1.5f-fabsf(4.0f*t-1.0f),0.0f),1.0f);
+    }
+    instance.vRotation.v[0]=0;
+    instance.vRotation.v[1]=0;
+    instance.vRotation.v[2]=0;
+    instance.vRotation.v[3]=1;
+    instance.vScale.v[0]=size;
+    instance.vScale.v[1]=size;
+    instance.vScale.v[2]=size;
+    instance.vScale.v[3]=0;
+    out->push_back(instance);
+}
+
+void OctomapVoxels::UploadEntry(unsigned int entry, const std::vector<vr::RenderModel_Instance_t_rgb>& instances)
+{
+    if(instances.empty()){
+        /// Otherwise the bare template would get drawn once
+        mesh->m_Entries[entry].Release();
+    }else{
+        mesh->InitTemplateInstances(Mesh::TEMPLATE_CUBE,instances,entry);
+    }
+}
+
+#endif
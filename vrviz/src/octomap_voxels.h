@@ -0,0 +1,104 @@
+#ifndef OCTOMAP_VOXELS_H
+#define	OCTOMAP_VOXELS_H
+
+/// Only built with octomap_msgs
+#ifdef HAVE_OCTOMAP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+#include <octomap_msgs/Octomap.h>
+#include "mesh.h"
+
+/*!
+ * \brief Occupied voxels of an octomap_msgs/Octomap, decoded straight from the message
+ *
+ * Handles the binary format (any OcTree), and the full format of OcTree and ColorOcTree,
+ * assuming octomap's usual tree depth of 16. Every occupied leaf is an instance of the
+ * cube template, scaled to the size of its depth.
+ *
+ * Both formats write the tree depth first, so each subtree is a contiguous run of bytes.
+ * The subtrees at CHUNK_DEPTH each get their own mesh entry, and a hash of their bytes:
+ * only the subtrees whose bytes changed since the last message get decoded and uploaded
+ * again. Leaves above CHUNK_DEPTH (big pruned voxels) share entry 0.
+ *
+ * SetOctomap() does all of the decoding and diffing, on the subscriber's thread, and
+ * leaves the instances of the chunks that changed for Upload(). If another message comes
+ * in before the render thread gets to them, its changes are merged into what's waiting,
+ * so the render thread only ever uploads.
+ *
+ * Voxels are colored by height, unless the tree has its own colors.
+ */
+class OctomapVoxels
+{
+public:
+    OctomapVoxels(const std::string& name);
+
+    void SetOctomap(const octomap_msgs::Octomap& msg, float scaling_factor, float min_z, float max_z);
+    void Upload();
+
+    Mesh* mesh;                         ///!< Goes in robot_meshes, which owns it
+
+private:
+    enum Format { BINARY, FULL, FULL_COLOR };
+
+    struct Chunk {
+        Chunk() : hash(0), generation(0) {}
+        u_int64_t hash;                 ///!< Of the subtree's bytes, to tell if it changed
+        unsigned int generation;        ///!< Last message it showed up in
+    };
+
+    /// What changed since the render thread last uploaded
+    struct Changes {
+        Changes() : reset(false), coarse_changed(false), fresh(false) {}
+        bool reset;                     ///!< Throw away every entry first
+        bool coarse_changed;
+        std::vector<vr::RenderModel_Instance_t_rgb> coarse;
+        std::map<unsigned int, std::vector<vr::RenderModel_Instance_t_rgb> > chunks;    ///!< Empty if the chunk went away
+        std::string frame_id;
+        bool fresh;                     ///!< There is something to upload
+    };
+
+    /// Where a depth first walk over the message is up to
+    struct Cursor {
+        const unsigned char* data;
+        size_t size;
+        size_t pos;
+    };
+
+    bool ReadNode(Cursor& cursor, int depth, Vector3 center, unsigned int key, std::vector<vr::RenderModel_Instance_t_rgb>* out);
+    bool ReadBinaryNode(Cursor& cursor, int depth, Vector3 center, unsigned int key, std::vector<vr::RenderModel_Instance_t_rgb>* out);
+    bool ReadFullNode(Cursor& cursor, int depth, Vector3 center, unsigned int key, std::vector<vr::RenderModel_Instance_t_rgb>* out);
+    bool ReadChunk(Cursor& cursor, int depth, Vector3 center, unsigned int key);
+    Vector3 ChildCenter(Vector3 center, int child_depth, int child) const;
+    void AddVoxel(Vector3 center, int depth, const unsigned char* color, std::vector<vr::RenderModel_Instance_t_rgb>* out) const;
+    void UploadEntry(unsigned int entry, const std::vector<vr::RenderModel_Instance_t_rgb>& instances);
+    void Reset();
+    void ReleaseEntries();
+
+    /// The subscriber's side, what the last message decoded to
+    Format m_format;
+    std::string m_id;
+    std::string m_frameId;
+    double m_resolution;                ///!< ROS units, of the smallest voxels
+    float m_scalingFactor;
+    float m_minZ;                       ///!< Heights the colors go from blue to red over, in ROS units
+    float m_maxZ;
+    unsigned int m_generation;
+
+    std::map<unsigned int, Chunk> m_chunks;     ///!< Path of child indices down to CHUNK_DEPTH -> chunk
+    std::vector<vr::RenderModel_Instance_t_rgb> m_coarse;  ///!< What entry 0 was last built from
+    Changes m_decoded;                  ///!< What SetOctomap() has found changed so far
+
+    boost::mutex m_mutex;               ///!< Protects m_pending
+    Changes m_pending;
+
+    /// The render thread's side
+    std::map<unsigned int, unsigned int> m_entries;     ///!< Chunk -> which of the mesh's entries it is drawn with
+    std::vector<unsigned int> m_freeEntries;    ///!< Mesh entries left over from chunks that went away
+};
+
+#endif	/* HAVE_OCTOMAP */
+
+#endif	/* OCTOMAP_VOXELS_H */
@@ -13,7 +13,21 @@ CMainApplication::CMainApplication( int argc, char *argv[] )
 	, m_unCompanionWindowProgramID( 0 )
 	, m_unControllerTransformProgramID( 0 )
 	, m_unRenderModelProgramID( 0 )
+	, m_unLitInstancedProgramID( 0 )
+	, m_unMarkerPointsProgramID( 0 )
+	, m_unThickLinesProgramID( 0 )
+	, m_unTextProgramID( 0 )
+	, m_unAssetInstancedProgramID( 0 )
+	, m_unHudProgramID( 0 )
+	, m_unOccupancyGridProgramID( 0 )
+	, m_unHeightfieldProgramID( 0 )
+	, m_unYUVProgramID( 0 )
+	, m_unCameraPlaneProgramID( 0 )
 	, m_pHMD( NULL )
+	, m_fLineWidth( 2.0f )
+	, m_bHudText( false )
+	, m_fMapAlpha( 0.7f )
+	, m_fCameraPlaneAlpha( 1.0f )
 	, m_bDebugOpenGL( false )
 	, m_bVerbose( false )
 	, m_bPerf( false )
@@ -29,6 +43,45 @@ CMainApplication::CMainApplication( int argc, char *argv[] )
 	, m_nSceneMatrixLocation( -1 )
 	, m_nControllerMatrixLocation( -1 )
 	, m_nRenderModelMatrixLocation( -1 )
+	, m_nLitInstancedMatrixLocation( -1 )
+	, m_nMarkerPointsMatrixLocation( -1 )
+	, m_nMarkerPointsScaleLocation( -1 )
+	, m_nThickLinesMatrixLocation( -1 )
+	, m_nThickLinesViewportLocation( -1 )
+	, m_nThickLinesWorldWidthLocation( -1 )
+	, m_nThickLinesMinWidthLocation( -1 )
+	, m_nTextMatrixLocation( -1 )
+	, m_nTextWorldLocation( -1 )
+	, m_nTextAnchorLocation( -1 )
+	, m_nTextRightLocation( -1 )
+	, m_nTextUpLocation( -1 )
+	, m_nTextColorLocation( -1 )
+	, m_nTextAtlasLocation( -1 )
+	, m_nAssetMatrixLocation( -1 )
+	, m_nAssetTexturedLocation( -1 )
+	, m_nAssetTextureLocation( -1 )
+	, m_nHudMatrixLocation( -1 )
+	, m_nHudExtentLocation( -1 )
+	, m_nHudTextureLocation( -1 )
+	, m_nOccupancyGridMatrixLocation( -1 )
+	, m_nOccupancyGridTextureLocation( -1 )
+	, m_nOccupancyGridAlphaLocation( -1 )
+	, m_nHeightfieldMatrixLocation( -1 )
+	, m_nHeightfieldWorldLocation( -1 )
+	, m_nHeightfieldTextureLocation( -1 )
+	, m_nHeightfieldOffsetLocation( -1 )
+	, m_nHeightfieldRangeLocation( -1 )
+	, m_nYUVLayoutLocation( -1 )
+	, m_nYUVRowsLocation( -1 )
+	, m_nYUVColorSpaceLocation( -1 )
+	, m_nCameraPlaneMatrixLocation( -1 )
+	, m_nCameraPlaneTextureLocation( -1 )
+	, m_nCameraPlaneAlphaLocation( -1 )
+	, m_unHudFramebuffer( 0 )
+	, m_unHudTexture( 0 )
+	, m_unHudVAO( 0 )
+	, m_nHudSize( 1024 )
+	, m_bHudVisible( false )
 	, m_iTrackedControllerCount( 0 )
 	, m_iTrackedControllerCount_Last( -1 )
 	, m_iValidPoseCount( 0 )
@@ -345,6 +398,55 @@ void CMainApplication::Shutdown()
 		{
 			glDeleteProgram( m_unCompanionWindowProgramID );
 		}
+		if ( m_unLitInstancedProgramID )
+		{
+			glDeleteProgram( m_unLitInstancedProgramID );
+		}
+		if ( m_unMarkerPointsProgramID )
+		{
+			glDeleteProgram( m_unMarkerPointsProgramID );
+		}
+		if ( m_unThickLinesProgramID )
+		{
+			glDeleteProgram( m_unThickLinesProgramID );
+		}
+		if ( m_unTextProgramID )
+		{
+			glDeleteProgram( m_unTextProgramID );
+		}
+		if ( m_unAssetInstancedProgramID )
+		{
+			glDeleteProgram( m_unAssetInstancedProgramID );
+		}
+		if ( m_unHudProgramID )
+		{
+			glDeleteProgram( m_unHudProgramID );
+		}
+		if ( m_unOccupancyGridProgramID )
+		{
+			glDeleteProgram( m_unOccupancyGridProgramID );
+		}
+		if ( m_unHeightfieldProgramID )
+		{
+			glDeleteProgram( m_unHeightfieldProgramID );
+		}
+		if ( m_unYUVProgramID )
+		{
+			glDeleteProgram( m_unYUVProgramID );
+		}
+		if ( m_unCameraPlaneProgramID )
+		{
+			glDeleteProgram( m_unCameraPlaneProgramID );
+		}
+		if ( m_unHudFramebuffer )
+		{
+			glDeleteFramebuffers( 1, &m_unHudFramebuffer );
+			glDeleteTextures( 1, &m_unHudTexture );
+		}
+		if ( m_unHudVAO )
+		{
+			glDeleteVertexArrays( 1, &m_unHudVAO );
+		}
 
 		glDeleteRenderbuffers( 1, &leftEyeDesc.m_nDepthBufferId );
 		glDeleteTextures( 1, &leftEyeDesc.m_nRenderTextureId );
@@ -376,6 +478,9 @@ void CMainApplication::Shutdown()
 		if( m_unColorTrisVAO != 0 ){
 			glDeleteVertexArrays( 1, &m_unColorTrisVAO );
 		}
+		Mesh::asset_cache.Clear();
+		Mesh::geometry_pool.Clear();
+		Mesh::text_atlas.Clear();
 	}
 
 	if( m_pCompanionWindow )
@@ -550,6 +655,9 @@ void CMainApplication::RenderFrame()
 	// for now as fast as possible
 	if ( m_pHMD )
 	{
+		UpdateMarkerPoses();
+		UpdateAssetInstances();
+		UpdateHudLayer();
 		RenderControllerAxes();
 		RenderStereoTargets();
 		RenderCompanionWindow();
@@ -607,6 +715,16 @@ void CMainApplication::RenderFrame()
 //			the shader couldn't be compiled for some reason.
 //-----------------------------------------------------------------------------
 GLuint CMainApplication::CompileGLShader( const char *pchShaderName, const char *pchVertexShader, const char *pchFragmentShader )
+{
+	return CompileGLShader( pchShaderName, pchVertexShader, NULL, pchFragmentShader );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Same as above, with an optional geometry shader between the vertex
+//			and fragment stages (pass NULL to skip it).
+//-----------------------------------------------------------------------------
+GLuint CMainApplication::CompileGLShader( const char *pchShaderName, const char *pchVertexShader, const char *pchGeometryShader, const char *pchFragmentShader )
 {
 	GLuint unProgramID = glCreateProgram();
 
@@ -626,6 +744,25 @@ GLuint CMainApplication::CompileGLShader( const char *pchShaderName, const char
 	glAttachShader( unProgramID, nSceneVertexShader);
 	glDeleteShader( nSceneVertexShader ); // the program hangs onto this once it's attached
 
+	if ( pchGeometryShader )
+	{
+		GLuint nSceneGeometryShader = glCreateShader(GL_GEOMETRY_SHADER);
+		glShaderSource( nSceneGeometryShader, 1, &pchGeometryShader, NULL);
+		glCompileShader( nSceneGeometryShader );
+
+		GLint gShaderCompiled = GL_FALSE;
+		glGetShaderiv( nSceneGeometryShader, GL_COMPILE_STATUS, &gShaderCompiled);
+		if ( gShaderCompiled != GL_TRUE)
+		{
+			dprintf("%s - Unable to compile geometry shader %d!\n", pchShaderName, nSceneGeometryShader);
+			glDeleteProgram( unProgramID );
+			glDeleteShader( nSceneGeometryShader );
+			return 0;
+		}
+		glAttachShader( unProgramID, nSceneGeometryShader);
+		glDeleteShader( nSceneGeometryShader );
+	}
+
 	GLuint  nSceneFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 	glShaderSource( nSceneFragmentShader, 1, &pchFragmentShader, NULL);
 	glCompileShader( nSceneFragmentShader );
@@ -766,32 +903,8 @@ bool CMainApplication::CreateAllShaders()
         return false;
     }
 
-    m_unLitRGBModelProgramID = CompileGLShader(
-		"render model",
-
-		// vertex shader
-		"#version 330\n"
-		"\n"
-		"layout (location = 0) in vec3 Position;\n"
-		"layout (location = 1) in vec3 Normal;\n"
-		"layout (location = 2) in vec3 v3ColorIn;\n"
-		"\n"
-		"uniform mat4 gWVP;\n"
-		"uniform mat4 gWorld;\n"
-		"\n"
-		"out vec4 v4Color;\n"
-		"out vec3 Normal0;\n"
-		"out vec3 WorldPos0;\n"
-		"\n"
-		"void main()\n"
-		"{\n"
-		" gl_Position = gWVP * vec4(Position, 1.0);\n"
-		" v4Color = vec4(v3ColorIn, 1.0);\n"
-		" Normal0 = (gWorld * vec4(Normal, 0.0)).xyz;\n"
-		" WorldPos0 = (gWorld * vec4(Position, 1.0)).xyz;\n"
-		"}\n",
-
-		//fragment shader
+    /// The lit RGB fragment shader is shared by the plain and instanced programs
+    const char *pchLitRGBFragmentShader =
 		"#version 330\n"
 		"\n"
 		"const int MAX_POINT_LIGHTS = 2;\n"
@@ -917,8 +1030,35 @@ bool CMainApplication::CreateAllShaders()
 		" }\n"
 		"\n"
 		" FragColor = v4Color * TotalLight;\n"
-		"}\n"
+		"}\n";
+
+    m_unLitRGBModelProgramID = CompileGLShader(
+		"render model",
+
+		// vertex shader
+		"#version 330\n"
+		"\n"
+		"layout (location = 0) in vec3 Position;\n"
+		"layout (location = 1) in vec3 Normal;\n"
+		"layout (location = 2) in vec3 v3ColorIn;\n"
+		"\n"
+		"uniform mat4 gWVP;\n"
+		"uniform mat4 gWorld;\n"
+		"\n"
+		"out vec4 v4Color;\n"
+		"out vec3 Normal0;\n"
+		"out vec3 WorldPos0;\n"
+		"\n"
+		"void main()\n"
+		"{\n"
+		" gl_Position = gWVP * vec4(Position, 1.0);\n"
+		" v4Color = vec4(v3ColorIn, 1.0);\n"
+		" Normal0 = (gWorld * vec4(Normal, 0.0)).xyz;\n"
+		" WorldPos0 = (gWorld * vec4(Position, 1.0)).xyz;\n"
+		"}\n",
 
+		//fragment shader
+		pchLitRGBFragmentShader
 		);
 
     m_nLitRGBModelMatrixLocation = glGetUniformLocation( m_unLitRGBModelProgramID, "gWVP");
@@ -942,6 +1082,524 @@ bool CMainApplication::CreateAllShaders()
 		return false;
 	}
 
+    m_unLitInstancedProgramID = CompileGLShader(
+        "instanced model",
+
+        // vertex shader
+        "#version 330\n"
+        "\n"
+        "layout (location = 0) in vec3 Position;\n"
+        "layout (location = 1) in vec3 Normal;\n"
+        "layout (location = 2) in vec3 v3ColorIn;\n"
+        "layout (location = 3) in vec3 v3InstanceOffset;\n"
+        "layout (location = 4) in vec3 v3InstanceColor;\n"
+        "layout (location = 5) in vec4 v4InstanceRotation;\n"
+        "layout (location = 6) in vec4 v4InstanceScale;\n"
+        "\n"
+        "uniform mat4 gWVP;\n"
+        "uniform mat4 gWorld;\n"
+        "\n"
+        "out vec4 v4Color;\n"
+        "out vec3 Normal0;\n"
+        "out vec3 WorldPos0;\n"
+        "\n"
+        "vec3 rotate(vec4 q, vec3 v)\n"
+        "{\n"
+        " return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);\n"
+        "}\n"
+        "\n"
+        "void main()\n"
+        "{\n"
+        " vec3 p = Position;\n"
+        " vec3 s = v4InstanceScale.xyz;\n"
+        // Arrows: w is the head's share of the length, and the template's head starts at x=2.
+        // Scale is (length, shaft radius, head radius), so shaft and head scale separately.
+        " if( v4InstanceScale.w > 0.0 )\n"
+        " {\n"
+        "  float head = v4InstanceScale.w;\n"
+        "  bool in_head = p.x > 1.5;\n"
+        "  float radius = in_head ? s.z : s.y;\n"
+        "  float part = in_head ? head : 1.0 - head;\n"
+        "  p.x = in_head ? p.x - 2.0 + (1.0 - head) / head : p.x;\n"
+        "  s = vec3(s.x * part, radius, radius);\n"
+        " }\n"
+        " vec4 Pos = vec4(rotate(v4InstanceRotation, p * s) + v3InstanceOffset, 1.0);\n"
+        " gl_Position = gWVP * Pos;\n"
+        " v4Color = vec4(v3ColorIn * v3InstanceColor, 1.0);\n"
+        // Normals scale by the inverse, so squashed spheres still shade right
+        " vec3 n = rotate(v4InstanceRotation, Normal / max(s, vec3(1e-6)));\n"
+        " Normal0 = (gWorld * vec4(normalize(n), 0.0)).xyz;\n"
+        " WorldPos0 = (gWorld * Pos).xyz;\n"
+        "}\n",
+
+        //fragment shader
+        pchLitRGBFragmentShader
+        );
+
+    m_nLitInstancedMatrixLocation = glGetUniformLocation( m_unLitInstancedProgramID, "gWVP");
+    m_WorldMatrixInstancedLocation = glGetUniformLocation( m_unLitInstancedProgramID, "gWorld");
+    m_eyeWorldPosInstancedLocation = glGetUniformLocation( m_unLitInstancedProgramID, "gEyeWorldPos");
+    m_dirLightInstancedLocation.Color = glGetUniformLocation( m_unLitInstancedProgramID, "gDirectionalLight.Base.Color");
+    m_dirLightInstancedLocation.AmbientIntensity = glGetUniformLocation( m_unLitInstancedProgramID, "gDirectionalLight.Base.AmbientIntensity");
+    m_dirLightInstancedLocation.Direction = glGetUniformLocation( m_unLitInstancedProgramID, "gDirectionalLight.Direction");
+    m_dirLightInstancedLocation.DiffuseIntensity = glGetUniformLocation( m_unLitInstancedProgramID, "gDirectionalLight.Base.DiffuseIntensity");
+    m_numPointLightsInstancedLocation = glGetUniformLocation( m_unLitInstancedProgramID, "gNumPointLights");
+    m_numSpotLightsInstancedLocation = glGetUniformLocation( m_unLitInstancedProgramID, "gNumSpotLights");
+
+    if( m_nLitInstancedMatrixLocation == -1 )
+    {
+        dprintf( "Unable to find matrix uniform in instanced model shader\n" );
+        return false;
+    }
+
+    m_unMarkerPointsProgramID = CompileGLShader(
+        "marker points",
+
+        // vertex shader
+        "#version 410\n"
+        "uniform mat4 matrix;\n"
+        "uniform float fPointScale;\n"
+        "layout(location = 0) in vec3 position;\n"
+        "layout(location = 2) in vec3 v3ColorIn;\n"
+        "out vec4 v4Color;\n"
+        "void main()\n"
+        "{\n"
+        "	v4Color = vec4(v3ColorIn, 1.0);\n"
+        "	gl_Position = matrix * vec4(position, 1.0);\n"
+        "	gl_PointSize = max(1.0, fPointScale / gl_Position.w);\n"
+        "}\n",
+
+        // fragment shader
+        "#version 410\n"
+        "in vec4 v4Color;\n"
+        "out vec4 outputColor;\n"
+        "void main()\n"
+        "{\n"
+        "   outputColor = v4Color;\n"
+        "}\n"
+        );
+    m_nMarkerPointsMatrixLocation = glGetUniformLocation( m_unMarkerPointsProgramID, "matrix" );
+    m_nMarkerPointsScaleLocation = glGetUniformLocation( m_unMarkerPointsProgramID, "fPointScale" );
+    if( m_nMarkerPointsMatrixLocation == -1 )
+    {
+        dprintf( "Unable to find matrix uniform in marker points shader\n" );
+        return false;
+    }
+
+    /// Lines only upload their endpoints, the geometry shader expands each segment into a quad
+    m_unThickLinesProgramID = CompileGLShader(
+        "thick lines",
+
+        // vertex shader
+        "#version 410\n"
+        "uniform mat4 matrix;\n"
+        "layout(location = 0) in vec3 position;\n"
+        "layout(location = 2) in vec3 v3ColorIn;\n"
+        "out vec3 v3Color;\n"
+        "void main()\n"
+        "{\n"
+        "	v3Color = v3ColorIn;\n"
+        "	gl_Position = matrix * vec4(position, 1.0);\n"
+        "}\n",
+
+        // geometry shader
+        "#version 410\n"
+        "layout(lines) in;\n"
+        "layout(triangle_strip, max_vertices = 4) out;\n"
+        "uniform vec2 v2Viewport;\n"   // render target size in pixels
+        "uniform float fWorldWidth;\n" // width in vr units times the focal length in pixels, 0 for screen space only
+        "uniform float fMinWidth;\n"   // never draw thinner than this many pixels
+        "in vec3 v3Color[];\n"
+        "out vec4 v4Color;\n"
+        "void main()\n"
+        "{\n"
+        "	vec4 p0 = gl_in[0].gl_Position;\n"
+        "	vec4 p1 = gl_in[1].gl_Position;\n"
+        "	vec3 c0 = v3Color[0];\n"
+        "	vec3 c1 = v3Color[1];\n"
+        "	const float fNear = 0.0001;\n"
+        "	if( p0.w < fNear && p1.w < fNear ) return;\n"
+        "	if( p0.w < fNear ) { float t = (fNear - p0.w) / (p1.w - p0.w); p0 = mix(p0, p1, t); c0 = mix(c0, c1, t); }\n"
+        "	else if( p1.w < fNear ) { float t = (fNear - p1.w) / (p0.w - p1.w); p1 = mix(p1, p0, t); c1 = mix(c1, c0, t); }\n"
+        "	vec2 v2Half = 0.5 * v2Viewport;\n"
+        "	vec2 dir = p1.xy / p1.w * v2Half - p0.xy / p0.w * v2Half;\n"
+        "	if( dot(dir, dir) < 1e-8 ) dir = vec2(1.0, 0.0);\n"
+        "	vec2 normal = normalize(vec2(-dir.y, dir.x));\n"
+        "	vec2 o0 = normal * 0.5 * max(fMinWidth, fWorldWidth / p0.w) / v2Half * p0.w;\n"
+        "	vec2 o1 = normal * 0.5 * max(fMinWidth, fWorldWidth / p1.w) / v2Half * p1.w;\n"
+        "	v4Color = vec4(c0, 1.0); gl_Position = vec4(p0.xy + o0, p0.zw); EmitVertex();\n"
+        "	v4Color = vec4(c0, 1.0); gl_Position = vec4(p0.xy - o0, p0.zw); EmitVertex();\n"
+        "	v4Color = vec4(c1, 1.0); gl_Position = vec4(p1.xy + o1, p1.zw); EmitVertex();\n"
+        "	v4Color = vec4(c1, 1.0); gl_Position = vec4(p1.xy - o1, p1.zw); EmitVertex();\n"
+        "	EndPrimitive();\n"
+        "}\n",
+
+        // fragment shader
+        "#version 410\n"
+        "in vec4 v4Color;\n"
+        "out vec4 outputColor;\n"
+        "void main()\n"
+        "{\n"
+        "   outputColor = v4Color;\n"
+        "}\n"
+        );
+    m_nThickLinesMatrixLocation = glGetUniformLocation( m_unThickLinesProgramID, "matrix" );
+    m_nThickLinesViewportLocation = glGetUniformLocation( m_unThickLinesProgramID, "v2Viewport" );
+    m_nThickLinesWorldWidthLocation = glGetUniformLocation( m_unThickLinesProgramID, "fWorldWidth" );
+    m_nThickLinesMinWidthLocation = glGetUniformLocation( m_unThickLinesProgramID, "fMinWidth" );
+    if( m_nThickLinesMatrixLocation == -1 )
+    {
+        dprintf( "Unable to find matrix uniform in thick lines shader\n" );
+        return false;
+    }
+
+    /// Text glyphs are offsets from an anchor, turned to face the viewer here rather than on the CPU
+    m_unTextProgramID = CompileGLShader(
+        "sdf text",
+
+        // vertex shader
+        "#version 410\n"
+        "uniform mat4 matrix;\n"
+        "uniform mat4 gWorld;\n"
+        "uniform vec3 v3Anchor;\n"
+        "uniform vec3 v3Right;\n"
+        "uniform vec3 v3Up;\n"
+        "layout(location = 0) in vec3 position;\n"
+        "layout(location = 2) in vec3 v3TexCoordIn;\n" // texture coordinates ride in the color slot
+        "out vec2 v2TexCoord;\n"
+        "void main()\n"
+        "{\n"
+        "	v2TexCoord = v3TexCoordIn.xy;\n"
+        "	vec4 anchor = gWorld * vec4(v3Anchor, 1.0);\n"
+        "	gl_Position = matrix * vec4(anchor.xyz + v3Right * position.x + v3Up * position.y, 1.0);\n"
+        "}\n",
+
+        // fragment shader
+        "#version 410\n"
+        "uniform sampler2D atlas;\n"
+        "uniform vec4 v4Color;\n"
+        "in vec2 v2TexCoord;\n"
+        "out vec4 outputColor;\n"
+        "void main()\n"
+        "{\n"
+        "	float dist = texture(atlas, v2TexCoord).r;\n"
+        "	float edge = fwidth(dist);\n"
+        "	float alpha = smoothstep(0.5 - edge, 0.5 + edge, dist) * v4Color.a;\n"
+        "	if( alpha < 0.01 ) discard;\n"
+        "	outputColor = vec4(v4Color.rgb, alpha);\n"
+        "}\n"
+        );
+    m_nTextMatrixLocation = glGetUniformLocation( m_unTextProgramID, "matrix" );
+    m_nTextWorldLocation = glGetUniformLocation( m_unTextProgramID, "gWorld" );
+    m_nTextAnchorLocation = glGetUniformLocation( m_unTextProgramID, "v3Anchor" );
+    m_nTextRightLocation = glGetUniformLocation( m_unTextProgramID, "v3Right" );
+    m_nTextUpLocation = glGetUniformLocation( m_unTextProgramID, "v3Up" );
+    m_nTextColorLocation = glGetUniformLocation( m_unTextProgramID, "v4Color" );
+    m_nTextAtlasLocation = glGetUniformLocation( m_unTextProgramID, "atlas" );
+    if( m_nTextMatrixLocation == -1 )
+    {
+        dprintf( "Unable to find matrix uniform in text shader\n" );
+        return false;
+    }
+
+    /// Every copy of a mesh asset in one draw, each with its own transform and color.
+    /// Same ambient + one directional light as the other marker shaders.
+    m_unAssetInstancedProgramID = CompileGLShader(
+        "instanced asset",
+
+        // vertex shader
+        "#version 410\n"
+        "uniform mat4 matrix;\n"
+        "layout(location = 0) in vec3 position;\n"
+        "layout(location = 1) in vec3 v3NormalIn;\n"
+        "layout(location = 2) in vec3 v3ColorIn;\n" // or texture coordinates, for textured submeshes
+        "layout(location = 3) in mat4 m4Instance;\n" // takes locations 3 to 6
+        "layout(location = 7) in vec4 v4InstanceColor;\n"
+        "out vec3 v3Color;\n"
+        "out vec3 v3Normal;\n"
+        "out vec4 v4Tint;\n"
+        "void main()\n"
+        "{\n"
+        "	v3Color = v3ColorIn;\n"
+        "	v3Normal = mat3(m4Instance) * v3NormalIn;\n"
+        "	v4Tint = v4InstanceColor;\n"
+        "	gl_Position = matrix * m4Instance * vec4(position, 1.0);\n"
+        "}\n",
+
+        // fragment shader
+        "#version 410\n"
+        "uniform sampler2D diffuse;\n"
+        "uniform bool bTextured;\n"
+        "in vec3 v3Color;\n"
+        "in vec3 v3Normal;\n"
+        "in vec4 v4Tint;\n"
+        "out vec4 outputColor;\n"
+        "void main()\n"
+        "{\n"
+        "	vec3 base = bTextured ? texture(diffuse, v3Color.xy).rgb : v3Color;\n"
+        "	if( v4Tint.a > 0.5 ) base = v4Tint.rgb;\n"
+        "	float light = 0.15 + 0.5 * max(dot(normalize(v3Normal), -vec3(0.70710678118, 0, 0.70710678118)), 0.0);\n"
+        "	outputColor = vec4(base * light, 1.0);\n"
+        "}\n"
+        );
+    m_nAssetMatrixLocation = glGetUniformLocation( m_unAssetInstancedProgramID, "matrix" );
+    m_nAssetTexturedLocation = glGetUniformLocation( m_unAssetInstancedProgramID, "bTextured" );
+    m_nAssetTextureLocation = glGetUniformLocation( m_unAssetInstancedProgramID, "diffuse" );
+    if( m_nAssetMatrixLocation == -1 )
+    {
+        dprintf( "Unable to find matrix uniform in instanced asset shader\n" );
+        return false;
+    }
+
+    /// The cached HUD layer, as a head-locked quad. The corners come from gl_VertexID, so there's no vertex buffer
+    m_unHudProgramID = CompileGLShader(
+        "hud layer",
+
+        // vertex shader
+        "#version 410\n"
+        "uniform mat4 matrix;\n"
+        "uniform vec2 v2Extent;\n"
+        "out vec2 v2UV;\n"
+        "void main()\n"
+        "{\n"
+        "	v2UV = vec2( gl_VertexID & 1, gl_VertexID >> 1 );\n"
+        "	gl_Position = matrix * vec4( ( v2UV * 2.0 - 1.0 ) * v2Extent, -1.0, 1.0 );\n"
+        "}\n",
+
+        // fragment shader, the layer is premultiplied alpha
+        "#version 410\n"
+        "uniform sampler2D hud;\n"
+        "in vec2 v2UV;\n"
+        "out vec4 outputColor;\n"
+        "void main()\n"
+        "{\n"
+        "	outputColor = texture(hud, v2UV);\n"
+        "}\n"
+        );
+    m_nHudMatrixLocation = glGetUniformLocation( m_unHudProgramID, "matrix" );
+    m_nHudExtentLocation = glGetUniformLocation( m_unHudProgramID, "v2Extent" );
+    m_nHudTextureLocation = glGetUniformLocation( m_unHudProgramID, "hud" );
+    if( m_nHudMatrixLocation == -1 )
+    {
+        dprintf( "Unable to find matrix uniform in hud layer shader\n" );
+        return false;
+    }
+
+    /// Occupancy grids, one quad whose corners come from gl_VertexID, colored from the raw cell values
+    m_unOccupancyGridProgramID = CompileGLShader(
+        "occupancy grid",
+
+        // vertex shader
+        "#version 410\n"
+        "uniform mat4 matrix;\n"
+        "out vec2 v2UV;\n"
+        "void main()\n"
+        "{\n"
+        "	v2UV = vec2( gl_VertexID & 1, gl_VertexID >> 1 );\n"
+        "	gl_Position = matrix * vec4( v2UV, 0.0, 1.0 );\n"
+        "}\n",
+
+        // fragment shader, same palette as rviz's map scheme: free is white, occupied is black
+        "#version 410\n"
+        "uniform sampler2D grid;\n"
+        "uniform float fAlpha;\n"
+        "in vec2 v2UV;\n"
+        "out vec4 outputColor;\n"
+        "void main()\n"
+        "{\n"
+        "	float value = texture(grid, v2UV).r * 255.0;\n"
+        "	vec3 color = vec3( 1.0 - value / 100.0 );\n"
+        "	if( value > 100.5 )\n"  // unknown (-1), or out of range
+        "		color = vec3( 0.44, 0.54, 0.53 );\n"
+        "	outputColor = vec4( color, fAlpha );\n"
+        "}\n"
+        );
+    m_nOccupancyGridMatrixLocation = glGetUniformLocation( m_unOccupancyGridProgramID, "matrix" );
+    m_nOccupancyGridTextureLocation = glGetUniformLocation( m_unOccupancyGridProgramID, "grid" );
+    m_nOccupancyGridAlphaLocation = glGetUniformLocation( m_unOccupancyGridProgramID, "fAlpha" );
+    if( m_nOccupancyGridMatrixLocation == -1 )
+    {
+        dprintf( "Unable to find matrix uniform in occupancy grid shader\n" );
+        return false;
+    }
+
+    /// Heightfields. The grid comes from gl_VertexID, two triangles per quad, and each vertex
+    /// fetches its own height. Sides longer than HEIGHTFIELD_MAX_SIDE (1024) skip cells.
+    m_unHeightfieldProgramID = CompileGLShader(
+        "heightfield",
+
+        // vertex shader
+        "#version 410\n"
+        "uniform mat4 matrix;\n"
+        "uniform mat4 world;\n"       // grid to vr world, for the normals
+        "uniform sampler2D heights;\n"
+        "uniform ivec2 v2Offset;\n"   // where the data starts, it wraps around from there
+        "out float fHeight;\n"
+        "out float fValid;\n"
+        "out vec3 v3Normal;\n"
+        "vec3 cellPosition( ivec2 cell, ivec2 size, float fallback )\n"
+        "{\n"
+        "	float h = texelFetch( heights, ( cell + v2Offset ) % size, 0 ).r;\n"
+        "	return vec3( vec2( cell ) + 0.5, isnan( h ) ? fallback : h );\n"
+        "}\n"
+        "void main()\n"
+        "{\n"
+        "	const ivec2 corners[6] = ivec2[6]( ivec2(0,0), ivec2(1,0), ivec2(1,1), ivec2(0,0), ivec2(1,1), ivec2(0,1) );\n"
+        "	ivec2 size = textureSize( heights, 0 );\n"
+        "	int step = max( 1, ( max( size.x, size.y ) + 1023 ) / 1024 );\n"
+        "	int quadsX = ( size.x - 2 ) / step + 1;\n"
+        "	int quad = gl_VertexID / 6;\n"
+        "	ivec2 cell = min( ( ivec2( quad % quadsX, quad / quadsX ) + corners[gl_VertexID % 6] ) * step, size - 1 );\n"
+        "	float h = texelFetch( heights, ( cell + v2Offset ) % size, 0 ).r;\n"
+        "	fValid = isnan( h ) ? 0.0 : 1.0;\n"
+        "	fHeight = isnan( h ) ? 0.0 : h;\n"
+        "	vec3 px = cellPosition( min( cell + ivec2( step, 0 ), size - 1 ), size, fHeight );\n"
+        "	vec3 mx = cellPosition( max( cell - ivec2( step, 0 ), ivec2( 0 ) ), size, fHeight );\n"
+        "	vec3 py = cellPosition( min( cell + ivec2( 0, step ), size - 1 ), size, fHeight );\n"
+        "	vec3 my = cellPosition( max( cell - ivec2( 0, step ), ivec2( 0 ) ), size, fHeight );\n"
+        "	v3Normal = cross( ( world * vec4( px - mx, 0.0 ) ).xyz, ( world * vec4( py - my, 0.0 ) ).xyz );\n"
+        "	gl_Position = matrix * vec4( vec2( cell ) + 0.5, fHeight, 1.0 );\n"
+        "}\n",
+
+        // fragment shader, colored low to high like rviz's rainbow, and lit from above
+        "#version 410\n"
+        "uniform vec2 v2Range;\n"
+        "in float fHeight;\n"
+        "in float fValid;\n"
+        "in vec3 v3Normal;\n"
+        "out vec4 outputColor;\n"
+        "void main()\n"
+        "{\n"
+        "	if( fValid < 0.999 )\n"      // touches a cell with no data
+        "		discard;\n"
+        "	float t = clamp( ( fHeight - v2Range.x ) / max( v2Range.y - v2Range.x, 1e-6 ), 0.0, 1.0 );\n"
+        "	vec3 color = clamp( 1.5 - abs( 4.0 * t - vec3( 3.0, 2.0, 1.0 ) ), 0.0, 1.0 );\n"
+        "	float light = 0.4 + 0.6 * abs( dot( normalize( v3Normal ), vec3( 0.0, 0.70710678118, -0.70710678118 ) ) );\n"
+        "	outputColor = vec4( color * light, 1.0 );\n"
+        "}\n"
+        );
+    m_nHeightfieldMatrixLocation = glGetUniformLocation( m_unHeightfieldProgramID, "matrix" );
+    m_nHeightfieldWorldLocation = glGetUniformLocation( m_unHeightfieldProgramID, "world" );
+    m_nHeightfieldTextureLocation = glGetUniformLocation( m_unHeightfieldProgramID, "heights" );
+    m_nHeightfieldOffsetLocation = glGetUniformLocation( m_unHeightfieldProgramID, "v2Offset" );
+    m_nHeightfieldRangeLocation = glGetUniformLocation( m_unHeightfieldProgramID, "v2Range" );
+    if( m_nHeightfieldMatrixLocation == -1 )
+    {
+        dprintf( "Unable to find matrix uniform in heightfield shader\n" );
+        return false;
+    }
+
+    /// YUV camera images to RGB, drawn over the whole overlay texture with one triangle from gl_VertexID.
+    /// iLayout is ImageStreamer::Layout, iRows where NV12/NV21's chroma starts, iColorSpace ImageStreamer::ColorSpace
+    m_unYUVProgramID = CompileGLShader(
+        "yuv",
+
+        // vertex shader
+        "#version 410\n"
+        "void main()\n"
+        "{\n"
+        "	vec2 corner = vec2( ( gl_VertexID << 1 ) & 2, gl_VertexID & 2 );\n"
+        "	gl_Position = vec4( corner * 2.0 - 1.0, 0.0, 1.0 );\n"
+        "}\n",
+
+        // fragment shader, BT.601 video range (like cv_bridge's conversion) unless iColorSpace says otherwise
+        "#version 410\n"
+        "uniform sampler2D yuv;\n"
+        "uniform int iLayout;\n"
+        "uniform int iRows;\n"
+        "uniform int iColorSpace;\n"
+        "out vec4 outputColor;\n"
+        "void main()\n"
+        "{\n"
+        "	ivec2 pixel = ivec2( gl_FragCoord.xy );\n"
+        "	float y, u, v;\n"
+        "	if( iLayout <= 2 )\n"      // 4:2:2, one texel per pair of pixels
+        "	{\n"
+        "		vec4 pair = texelFetch( yuv, ivec2( pixel.x >> 1, pixel.y ), 0 );\n"
+        "		if( iLayout == 1 )\n"  // UYVY
+        "			pair = pair.grab;\n"
+        "		y = ( pixel.x & 1 ) == 0 ? pair.r : pair.b;\n"
+        "		u = pair.g;\n"
+        "		v = pair.a;\n"
+        "	}\n"
+        "	else\n"                    // NV12/NV21, a chroma pair for every 2x2 pixels
+        "	{\n"
+        "		y = texelFetch( yuv, pixel, 0 ).r;\n"
+        "		ivec2 chroma = ivec2( pixel.x & ~1, iRows + ( pixel.y >> 1 ) );\n"
+        "		u = texelFetch( yuv, chroma, 0 ).r;\n"
+        "		v = texelFetch( yuv, chroma + ivec2( 1, 0 ), 0 ).r;\n"
+        "		if( iLayout == 4 )\n"
+        "		{\n"
+        "			float swap = u;\n"
+        "			u = v;\n"
+        "			v = swap;\n"
+        "		}\n"
+        "	}\n"
+        "	u -= 0.5;\n"
+        "	v -= 0.5;\n"
+        "	if( ( iColorSpace & 1 ) == 0 )\n"   // video range, luma 16-235 and chroma 16-240
+        "	{\n"
+        "		y = 1.164 * ( y - 0.0625 );\n"
+        "		u *= 1.138;\n"
+        "		v *= 1.138;\n"
+        "	}\n"
+        "	vec3 rgb;\n"
+        "	if( ( iColorSpace & 2 ) == 0 )\n"   // BT.601
+        "		rgb = vec3( y + 1.402 * v, y - 0.344 * u - 0.714 * v, y + 1.772 * u );\n"
+        "	else\n"                              // BT.709
+        "		rgb = vec3( y + 1.575 * v, y - 0.187 * u - 0.468 * v, y + 1.856 * u );\n"
+        "	outputColor = vec4( clamp( rgb, 0.0, 1.0 ), 1.0 );\n"
+        "}\n"
+        );
+    m_nYUVLayoutLocation = glGetUniformLocation( m_unYUVProgramID, "iLayout" );
+    m_nYUVRowsLocation = glGetUniformLocation( m_unYUVProgramID, "iRows" );
+    m_nYUVColorSpaceLocation = glGetUniformLocation( m_unYUVProgramID, "iColorSpace" );
+    if( m_nYUVLayoutLocation == -1 )
+    {
+        dprintf( "Unable to find layout uniform in yuv shader\n" );
+        return false;
+    }
+
+    /// Camera images in the world, one instance per camera. Each corner is where the edges of
+    /// the image reach at the plane's depth, in the camera's optical frame (x right, y down)
+    m_unCameraPlaneProgramID = CompileGLShader(
+        "camera plane",
+
+        // vertex shader
+        "#version 410\n"
+        "uniform mat4 matrix;\n"
+        "layout(location = 0) in mat4 camera;\n"
+        "layout(location = 4) in vec4 frustum;\n"
+        "layout(location = 5) in vec2 depthLayer;\n"
+        "out vec3 v3UV;\n"
+        "void main()\n"
+        "{\n"
+        "	vec2 corner = vec2( gl_VertexID & 1, gl_VertexID >> 1 );\n"
+        "	vec2 edge = mix( frustum.xy, frustum.zw, corner );\n"
+        "	v3UV = vec3( corner, depthLayer.y );\n"  // the first row of the image is v=0
+        "	gl_Position = matrix * camera * vec4( edge * depthLayer.x, depthLayer.x, 1.0 );\n"
+        "}\n",
+
+        // fragment shader
+        "#version 410\n"
+        "uniform sampler2DArray images;\n"
+        "uniform float fAlpha;\n"
+        "in vec3 v3UV;\n"
+        "out vec4 outputColor;\n"
+        "void main()\n"
+        "{\n"
+        "	outputColor = vec4( texture( images, v3UV ).rgb, fAlpha );\n"
+        "}\n"
+        );
+    m_nCameraPlaneMatrixLocation = glGetUniformLocation( m_unCameraPlaneProgramID, "matrix" );
+    m_nCameraPlaneTextureLocation = glGetUniformLocation( m_unCameraPlaneProgramID, "images" );
+    m_nCameraPlaneAlphaLocation = glGetUniformLocation( m_unCameraPlaneProgramID, "fAlpha" );
+    if( m_nCameraPlaneMatrixLocation == -1 )
+    {
+        dprintf( "Unable to find matrix uniform in camera plane shader\n" );
+        return false;
+    }
+
 
 
 
@@ -1402,6 +2060,9 @@ void CMainApplication::RenderControllerAxes()
 		offset += sizeof( Vector3 );
 		glEnableVertexAttribArray( 1 );
 		glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
+		// the thick line shader reads color from the same slot as the marker geometry
+		glEnableVertexAttribArray( 2 );
+		glVertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
 
 		glBindVertexArray( 0 );
 	}
@@ -1610,9 +2271,12 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
 
 	if( bIsInputAvailable )
 	{
-		// draw the controller axis lines
-		glUseProgram( m_unControllerTransformProgramID );
-		glUniformMatrix4fv( m_nControllerMatrixLocation, 1, GL_FALSE, GetCurrentViewProjectionMatrix( nEye ).get() );
+		// draw the controller axis lines, a fixed number of pixels wide
+		glUseProgram( m_unThickLinesProgramID );
+		glUniformMatrix4fv( m_nThickLinesMatrixLocation, 1, GL_FALSE, GetCurrentViewProjectionMatrix( nEye ).get() );
+		glUniform2f( m_nThickLinesViewportLocation, m_nRenderWidth, m_nRenderHeight );
+		glUniform1f( m_nThickLinesWorldWidthLocation, 0.0f );
+		glUniform1f( m_nThickLinesMinWidthLocation, m_fLineWidth );
 		glBindVertexArray( m_unControllerVAO );
 		glDrawArrays( GL_LINES, 0, m_uiControllerVertcount );
 		glBindVertexArray( 0 );
@@ -1650,19 +2314,120 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
 
 
     for(int idx=0;idx<robot_meshes.size();idx++){
+        if(robot_meshes[idx]->hud){
+            /// Already in the HUD layer
+            continue;
+        }
 
         //robot_meshes[idx]->Render();
         for(int jj=0;jj<robot_meshes[idx]->m_Entries.size();jj++){
-            if(robot_meshes[idx]->initialized){
+            if(robot_meshes[idx]->initialized && robot_meshes[idx]->m_Entries[jj].NumIndices>0){
                 //std::cout << "Rendering " << robot_meshes[idx]->name << " ID=" << robot_meshes[idx]->id << std::endl;
 
-                if(robot_meshes[idx]->m_Entries[jj].MaterialIndex!=NO_TEXTURE){
+                if(robot_meshes[idx]->m_Entries[jj].MaterialIndex==SDF_TEXT){
+
+                    // ----- Text marker rendering (TEXT_VIEW_FACING) -----
+                    const Mesh::MeshEntry &entry = robot_meshes[idx]->m_Entries[jj];
+                    glUseProgram( m_unTextProgramID );
+
+                    const Matrix4 &matWorld = robot_meshes[idx]->pose;
+                    glUniformMatrix4fv( m_nTextMatrixLocation, 1, GL_FALSE, GetCurrentViewProjectionMatrix( nEye ).get() );
+                    glUniformMatrix4fv( m_nTextWorldLocation, 1, GL_FALSE, matWorld.get() );
+                    glUniform3f( m_nTextAnchorLocation, robot_meshes[idx]->text_anchor.x, robot_meshes[idx]->text_anchor.y, robot_meshes[idx]->text_anchor.z );
+                    /// The rows of the view rotation are the head's right and up vectors in world space
+                    glUniform3f( m_nTextRightLocation, m_mat4HMDPose[0], m_mat4HMDPose[4], m_mat4HMDPose[8] );
+                    glUniform3f( m_nTextUpLocation, m_mat4HMDPose[1], m_mat4HMDPose[5], m_mat4HMDPose[9] );
+                    const visualization_msgs::Marker &marker = robot_meshes[idx]->marker;
+                    glUniform4f( m_nTextColorLocation, marker.color.r, marker.color.g, marker.color.b, marker.color.a );
+                    glUniform1i( m_nTextAtlasLocation, 0 );
+                    Mesh::text_atlas.Bind( GL_TEXTURE0 );
+
+                    glEnable( GL_BLEND );
+                    glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+                    glBindVertexArray( entry.VA );
+                    glDrawElementsBaseVertex( GL_TRIANGLES, entry.NumIndices, GL_UNSIGNED_INT,
+                                              (void*)(sizeof(u_int32_t)*entry.FirstIndex),
+                                              entry.BaseVertex );
+                    glBindVertexArray( 0 );
+                    glDisable( GL_BLEND );
+
+                    glUseProgram( 0 );
+                }else if(robot_meshes[idx]->m_Entries[jj].MaterialIndex==OCCUPANCY_GRID){
+
+                    // ----- Occupancy grid rendering, the whole map in one quad -----
+                    const Mesh::MeshEntry &entry = robot_meshes[idx]->m_Entries[jj];
+                    glUseProgram( m_unOccupancyGridProgramID );
+
+                    Matrix4 matMVP = GetCurrentViewProjectionMatrix( nEye ) * robot_meshes[idx]->pose * robot_meshes[idx]->trans;
+                    glUniformMatrix4fv( m_nOccupancyGridMatrixLocation, 1, GL_FALSE, matMVP.get() );
+                    glUniform1i( m_nOccupancyGridTextureLocation, 0 );
+                    glUniform1f( m_nOccupancyGridAlphaLocation, m_fMapAlpha );
+                    glActiveTexture( GL_TEXTURE0 );
+                    glBindTexture( GL_TEXTURE_2D, entry.DataTexture );
+
+                    glEnable( GL_BLEND );
+                    glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+                    glBindVertexArray( entry.VA );
+                    glDrawArrays( GL_TRIANGLE_STRIP, 0, entry.NumIndices );
+                    glBindVertexArray( 0 );
+                    glDisable( GL_BLEND );
+                    glBindTexture( GL_TEXTURE_2D, 0 );
+
+                    glUseProgram( 0 );
+                }else if(robot_meshes[idx]->m_Entries[jj].MaterialIndex==CAMERA_PLANE){
+
+                    // ----- Camera images in the world, every camera in one instanced quad -----
+                    const Mesh::MeshEntry &entry = robot_meshes[idx]->m_Entries[jj];
+                    if(entry.NumInstances==0){
+                        continue;
+                    }
+                    glUseProgram( m_unCameraPlaneProgramID );
+
+                    Matrix4 matMVP = GetCurrentViewProjectionMatrix( nEye ) * robot_meshes[idx]->pose;
+                    glUniformMatrix4fv( m_nCameraPlaneMatrixLocation, 1, GL_FALSE, matMVP.get() );
+                    glUniform1i( m_nCameraPlaneTextureLocation, 0 );
+                    glUniform1f( m_nCameraPlaneAlphaLocation, m_fCameraPlaneAlpha );
+                    glActiveTexture( GL_TEXTURE0 );
+                    glBindTexture( GL_TEXTURE_2D_ARRAY, entry.DataTexture );
+
+                    glEnable( GL_BLEND );
+                    glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+                    glBindVertexArray( entry.InstanceVA );
+                    glDrawArraysInstanced( GL_TRIANGLE_STRIP, 0, entry.NumIndices, entry.NumInstances );
+                    glBindVertexArray( 0 );
+                    glDisable( GL_BLEND );
+                    glBindTexture( GL_TEXTURE_2D_ARRAY, 0 );
+
+                    glUseProgram( 0 );
+                }else if(robot_meshes[idx]->m_Entries[jj].MaterialIndex==HEIGHTFIELD){
+
+                    // ----- Heightfield rendering (costmaps, grid maps), no geometry, just the heights -----
+                    const Mesh::MeshEntry &entry = robot_meshes[idx]->m_Entries[jj];
+                    glUseProgram( m_unHeightfieldProgramID );
+
+                    Matrix4 matWorld = robot_meshes[idx]->pose * robot_meshes[idx]->trans;
+                    Matrix4 matMVP = GetCurrentViewProjectionMatrix( nEye ) * matWorld;
+                    glUniformMatrix4fv( m_nHeightfieldMatrixLocation, 1, GL_FALSE, matMVP.get() );
+                    glUniformMatrix4fv( m_nHeightfieldWorldLocation, 1, GL_FALSE, matWorld.get() );
+                    glUniform1i( m_nHeightfieldTextureLocation, 0 );
+                    glUniform2i( m_nHeightfieldOffsetLocation, entry.DataOffset[0], entry.DataOffset[1] );
+                    glUniform2f( m_nHeightfieldRangeLocation, entry.DataMin, entry.DataMax );
+                    glActiveTexture( GL_TEXTURE0 );
+                    glBindTexture( GL_TEXTURE_2D, entry.DataTexture );
+
+                    glBindVertexArray( entry.VA );
+                    glDrawArrays( GL_TRIANGLES, 0, entry.NumIndices );
+                    glBindVertexArray( 0 );
+                    glBindTexture( GL_TEXTURE_2D, 0 );
+
+                    glUseProgram( 0 );
+                }else if(robot_meshes[idx]->m_Entries[jj].MaterialIndex!=NO_TEXTURE){
 
                     // ----- Render Model rendering -----
                     glUseProgram( m_unLitModelProgramID );
 
-                    Matrix4 matMVP = GetCurrentViewProjectionMatrix( nEye ) * GetRobotMatrixPose(robot_meshes[idx]->frame_id);
-                    Matrix4 matWorld = GetRobotMatrixPose(robot_meshes[idx]->frame_id) ;
+                    Matrix4 matMVP = GetCurrentViewProjectionMatrix( nEye ) * robot_meshes[idx]->pose;
+                    const Matrix4 &matWorld = robot_meshes[idx]->pose;
                     Vector4 eyePos = GetHMDMatrixPoseEye(nEye)*Vector4(0,0,0,1);
                     glUniformMatrix4fv( m_nLitModelMatrixLocation, 1, GL_FALSE, matMVP.get() );
 
@@ -1683,18 +2448,105 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
 
                     robot_meshes[idx]->m_Textures[jj]->Bind(GL_TEXTURE0);
 
-                    glDrawElements( GL_TRIANGLES, robot_meshes[idx]->m_Entries[jj].NumIndices, GL_UNSIGNED_INT, 0 );
+                    glDrawElementsBaseVertex( GL_TRIANGLES, robot_meshes[idx]->m_Entries[jj].NumIndices, GL_UNSIGNED_INT,
+                                              (void*)(sizeof(u_int32_t)*robot_meshes[idx]->m_Entries[jj].FirstIndex),
+                                              robot_meshes[idx]->m_Entries[jj].BaseVertex );
+
+                    glBindVertexArray( 0 );
+
+                    glUseProgram( 0 );
+                }else if(robot_meshes[idx]->m_Entries[jj].NumInstances>0){
+
+                    // ----- Instanced marker rendering (CUBE_LIST, SPHERE_LIST, template primitives) -----
+                    const Mesh::MeshEntry &entry = robot_meshes[idx]->m_Entries[jj];
+                    glUseProgram( m_unLitInstancedProgramID );
+
+                    Matrix4 matMVP = GetCurrentViewProjectionMatrix( nEye ) * robot_meshes[idx]->pose;
+                    const Matrix4 &matWorld = robot_meshes[idx]->pose;
+                    Vector4 eyePos = GetHMDMatrixPoseEye(nEye)*Vector4(0,0,0,1);
+                    glUniformMatrix4fv( m_nLitInstancedMatrixLocation, 1, GL_FALSE, matMVP.get() );
+                    glUniformMatrix4fv( m_WorldMatrixInstancedLocation, 1, GL_FALSE, matWorld.get() );
+                    glUniform3f(m_eyeWorldPosInstancedLocation, eyePos.x,eyePos.y,eyePos.z);
+                    glUniform3f(m_dirLightInstancedLocation.Color, 1.0,1.0,1.0);
+                    glUniform1f(m_dirLightInstancedLocation.AmbientIntensity, 0.15);
+                    glUniform3f(m_dirLightInstancedLocation.Direction, 0.70710678118, 0, 0.70710678118);
+                    glUniform1f(m_dirLightInstancedLocation.DiffuseIntensity, 0.5);
+                    glUniform1i(m_numPointLightsInstancedLocation, 0);
+                    glUniform1i(m_numSpotLightsInstancedLocation, 0);
+
+                    unsigned int num_indices = entry.NumIndices;
+                    unsigned int first_index = entry.FirstIndex;
+                    unsigned int base_vertex = entry.BaseVertex;
+                    if(entry.Template>=0){
+                        /// Pick the level of detail from how big the nearest instance could look
+                        Vector4 center = matWorld*Vector4(entry.BoundCenter.x,entry.BoundCenter.y,entry.BoundCenter.z,1);
+                        Vector3 to_eye(center.x-eyePos.x,center.y-eyePos.y,center.z-eyePos.z);
+                        float dist = std::max(to_eye.length()-entry.BoundRadius,0.01f);
+                        float focal_pixels = m_mat4ProjectionLeft[5]*m_nRenderHeight*0.5f;
+                        int lod = Mesh::ChooseLOD(entry.ElementRadius*focal_pixels/dist);
+                        const Mesh::PrimitiveTemplate &prim = Mesh::templates[entry.Template];
+                        num_indices = prim.NumIndices[lod];
+                        first_index = prim.FirstIndex[lod];
+                        base_vertex = prim.BaseVertex[lod];
+                    }
+
+                    /// Every element of the list in one draw call
+                    glBindVertexArray( entry.InstanceVA );
+                    glDrawElementsInstancedBaseVertex( entry.Mode, num_indices, GL_UNSIGNED_INT,
+                                                       (void*)(sizeof(u_int32_t)*first_index),
+                                                       entry.NumInstances, base_vertex );
+                    glBindVertexArray( 0 );
+
+                    glUseProgram( 0 );
+                }else if(robot_meshes[idx]->m_Entries[jj].Mode==GL_LINES){
+
+                    // ----- Thick line marker rendering (LINE_LIST, LINE_STRIP) -----
+                    const Mesh::MeshEntry &entry = robot_meshes[idx]->m_Entries[jj];
+                    glUseProgram( m_unThickLinesProgramID );
+
+                    Matrix4 matMVP = GetCurrentViewProjectionMatrix( nEye ) * robot_meshes[idx]->pose;
+                    const Matrix4 &matProjection = ( nEye == vr::Eye_Left ) ? m_mat4ProjectionLeft : m_mat4ProjectionRight;
+                    glUniformMatrix4fv( m_nThickLinesMatrixLocation, 1, GL_FALSE, matMVP.get() );
+                    glUniform2f( m_nThickLinesViewportLocation, m_nRenderWidth, m_nRenderHeight );
+                    /// scale.x is the line width in world units, but keep at least one pixel so far lines don't vanish
+                    glUniform1f( m_nThickLinesWorldWidthLocation, entry.Width * matProjection[5] * m_nRenderHeight * 0.5f );
+                    glUniform1f( m_nThickLinesMinWidthLocation, 1.0f );
+
+                    glBindVertexArray( entry.VA );
+                    glDrawElementsBaseVertex( entry.Mode, entry.NumIndices, GL_UNSIGNED_INT,
+                                              (void*)(sizeof(u_int32_t)*entry.FirstIndex),
+                                              entry.BaseVertex );
+                    glBindVertexArray( 0 );
 
+                    glUseProgram( 0 );
+                }else if(robot_meshes[idx]->m_Entries[jj].Mode==GL_POINTS){
+
+                    // ----- Point marker rendering (POINTS) -----
+                    const Mesh::MeshEntry &entry = robot_meshes[idx]->m_Entries[jj];
+                    glUseProgram( m_unMarkerPointsProgramID );
+
+                    Matrix4 matMVP = GetCurrentViewProjectionMatrix( nEye ) * robot_meshes[idx]->pose;
+                    glUniformMatrix4fv( m_nMarkerPointsMatrixLocation, 1, GL_FALSE, matMVP.get() );
+                    /// Points are sized in vr units, so scale by the focal length (in pixels) and let the shader divide by depth
+                    const Matrix4 &matProjection = ( nEye == vr::Eye_Left ) ? m_mat4ProjectionLeft : m_mat4ProjectionRight;
+                    glUniform1f( m_nMarkerPointsScaleLocation, entry.Width * matProjection[5] * m_nRenderHeight * 0.5f );
+                    glEnable( GL_PROGRAM_POINT_SIZE );
+
+                    glBindVertexArray( entry.VA );
+                    glDrawElementsBaseVertex( entry.Mode, entry.NumIndices, GL_UNSIGNED_INT,
+                                              (void*)(sizeof(u_int32_t)*entry.FirstIndex),
+                                              entry.BaseVertex );
                     glBindVertexArray( 0 );
 
+                    glDisable( GL_PROGRAM_POINT_SIZE );
                     glUseProgram( 0 );
                 }else{
 
                     // ----- Render Model rendering -----
                     glUseProgram( m_unLitRGBModelProgramID );
 
-                    Matrix4 matMVP = GetCurrentViewProjectionMatrix( nEye ) * GetRobotMatrixPose(robot_meshes[idx]->frame_id);
-                    Matrix4 matWorld = GetRobotMatrixPose(robot_meshes[idx]->frame_id) ;
+                    Matrix4 matMVP = GetCurrentViewProjectionMatrix( nEye ) * robot_meshes[idx]->pose;
+                    const Matrix4 &matWorld = robot_meshes[idx]->pose;
                     Vector4 eyePos = GetHMDMatrixPoseEye(nEye)*Vector4(0,0,0,1);
                     glUniformMatrix4fv( m_nLitRGBModelMatrixLocation, 1, GL_FALSE, matMVP.get() );
 
@@ -1713,7 +2565,9 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
 
                     glBindVertexArray( robot_meshes[idx]->m_Entries[jj].VA );
 
-                    glDrawElements( GL_TRIANGLES, robot_meshes[idx]->m_Entries[jj].NumIndices, GL_UNSIGNED_INT, 0 );
+                    glDrawElementsBaseVertex( GL_TRIANGLES, robot_meshes[idx]->m_Entries[jj].NumIndices, GL_UNSIGNED_INT,
+                                              (void*)(sizeof(u_int32_t)*robot_meshes[idx]->m_Entries[jj].FirstIndex),
+                                              robot_meshes[idx]->m_Entries[jj].BaseVertex );
 
                     glBindVertexArray( 0 );
 
@@ -1723,7 +2577,180 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
         }
     }
 
+    // ----- Mesh resource rendering (MESH_RESOURCE) -----
+    /// The instances were uploaded by UpdateAssetInstances, so each asset is one instanced draw per submesh
+    if(!m_mapAssetInstanceCounts.empty()){
+        glUseProgram( m_unAssetInstancedProgramID );
+        glUniformMatrix4fv( m_nAssetMatrixLocation, 1, GL_FALSE, GetCurrentViewProjectionMatrix( nEye ).get() );
+        glUniform1i( m_nAssetTextureLocation, 0 );
+        for(std::map<AssetCache::Asset*, unsigned int>::iterator it=m_mapAssetInstanceCounts.begin();it!=m_mapAssetInstanceCounts.end();++it){
+            AssetCache::Asset* asset = it->first;
+            for(size_t jj=0;jj<asset->submeshes.size();jj++){
+                const AssetCache::SubMesh &sub = asset->submeshes[jj];
+                if(sub.NumIndices==0){
+                    continue;
+                }
+                if(sub.Texture>=0){
+                    asset->textures[sub.Texture]->Bind(GL_TEXTURE0);
+                }
+                glUniform1i( m_nAssetTexturedLocation, sub.Texture>=0 );
+                glBindVertexArray( sub.InstanceVA );
+                glDrawElementsInstancedBaseVertex( GL_TRIANGLES, sub.NumIndices, GL_UNSIGNED_INT,
+                                                   (void*)(sizeof(u_int32_t)*sub.range.index_offset),
+                                                   it->second, sub.range.vertex_offset );
+            }
+        }
+        glBindVertexArray( 0 );
+    }
+
+    RenderHudLayer( nEye );
+
+	glUseProgram( 0 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Redraws the HUD layer, but only if the HUD text changed since the
+//          last frame. Static status text then costs one quad per eye.
+//-----------------------------------------------------------------------------
+void CMainApplication::UpdateHudLayer()
+{
+	if ( !m_bHudText )
+		return;
+
+	std::vector<Mesh*> hud_meshes;
+	std::vector<double> signature;
+	for ( size_t idx = 0; idx < robot_meshes.size(); idx++ )
+	{
+		const Mesh *mesh = robot_meshes[idx];
+		if ( !mesh->hud || !mesh->initialized || mesh->m_Entries.empty() || mesh->m_Entries[0].NumIndices == 0 )
+			continue;
+		const Mesh::MeshEntry &entry = mesh->m_Entries[0];
+		const visualization_msgs::Marker &marker = mesh->marker;
+		/// The generation catches new text that happens to land in the same range, like "86%" after "87%"
+		double values[] = { mesh->text_anchor.x, mesh->text_anchor.y, mesh->text_anchor.z,
+		                    marker.color.r, marker.color.g, marker.color.b, marker.color.a,
+		                    double( mesh->text_generation ),
+		                    double( entry.FirstIndex ), double( entry.NumIndices ), double( entry.BaseVertex ) };
+		signature.insert( signature.end(), values, values + sizeof( values ) / sizeof( values[0] ) );
+		hud_meshes.push_back( robot_meshes[idx] );
+	}
+	if ( m_unHudFramebuffer != 0 && signature == m_vecHudSignature )
+		return;
+	m_vecHudSignature.swap( signature );
+	m_bHudVisible = !hud_meshes.empty();
+	if ( !m_bHudVisible )
+		return;
+
+	if ( m_unHudFramebuffer == 0 )
+	{
+		glGenTextures( 1, &m_unHudTexture );
+		glBindTexture( GL_TEXTURE_2D, m_unHudTexture );
+		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, m_nHudSize, m_nHudSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+		glBindTexture( GL_TEXTURE_2D, 0 );
+
+		glGenFramebuffers( 1, &m_unHudFramebuffer );
+		glBindFramebuffer( GL_FRAMEBUFFER, m_unHudFramebuffer );
+		glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_unHudTexture, 0 );
+		if ( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE )
+		{
+			dprintf( "HUD framebuffer is incomplete, HUD text won't be shown\n" );
+			m_bHudVisible = false;
+		}
+		glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+		glGenVertexArrays( 1, &m_unHudVAO );
+
+		/// Cover the wider of the two eyes' fields of view
+		m_fHudExtent[0] = 0.0f;
+		m_fHudExtent[1] = 0.0f;
+		const Matrix4 *projections[] = { &m_mat4ProjectionLeft, &m_mat4ProjectionRight };
+		for ( int eye = 0; eye < 2; eye++ )
+		{
+			const Matrix4 &proj = *projections[eye];
+			m_fHudExtent[0] = std::max( m_fHudExtent[0], ( 1.0f + fabsf( proj[8] ) ) / proj[0] );
+			m_fHudExtent[1] = std::max( m_fHudExtent[1], ( 1.0f + fabsf( proj[9] ) ) / proj[5] );
+		}
+	}
+	if ( !m_bHudVisible )
+		return;
+
+	glBindFramebuffer( GL_FRAMEBUFFER, m_unHudFramebuffer );
+	glViewport( 0, 0, m_nHudSize, m_nHudSize );
+	glClearColor( 0.0f, 0.0f, 0.0f, 0.0f );
+	glClear( GL_COLOR_BUFFER_BIT );
+	glDisable( GL_DEPTH_TEST );
+
+	/// The text is in head space. Each label is projected onto the plane one unit in front of
+	/// the head, then the plane is mapped straight onto the layer.
+	Matrix4 matHud;
+	matHud.scale( 1.0f / m_fHudExtent[0], 1.0f / m_fHudExtent[1], 0.0f );
+	glUseProgram( m_unTextProgramID );
+	glUniformMatrix4fv( m_nTextMatrixLocation, 1, GL_FALSE, matHud.get() );
+	glUniformMatrix4fv( m_nTextWorldLocation, 1, GL_FALSE, Matrix4().identity().get() );
+	glUniform1i( m_nTextAtlasLocation, 0 );
+	Mesh::text_atlas.Bind( GL_TEXTURE0 );
+
+	/// Keep the layer premultiplied, so it composites correctly over the scene
+	glEnable( GL_BLEND );
+	glBlendFuncSeparate( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA );
+	for ( size_t idx = 0; idx < hud_meshes.size(); idx++ )
+	{
+		const Mesh *mesh = hud_meshes[idx];
+		const Vector3 &anchor = mesh->text_anchor;
+		if ( anchor.z > -0.01f )
+			continue; // behind the head
+		float perspective = -1.0f / anchor.z;
+		glUniform3f( m_nTextAnchorLocation, anchor.x * perspective, anchor.y * perspective, 0.0f );
+		glUniform3f( m_nTextRightLocation, perspective, 0.0f, 0.0f );
+		glUniform3f( m_nTextUpLocation, 0.0f, perspective, 0.0f );
+		const visualization_msgs::Marker &marker = mesh->marker;
+		glUniform4f( m_nTextColorLocation, marker.color.r, marker.color.g, marker.color.b, marker.color.a );
+
+		const Mesh::MeshEntry &entry = mesh->m_Entries[0];
+		glBindVertexArray( entry.VA );
+		glDrawElementsBaseVertex( GL_TRIANGLES, entry.NumIndices, GL_UNSIGNED_INT,
+		                          (void*)(sizeof(u_int32_t)*entry.FirstIndex),
+		                          entry.BaseVertex );
+	}
+	glBindVertexArray( 0 );
+	glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+	glDisable( GL_BLEND );
 	glUseProgram( 0 );
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Draws the cached HUD layer over the scene, locked to the head.
+//-----------------------------------------------------------------------------
+void CMainApplication::RenderHudLayer( vr::Hmd_Eye nEye )
+{
+	if ( !m_bHudText || !m_bHudVisible )
+		return;
+
+	Matrix4 matMVP = ( nEye == vr::Eye_Left ) ? m_mat4ProjectionLeft * m_mat4eyePosLeft : m_mat4ProjectionRight * m_mat4eyePosRight;
+	glUseProgram( m_unHudProgramID );
+	glUniformMatrix4fv( m_nHudMatrixLocation, 1, GL_FALSE, matMVP.get() );
+	glUniform2f( m_nHudExtentLocation, m_fHudExtent[0], m_fHudExtent[1] );
+	glUniform1i( m_nHudTextureLocation, 0 );
+	glActiveTexture( GL_TEXTURE0 );
+	glBindTexture( GL_TEXTURE_2D, m_unHudTexture );
+
+	glDisable( GL_DEPTH_TEST );
+	glEnable( GL_BLEND );
+	glBlendFunc( GL_ONE, GL_ONE_MINUS_SRC_ALPHA );
+	glBindVertexArray( m_unHudVAO );
+	glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 );
+	glBindVertexArray( 0 );
+	glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+	glDisable( GL_BLEND );
+	glEnable( GL_DEPTH_TEST );
+	glBindTexture( GL_TEXTURE_2D, 0 );
 }
 
 
@@ -1807,6 +2834,49 @@ Matrix4 CMainApplication::GetRobotMatrixPose( std::string frame_name )
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Poses every robot mesh for this frame, before either eye is drawn.
+//-----------------------------------------------------------------------------
+void CMainApplication::UpdateMarkerPoses()
+{
+	for ( size_t idx = 0; idx < robot_meshes.size(); idx++ )
+	{
+		robot_meshes[idx]->pose = GetRobotMatrixPose( robot_meshes[idx]->frame_id );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Gathers every marker using each MESH_RESOURCE asset and uploads
+//          them as its instances, once a frame so both eyes draw the same ones.
+//-----------------------------------------------------------------------------
+void CMainApplication::UpdateAssetInstances()
+{
+	std::map<AssetCache::Asset*, std::vector<AssetCache::Instance> > asset_instances;
+	for ( size_t idx = 0; idx < robot_meshes.size(); idx++ )
+	{
+		const Mesh *mesh = robot_meshes[idx];
+		if ( !mesh->initialized || !mesh->asset || mesh->asset->state != AssetCache::READY )
+			continue;
+		Matrix4 matWorld = mesh->pose * mesh->trans;
+		AssetCache::Instance instance;
+		memcpy( instance.mat, matWorld.get(), sizeof( instance.mat ) );
+		instance.color[0] = mesh->marker.color.r;
+		instance.color[1] = mesh->marker.color.g;
+		instance.color[2] = mesh->marker.color.b;
+		instance.color[3] = mesh->marker.mesh_use_embedded_materials ? 0.0f : 1.0f;
+		asset_instances[mesh->asset].push_back( instance );
+	}
+
+	m_mapAssetInstanceCounts.clear();
+	for ( std::map<AssetCache::Asset*, std::vector<AssetCache::Instance> >::iterator it = asset_instances.begin(); it != asset_instances.end(); ++it )
+	{
+		Mesh::asset_cache.UploadInstances( it->first, it->second );
+		m_mapAssetInstanceCounts[it->first] = it->second.size();
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Gets a Current View Projection Matrix with respect to nEye,
 //          which may be an Eye_Left or an Eye_Right.
@@ -0,0 +1,290 @@
+#include <cmath>
+#include <cctype>
+#include <algorithm>
+#include <cstdio>
+#include "text_atlas.h"
+#include "shared/lodepng.h"
+
+/// How far (in atlas pixels) the distance field reaches on either side of an edge
+#define SDF_SPREAD 8.0f
+
+TextAtlas::TextAtlas()
+    : m_texture(0),
+      m_gridSize(8)
+{
+    for(int idx=0;idx<256;idx++){
+        m_GlyphTable[idx]=-1;
+    }
+}
+
+/// The texture is released in Clear(), while the GL context is still around
+TextAtlas::~TextAtlas()
+{
+}
+
+/*!
+ * \brief build the codepoint lookup table from the order of glyphs in the atlas
+ *
+ * Lowercase letters that aren't in the atlas fall back to their uppercase glyph,
+ * since the default atlas only has uppercase.
+ *
+ * \param character_map the characters in the atlas, in row-major order
+ */
+void TextAtlas::SetCharacterMap(const std::string& character_map)
+{
+    for(int idx=0;idx<256;idx++){
+        m_GlyphTable[idx]=-1;
+    }
+    for(size_t idx=0;idx<character_map.size();idx++){
+        unsigned char character=character_map[idx];
+        /// Keep the first one, to match the old linear search
+        if(m_GlyphTable[character]==-1){
+            m_GlyphTable[character]=idx;
+        }
+    }
+    for(int idx=0;idx<256;idx++){
+        if(m_GlyphTable[idx]==-1 && islower(idx)){
+            m_GlyphTable[idx]=m_GlyphTable[(unsigned char)toupper(idx)];
+        }
+    }
+}
+
+/*!
+ * \brief Euclidean distance from every pixel to the nearest seed pixel
+ *
+ * This is the two pass "dead reckoning" approximation (8SSEDT), which carries the
+ * offset to the nearest seed along rather than just the distance.
+ */
+static void distance_transform(const std::vector<bool>& seed, int width, int height, std::vector<float>& dist)
+{
+    const int far_away=1<<14;
+    std::vector<int> dx(width*height),dy(width*height);
+    for(int idx=0;idx<width*height;idx++){
+        dx[idx]=seed[idx]?0:far_away;
+        dy[idx]=seed[idx]?0:far_away;
+    }
+
+#define DT_SQ(ii) (dx[ii]*dx[ii]+dy[ii]*dy[ii])
+#define DT_COMPARE(xx,yy,ox,oy) \
+    if((xx)+(ox)>=0 && (xx)+(ox)<width && (yy)+(oy)>=0 && (yy)+(oy)<height){ \
+        int other=((yy)+(oy))*width+(xx)+(ox); \
+        int cx=dx[other]-(ox); \
+        int cy=dy[other]-(oy); \
+        if(cx*cx+cy*cy<DT_SQ(here)){ dx[here]=cx; dy[here]=cy; } \
+    }
+
+    /// Forward pass
+    for(int yy=0;yy<height;yy++){
+        for(int xx=0;xx<width;xx++){
+            int here=yy*width+xx;
+            DT_COMPARE(xx,yy,-1, 0);
+            DT_COMPARE(xx,yy, 0,-1);
+            DT_COMPARE(xx,yy,-1,-1);
+            DT_COMPARE(xx,yy, 1,-1);
+        }
+        for(int xx=width-1;xx>=0;xx--){
+            int here=yy*width+xx;
+            DT_COMPARE(xx,yy, 1, 0);
+        }
+    }
+    /// Backward pass
+    for(int yy=height-1;yy>=0;yy--){
+        for(int xx=width-1;xx>=0;xx--){
+            int here=yy*width+xx;
+            DT_COMPARE(xx,yy, 1, 0);
+            DT_COMPARE(xx,yy, 0, 1);
+            DT_COMPARE(xx,yy,-1, 1);
+            DT_COMPARE(xx,yy, 1, 1);
+        }
+        for(int xx=0;xx<width;xx++){
+            int here=yy*width+xx;
+            DT_COMPARE(xx,yy,-1, 0);
+        }
+    }
+#undef DT_COMPARE
+#undef DT_SQ
+
+    dist.resize(width*height);
+    for(int idx=0;idx<width*height;idx++){
+        dist[idx]=sqrtf(float(dx[idx])*dx[idx]+float(dy[idx])*dy[idx]);
+    }
+}
+
+/*!
+ * \brief turn a white-on-black bitmap atlas into a single channel distance field
+ *
+ * Each glyph cell is processed on its own, so neighboring glyphs don't bleed into
+ * each other's field.
+ *
+ * \param rgba      the bitmap atlas, glyphs are wherever red > 127
+ * \param width     width of the atlas in pixels
+ * \param height    height of the atlas in pixels
+ * \param cell_size size of one glyph cell in pixels
+ * \param spread    distance in pixels that maps to the full 0-255 range
+ * \param sdf       output, one byte per pixel with 128 on the glyph edge
+ */
+void TextAtlas::GenerateSDF(const std::vector<unsigned char>& rgba, unsigned int width, unsigned int height,
+                            unsigned int cell_size, float spread, std::vector<unsigned char>& sdf)
+{
+    sdf.assign(width*height,0);
+    std::vector<bool> inside(cell_size*cell_size),outside(cell_size*cell_size);
+    std::vector<float> dist_to_inside,dist_to_outside;
+
+    for(unsigned int cell_y=0;cell_y+cell_size<=height;cell_y+=cell_size){
+        for(unsigned int cell_x=0;cell_x+cell_size<=width;cell_x+=cell_size){
+            for(unsigned int yy=0;yy<cell_size;yy++){
+                for(unsigned int xx=0;xx<cell_size;xx++){
+                    bool in=rgba[4*((cell_y+yy)*width+cell_x+xx)]>127;
+                    inside[yy*cell_size+xx]=in;
+                    outside[yy*cell_size+xx]=!in;
+                }
+            }
+            distance_transform(inside,cell_size,cell_size,dist_to_inside);
+            distance_transform(outside,cell_size,cell_size,dist_to_outside);
+            for(unsigned int yy=0;yy<cell_size;yy++){
+                for(unsigned int xx=0;xx<cell_size;xx++){
+                    int idx=yy*cell_size+xx;
+                    /// Positive inside the glyph, negative outside, measured from the pixel edge
+                    float signed_dist=inside[idx] ? (dist_to_outside[idx]-0.5f) : -(dist_to_inside[idx]-0.5f);
+                    float value=0.5f+0.5f*signed_dist/spread;
+                    value=std::min(1.0f,std::max(0.0f,value));
+                    sdf[(cell_y+yy)*width+cell_x+xx]=(unsigned char)(value*255.0f+0.5f);
+                }
+            }
+        }
+    }
+}
+
+/*!
+ * \brief load (or generate) the distance field atlas and upload it
+ * \param bitmap_filename   plain white-on-black glyph atlas, used if there's no sdf_filename
+ * \param character_map     characters in the atlas, in row-major order
+ * \param sdf_filename      optional ready-made distance field atlas (red channel is used)
+ * \param grid_size         number of glyphs along each side of the atlas
+ * \return success
+ */
+bool TextAtlas::Init(const std::string& bitmap_filename, const std::string& character_map,
+                     const std::string& sdf_filename, unsigned int grid_size)
+{
+    Clear();
+    m_gridSize=grid_size;
+    SetCharacterMap(character_map);
+
+    std::vector<unsigned char> imageRGBA;
+    std::vector<unsigned char> sdf;
+    unsigned nImageWidth, nImageHeight;
+    if(!sdf_filename.empty()){
+        unsigned nError = lodepng::decode( imageRGBA, nImageWidth, nImageHeight, sdf_filename.c_str() );
+        if ( nError != 0 ){
+            printf("Could not load text atlas %s: %s\n",sdf_filename.c_str(),lodepng_error_text(nError));
+            return false;
+        }
+        sdf.resize(nImageWidth*nImageHeight);
+        for(unsigned int idx=0;idx<sdf.size();idx++){
+            sdf[idx]=imageRGBA[4*idx];
+        }
+    }else{
+        unsigned nError = lodepng::decode( imageRGBA, nImageWidth, nImageHeight, bitmap_filename.c_str() );
+        if ( nError != 0 ){
+            printf("Could not load text bitmap %s: %s\n",bitmap_filename.c_str(),lodepng_error_text(nError));
+            return false;
+        }
+        GenerateSDF(imageRGBA,nImageWidth,nImageHeight,nImageWidth/m_gridSize,SDF_SPREAD,sdf);
+    }
+
+    glGenTextures( 1, &m_texture );
+    glBindTexture( GL_TEXTURE_2D, m_texture );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_R8, nImageWidth, nImageHeight, 0, GL_RED, GL_UNSIGNED_BYTE, &sdf[0] );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+    glGenerateMipmap( GL_TEXTURE_2D );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+    glBindTexture( GL_TEXTURE_2D, 0 );
+
+    return m_texture!=0;
+}
+
+/*!
+ * \brief lay out a string as one quad per glyph, centered on the anchor
+ *
+ * Newlines start a new line below the previous one. Characters that aren't in the
+ * atlas just leave a gap.
+ *
+ * \param text      string to display
+ * \param height    height of each glyph cell, in vr units
+ * \param Vertices  output, see the class description for the layout
+ * \param Indices   output
+ */
+void TextAtlas::BuildRun(const std::string& text, float height,
+                         std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices,
+                         std::vector<u_int32_t>& Indices) const
+{
+    /// Split into lines first, so each one can be centered
+    std::vector<std::string> lines(1);
+    for(size_t idx=0;idx<text.size();idx++){
+        if(text[idx]=='\n'){
+            lines.push_back(std::string());
+        }else{
+            lines.back().push_back(text[idx]);
+        }
+    }
+
+    Vertices.reserve(Vertices.size()+text.size()*4);
+    Indices.reserve(Indices.size()+text.size()*6);
+    float cell=1.0f/m_gridSize;
+    for(size_t line=0;line<lines.size();line++){
+        /// Block of text is centered vertically on the anchor too
+        float bottom=(lines.size()/2.0f-line-1)*height;
+        float left=-(lines[line].size()/2.0f)*height;
+        for(size_t ii=0;ii<lines[line].size();ii++){
+            int glyph=m_GlyphTable[(unsigned char)lines[line][ii]];
+            if(glyph<0){
+                continue;
+            }
+            float u0=(glyph%m_gridSize)*cell;
+            float v0=(glyph/m_gridSize)*cell;
+            float x0=left+ii*height;
+            float corners[4][4]={ { x0,        bottom,        u0,      v0+cell },
+                                  { x0+height, bottom,        u0+cell, v0+cell },
+                                  { x0+height, bottom+height, u0+cell, v0      },
+                                  { x0,        bottom+height, u0,      v0      } };
+            u_int32_t base=Vertices.size();
+            for(int cc=0;cc<4;cc++){
+                vr::RenderModel_Vertex_t_rgb v;
+                v.vPosition.v[0]=corners[cc][0];
+                v.vPosition.v[1]=corners[cc][1];
+                v.vPosition.v[2]=0;
+                v.vNormal.v[0]=0;
+                v.vNormal.v[1]=0;
+                v.vNormal.v[2]=1;
+                v.vColor.v[0]=corners[cc][2];
+                v.vColor.v[1]=corners[cc][3];
+                v.vColor.v[2]=0;
+                Vertices.push_back(v);
+            }
+            Indices.push_back(base+0);
+            Indices.push_back(base+1);
+            Indices.push_back(base+2);
+            Indices.push_back(base+2);
+            Indices.push_back(base+3);
+            Indices.push_back(base+0);
+        }
+    }
+}
+
+void TextAtlas::Bind(GLenum TextureUnit) const
+{
+    glActiveTexture(TextureUnit);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+}
+
+void TextAtlas::Clear()
+{
+    if(m_texture){
+        glDeleteTextures( 1, &m_texture );
+        m_texture=0;
+    }
+}
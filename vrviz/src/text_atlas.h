@@ -0,0 +1,52 @@
+#ifndef TEXT_ATLAS_H
+#define	TEXT_ATLAS_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <GL/glew.h>
+#include "geometry_pool.h"
+
+/*!
+ * \brief A signed distance field font atlas, for crisp text at any distance
+ *
+ * The atlas is a square grid of glyphs (8x8 for the default texture_map.png). It can
+ * either be loaded ready-made, or generated at startup from the plain bitmap atlas.
+ * Each texel stores the distance to the nearest glyph edge, with 0.5 on the edge
+ * itself, so the fragment shader can threshold it with smoothstep.
+ *
+ * Glyph runs are built with the same vertex layout as the rest of the marker geometry
+ * so they can live in the GeometryPool:
+ *  - vPosition holds the corner offset from the text anchor, in the plane of the text
+ *  - vColor.xy holds the atlas texture coordinate
+ */
+class TextAtlas
+{
+public:
+    TextAtlas();
+
+    ~TextAtlas();
+
+    bool Init(const std::string& bitmap_filename, const std::string& character_map,
+              const std::string& sdf_filename="", unsigned int grid_size=8);
+    void SetCharacterMap(const std::string& character_map);
+    void BuildRun(const std::string& text, float height,
+                  std::vector<vr::RenderModel_Vertex_t_rgb>& Vertices,
+                  std::vector<u_int32_t>& Indices) const;
+    void Bind(GLenum TextureUnit) const;
+    void Clear();
+
+    /// Glyph index for a character, or -1 if it isn't in the atlas
+    int GlyphIndex(unsigned char character) const { return m_GlyphTable[character]; }
+
+    static void GenerateSDF(const std::vector<unsigned char>& rgba, unsigned int width, unsigned int height,
+                            unsigned int cell_size, float spread, std::vector<unsigned char>& sdf);
+
+private:
+    int m_GlyphTable[256];      ///!< Codepoint to glyph index, so lookup doesn't search the map
+    GLuint m_texture;
+    unsigned int m_gridSize;    ///!< Number of glyphs along each side of the atlas
+};
+
+
+#endif	/* TEXT_ATLAS_H */
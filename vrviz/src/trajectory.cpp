@@ -0,0 +1,242 @@
+#include <cstdio>
+#include <algorithm>
+#include "trajectory.h"
+
+Trajectory::Trajectory(const std::string& name, Vector3 color)
+    : m_color(color),
+      m_capacity(0),
+      m_count(0),
+      m_head(0),
+      m_dirtyFirst(0),
+      m_dirtyCount(0),
+      m_pathSize(0)
+{
+    mesh=new Mesh;
+    mesh->name=name;
+    mesh->m_Entries.resize(1);
+    mesh->m_Entries[0].MaterialIndex=NO_TEXTURE;
+    mesh->m_Entries[0].Mode=GL_LINES;
+}
+
+bool Trajectory::Key::operator==(const Key& other) const
+{
+    return stamp==other.stamp && position.x==other.position.x && position.y==other.position.y && position.z==other.position.z;
+}
+
+/*!
+ * \brief (re)allocate the ring, which throws away everything in it
+ * \param max_points    the oldest points get retired once there are this many
+ */
+void Trajectory::SetCapacity(unsigned int max_points)
+{
+    max_points=std::max(max_points,2u);
+    Mesh::MeshEntry& entry=mesh->m_Entries[0];
+    entry.Release();
+    m_capacity=max_points;
+    m_vertices.resize(m_capacity);
+    m_indices.resize(2*m_capacity);
+
+    // create and bind a VAO to hold state for the trajectory
+    glGenVertexArrays( 1, &entry.VA );
+    glBindVertexArray( entry.VA );
+
+    // Reserve the whole ring up front, points get filled in later with glBufferSubData
+    glGenBuffers( 1, &entry.VB );
+    glBindBuffer( GL_ARRAY_BUFFER, entry.VB );
+    glBufferData( GL_ARRAY_BUFFER, sizeof( vr::RenderModel_Vertex_t_rgb ) * m_capacity, NULL, GL_DYNAMIC_DRAW );
+
+    // Identify the components in the vertex buffer
+    glEnableVertexAttribArray( 0 );
+    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vPosition ) );
+    glEnableVertexAttribArray( 1 );
+    glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vNormal ) );
+    glEnableVertexAttribArray( 2 );
+    glVertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, sizeof( vr::RenderModel_Vertex_t_rgb ), (void *)offsetof( vr::RenderModel_Vertex_t_rgb, vColor ) );
+
+    glGenBuffers( 1, &entry.IB );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, entry.IB );
+    glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof( u_int32_t ) * 2 * m_capacity, NULL, GL_DYNAMIC_DRAW );
+
+    glBindVertexArray( 0 );
+
+    Clear();
+}
+
+/*!
+ * \brief forget every point. Nothing needs uploading, since nothing past m_count gets drawn
+ */
+void Trajectory::Clear()
+{
+    m_count=0;
+    m_head=0;
+    m_dirtyFirst=0;
+    m_dirtyCount=0;
+    m_pathSize=0;
+    mesh->m_Entries[0].NumIndices=0;
+}
+
+/*!
+ * \brief add the new part of a Path message
+ *
+ * If the last pose we have shows up in the new message, only what comes after it is
+ * added. This covers a path that grows at the end, and one that is also trimmed at the
+ * front (the ring keeps the older points until they are retired). Anything else, like a
+ * new plan, replaces the whole trajectory.
+ */
+void Trajectory::SetPath(const nav_msgs::Path& path, float scaling_factor)
+{
+    size_t num_poses=path.poses.size();
+    size_t first_new=0;
+    bool append=false;
+    if(m_pathSize>0 && num_poses>0 && path.header.frame_id==mesh->frame_id){
+        Key first, expected;
+        first.stamp=path.poses[0].header.stamp;
+        first.position=path.poses[0].pose.position;
+        if(num_poses>=m_pathSize){
+            expected.stamp=path.poses[m_pathSize-1].header.stamp;
+            expected.position=path.poses[m_pathSize-1].pose.position;
+        }
+        if(num_poses>=m_pathSize && first==m_pathFirst && expected==m_pathLast){
+            /// The usual case, same as last time plus a few more
+            first_new=m_pathSize;
+            append=true;
+        }else{
+            /// Maybe the front got trimmed, look for where we left off
+            for(size_t idx=num_poses;idx>0;idx--){
+                Key key;
+                key.stamp=path.poses[idx-1].header.stamp;
+                key.position=path.poses[idx-1].pose.position;
+                if(key==m_pathLast){
+                    first_new=idx;
+                    append=true;
+                    break;
+                }
+            }
+        }
+    }
+    if(!append){
+        Clear();
+        mesh->frame_id=path.header.frame_id;
+    }
+
+    /// Anything that would be retired before it was drawn can be skipped
+    if(num_poses-first_new>m_capacity){
+        first_new=num_poses-m_capacity;
+    }
+    for(size_t idx=first_new;idx<num_poses;idx++){
+        Push(path.poses[idx].pose.position,scaling_factor);
+    }
+
+    if(num_poses>0){
+        m_pathFirst.stamp=path.poses[0].header.stamp;
+        m_pathFirst.position=path.poses[0].pose.position;
+        m_pathLast.stamp=path.poses[num_poses-1].header.stamp;
+        m_pathLast.position=path.poses[num_poses-1].pose.position;
+    }
+    m_pathSize=num_poses;
+    Upload();
+}
+
+/*!
+ * \brief add an Odometry pose to the history, if it has moved far enough from the last one
+ *
+ * A change of frame, or time going backwards (e.g. a bag looping), starts over.
+ */
+void Trajectory::AddOdometry(const nav_msgs::Odometry& odom, float scaling_factor, float min_distance)
+{
+    const geometry_msgs::Point& position=odom.pose.pose.position;
+    if(odom.header.frame_id!=mesh->frame_id || (m_count>0 && odom.header.stamp<m_lastOdom.stamp)){
+        Clear();
+        mesh->frame_id=odom.header.frame_id;
+    }
+    if(m_count>0){
+        double dx=position.x-m_lastOdom.position.x;
+        double dy=position.y-m_lastOdom.position.y;
+        double dz=position.z-m_lastOdom.position.z;
+        if(dx*dx+dy*dy+dz*dz<min_distance*min_distance){
+            return;
+        }
+    }
+    m_lastOdom.stamp=odom.header.stamp;
+    m_lastOdom.position=position;
+    Push(position,scaling_factor);
+    Upload();
+}
+
+/*!
+ * \brief put a point in the next slot of the ring, retiring the oldest if it is full
+ */
+void Trajectory::Push(const geometry_msgs::Point& position, float scaling_factor)
+{
+    unsigned int slot=m_head;
+    unsigned int prev=(slot+m_capacity-1)%m_capacity;
+    unsigned int next=(slot+1)%m_capacity;
+
+    vr::RenderModel_Vertex_t_rgb& vert=m_vertices[slot];
+    vert.vPosition.v[0]=position.x*scaling_factor;
+    vert.vPosition.v[1]=position.y*scaling_factor;
+    vert.vPosition.v[2]=position.z*scaling_factor;
+    vert.vNormal.v[0]=0;
+    vert.vNormal.v[1]=0;
+    vert.vNormal.v[2]=1;
+    vert.vColor.v[0]=m_color.x;
+    vert.vColor.v[1]=m_color.y;
+    vert.vColor.v[2]=m_color.z;
+
+    /// The first point has nothing to join to, so its segment is degenerate
+    m_indices[2*slot]=(m_count>0)?prev:slot;
+    m_indices[2*slot+1]=slot;
+    /// The next slot holds the oldest point, which isn't joined to anything older any more
+    m_indices[2*next]=next;
+    m_indices[2*next+1]=next;
+
+    /// The dirty slots always run from the first new point to the one after the newest
+    if(m_dirtyCount==0){
+        m_dirtyFirst=slot;
+        m_dirtyCount=2;
+    }else{
+        m_dirtyCount++;
+    }
+    m_dirtyCount=std::min(m_dirtyCount,m_capacity);
+
+    m_head=next;
+    m_count=std::min(m_count+1,m_capacity);
+}
+
+/*!
+ * \brief send the changed slots to the GPU, in two pieces if they wrap around
+ */
+void Trajectory::Upload()
+{
+    if(m_dirtyCount>0){
+        unsigned int first_count=std::min(m_dirtyCount,m_capacity-m_dirtyFirst);
+        UploadSlots(m_dirtyFirst,first_count);
+        if(first_count<m_dirtyCount){
+            UploadSlots(0,m_dirtyCount-first_count);
+        }
+        m_dirtyCount=0;
+    }
+    /// Segments are in the same slots as their newest point, and unused slots are never past m_count
+    mesh->m_Entries[0].NumIndices=2*m_count;
+    mesh->initialized=true;
+    mesh->needs_update=false;
+}
+
+void Trajectory::UploadSlots(unsigned int first, unsigned int count)
+{
+    const Mesh::MeshEntry& entry=mesh->m_Entries[0];
+    glBindBuffer( GL_ARRAY_BUFFER, entry.VB );
+    glBufferSubData( GL_ARRAY_BUFFER,
+                     sizeof( vr::RenderModel_Vertex_t_rgb ) * first,
+                     sizeof( vr::RenderModel_Vertex_t_rgb ) * count,
+                     &m_vertices[first] );
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    /// Don't bind the VAO, since binding the IB would change its state
+    glBindVertexArray( 0 );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, entry.IB );
+    glBufferSubData( GL_ELEMENT_ARRAY_BUFFER,
+                     sizeof( u_int32_t ) * 2 * first,
+                     sizeof( u_int32_t ) * 2 * count,
+                     &m_indices[2*first] );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+}
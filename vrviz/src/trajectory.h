@@ -0,0 +1,65 @@
+#ifndef TRAJECTORY_H
+#define	TRAJECTORY_H
+
+#include <string>
+#include <vector>
+#include <nav_msgs/Path.h>
+#include <nav_msgs/Odometry.h>
+#include "mesh.h"
+
+/*!
+ * \brief A robot trajectory (nav_msgs/Path, or Odometry history) drawn as one thick polyline
+ *
+ * The points live in a fixed size vertex buffer used as a ring, so the oldest points are
+ * retired once it is full. Line segment i joins point i-1 to point i, and sits in slot i of
+ * the index buffer, so adding a point only touches its own vertex and segment, plus the
+ * segment after it, which would otherwise join the newest point to the oldest. Each update
+ * only uploads what changed, so hours of trajectory cost no more per update than a minute.
+ *
+ * Successive Path messages usually repeat everything that was already sent, so the last
+ * point we have is looked for in the new message, and only what comes after it is added.
+ *
+ * The mesh is drawn by RenderScene with the rest of the markers. Render thread only.
+ */
+class Trajectory
+{
+public:
+    Trajectory(const std::string& name, Vector3 color);
+
+    void SetCapacity(unsigned int max_points);
+    void SetPath(const nav_msgs::Path& path, float scaling_factor);
+    void AddOdometry(const nav_msgs::Odometry& odom, float scaling_factor, float min_distance);
+    void Clear();
+
+    Mesh* mesh;                         ///!< Goes in robot_meshes, which owns it
+
+private:
+    /// Enough of a pose to tell whether two messages agree on it
+    struct Key {
+        ros::Time stamp;
+        geometry_msgs::Point position;
+        bool operator==(const Key& other) const;
+    };
+
+    void Push(const geometry_msgs::Point& position, float scaling_factor);
+    void Upload();
+    void UploadSlots(unsigned int first, unsigned int count);
+
+    Vector3 m_color;
+    unsigned int m_capacity;            ///!< Most points kept, the oldest are retired past this
+    unsigned int m_count;               ///!< Points in the ring, up to m_capacity
+    unsigned int m_head;                ///!< Slot the next point goes in
+    unsigned int m_dirtyFirst;          ///!< Slots changed since the last upload, wrapping around the ring
+    unsigned int m_dirtyCount;
+
+    std::vector<vr::RenderModel_Vertex_t_rgb> m_vertices;   ///!< Copy of the whole ring, one vertex per slot
+    std::vector<u_int32_t> m_indices;                       ///!< Two indices per slot
+
+    Key m_pathFirst;                    ///!< First and last poses of the last Path message
+    Key m_pathLast;
+    size_t m_pathSize;                  ///!< Zero if the ring didn't come from a Path
+    Key m_lastOdom;                     ///!< Newest Odometry pose that was added
+};
+
+
+#endif	/* TRAJECTORY_H */
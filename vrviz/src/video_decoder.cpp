@@ -0,0 +1,413 @@
+#include <cstdio>
+#include <cstring>
+#include "video_decoder.h"
+
+VideoDecoder::VideoDecoder()
+    : m_stop(false),
+      m_flush(false),
+      m_decoded(0),
+      m_dropped(0),
+      m_streamer(NULL),
+      m_loop(false)
+{
+#ifdef HAVE_LIBAV
+    m_codec=NULL;
+    m_parser=NULL;
+    m_frame=NULL;
+    m_scaler=NULL;
+    m_paced=false;
+    m_ptsStart=0.0;
+#endif
+}
+
+VideoDecoder::~VideoDecoder()
+{
+    Stop();
+}
+
+/*!
+ * \brief play a video file (or pipe, or URL) into the streamer
+ * \param streamer  where the frames go. Nothing else may write to it while this runs
+ * \param source    anything libavformat can open, e.g. a path or "pipe:0"
+ * \param loop      start it again when it ends, if it can be seeked
+ * \return false if there's no libavcodec to do it with. Failing to open the source is only printed
+ */
+bool VideoDecoder::Start(ImageStreamer* streamer, const std::string& source, bool loop)
+{
+#ifdef HAVE_LIBAV
+    m_streamer=streamer;
+    m_source=source;
+    m_loop=loop;
+    m_stop=false;
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+    av_register_all();
+#endif
+    avformat_network_init();
+    /// Opening can block (on a pipe or a network stream), so it happens on the worker too
+    m_thread=boost::thread(&VideoDecoder::FileLoop,this);
+    return true;
+#else
+    (void)streamer; (void)source; (void)loop;
+    printf("vrviz was built without libavcodec, so it can't decode video\n");
+    return false;
+#endif
+}
+
+/*!
+ * \brief decode packets handed to Submit() into the streamer
+ * \param streamer  where the frames go. Nothing else may write to it while this runs
+ */
+bool VideoDecoder::Start(ImageStreamer* streamer)
+{
+#ifdef HAVE_LIBAV
+    m_streamer=streamer;
+    m_source.clear();
+    m_stop=false;
+    m_flush=false;
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58, 10, 100)
+    avcodec_register_all();
+#endif
+    m_thread=boost::thread(&VideoDecoder::TopicLoop,this);
+    return true;
+#else
+    (void)streamer;
+    printf("vrviz was built without libavcodec, so it can't decode video\n");
+    return false;
+#endif
+}
+
+/*!
+ * \brief stop the worker, after whatever frame it is decoding now
+ */
+void VideoDecoder::Stop()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_stop=true;
+        m_packets.clear();
+    }
+    m_packetReady.notify_all();
+    if(m_thread.joinable()){
+        m_thread.join();
+    }
+}
+
+void VideoDecoder::Submit(const sensor_msgs::CompressedImage::ConstPtr& packet)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        if(m_packets.size()>=VIDEO_DECODER_MAX_QUEUED){
+            m_dropped+=m_packets.size();
+            m_packets.clear();
+            m_flush=true;
+        }
+        m_packets.push_back(packet);
+    }
+    m_packetReady.notify_one();
+}
+
+bool VideoDecoder::Stopping()
+{
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_stop;
+}
+
+#ifdef HAVE_LIBAV
+/// Lets a blocking read on the source give up when we stop
+int VideoDecoder::Interrupt(void* opaque)
+{
+    return static_cast<VideoDecoder*>(opaque)->Stopping()?1:0;
+}
+
+void VideoDecoder::FileLoop()
+{
+    AVFormatContext* format=avformat_alloc_context();
+    format->interrupt_callback.callback=Interrupt;
+    format->interrupt_callback.opaque=this;
+    /// Frees the context if it fails
+    if(avformat_open_input(&format,m_source.c_str(),NULL,NULL)<0){
+        printf("Could not open the video %s\n",m_source.c_str());
+        return;
+    }
+    int stream=-1;
+    if(avformat_find_stream_info(format,NULL)>=0){
+        stream=av_find_best_stream(format,AVMEDIA_TYPE_VIDEO,-1,-1,NULL,0);
+    }
+    if(stream<0 || !OpenCodec(format->streams[stream]->codecpar->codec_id,format->streams[stream]->codecpar)){
+        printf("Could not find a video stream to decode in %s\n",m_source.c_str());
+        avformat_close_input(&format);
+        return;
+    }
+    AVRational time_base=format->streams[stream]->time_base;
+    printf("Decoding %s %dx%d video from %s\n",avcodec_get_name(m_codec->codec_id),m_codec->width,m_codec->height,m_source.c_str());
+
+    AVPacket* packet=av_packet_alloc();
+    while(!Stopping()){
+        int err=av_read_frame(format,packet);
+        if(err==AVERROR_EOF){
+            /// Get the frames still in the decoder's threads out
+            Decode(NULL,time_base);
+            if(!m_loop){
+                break;
+            }
+            int64_t start=(format->start_time==AV_NOPTS_VALUE)?0:format->start_time;
+            if(av_seek_frame(format,-1,start,AVSEEK_FLAG_BACKWARD)<0){
+                printf("Could not seek back to the start of %s to loop it\n",m_source.c_str());
+                break;
+            }
+            avcodec_flush_buffers(m_codec);
+            m_paced=false;
+            continue;
+        }else if(err<0){
+            if(!Stopping()){
+                printf("Could not read from %s\n",m_source.c_str());
+            }
+            break;
+        }
+        if(packet->stream_index==stream){
+            Decode(packet,time_base);
+        }
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+    CloseCodec();
+    avformat_close_input(&format);
+}
+
+void VideoDecoder::TopicLoop()
+{
+    /// The packets are stamped in microseconds
+    const AVRational time_base={1,1000000};
+    AVPacket* packet=av_packet_alloc();
+    while(true){
+        sensor_msgs::CompressedImage::ConstPtr message;
+        bool flush;
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex);
+            while(!m_stop && m_packets.empty()){
+                m_packetReady.wait(lock);
+            }
+            if(m_stop){
+                break;
+            }
+            message=m_packets.front();
+            m_packets.pop_front();
+            flush=m_flush;
+            m_flush=false;
+        }
+        if(message->data.empty()){
+            continue;
+        }
+
+        if(!m_codec){
+            /// The first packet says which codec it is
+            bool hevc=(message->format.find("265")!=std::string::npos || message->format.find("hevc")!=std::string::npos);
+            if(!OpenCodec(hevc?AV_CODEC_ID_HEVC:AV_CODEC_ID_H264,NULL)){
+                printf("Could not start a %s decoder, video packets will be ignored\n",hevc?"hevc":"h264");
+                break;
+            }
+            printf("Decoding %s video packets\n",avcodec_get_name(m_codec->codec_id));
+        }else if(flush){
+            avcodec_flush_buffers(m_codec);
+            m_paced=false;
+        }
+
+        int64_t pts=message->header.stamp.toNSec()/1000;
+        const uint8_t* data=&message->data[0];
+        int size=message->data.size();
+        while(size>0){
+            int used=av_parser_parse2(m_parser,m_codec,&packet->data,&packet->size,data,size,pts,pts,0);
+            if(used<=0){
+                break;
+            }
+            data+=used;
+            size-=used;
+            if(packet->size>0){
+                packet->pts=m_parser->pts;
+                packet->dts=m_parser->dts;
+                packet->flags=m_parser->key_frame==1?AV_PKT_FLAG_KEY:0;
+                Decode(packet,time_base);
+            }
+        }
+    }
+    av_packet_free(&packet);
+    CloseCodec();
+}
+
+/*!
+ * \param codec_id      what to decode
+ * \param parameters    from the file, or NULL for packets off the topic, which need parsing
+ */
+bool VideoDecoder::OpenCodec(AVCodecID codec_id, const AVCodecParameters* parameters)
+{
+    const AVCodec* codec=avcodec_find_decoder(codec_id);
+    if(!codec){
+        printf("libavcodec has no %s decoder\n",avcodec_get_name(codec_id));
+        return false;
+    }
+    m_codec=avcodec_alloc_context3(codec);
+    if(parameters && avcodec_parameters_to_context(m_codec,parameters)<0){
+        CloseCodec();
+        return false;
+    }
+    /// A thread per core, each on its own frame. That adds a frame of latency per thread, which the pacing hides
+    m_codec->thread_count=0;
+    m_codec->thread_type=FF_THREAD_FRAME;
+    if(avcodec_open2(m_codec,codec,NULL)<0){
+        CloseCodec();
+        return false;
+    }
+    if(!parameters){
+        m_parser=av_parser_init(codec_id);
+        if(!m_parser){
+            CloseCodec();
+            return false;
+        }
+        m_parser->flags|=PARSER_FLAG_COMPLETE_FRAMES;
+    }
+    m_frame=av_frame_alloc();
+    m_paced=false;
+    return true;
+}
+
+void VideoDecoder::CloseCodec()
+{
+    avcodec_free_context(&m_codec);
+    if(m_parser){
+        av_parser_close(m_parser);
+        m_parser=NULL;
+    }
+    av_frame_free(&m_frame);
+    sws_freeContext(m_scaler);
+    m_scaler=NULL;
+}
+
+/*!
+ * \brief decode a packet, and show whatever frames come out
+ * \param packet    NULL to drain the decoder at the end of the stream
+ */
+bool VideoDecoder::Decode(AVPacket* packet, AVRational time_base)
+{
+    int err=avcodec_send_packet(m_codec,packet);
+    if(err<0 && err!=AVERROR_EOF){
+        /// Usually a broken frame after packets were dropped, it recovers at the next keyframe
+        return false;
+    }
+    while(!Stopping()){
+        err=avcodec_receive_frame(m_codec,m_frame);
+        if(err==AVERROR(EAGAIN) || err==AVERROR_EOF){
+            return true;
+        }else if(err<0){
+            return false;
+        }
+        Show(m_frame,time_base);
+        av_frame_unref(m_frame);
+    }
+    return true;
+}
+
+/// The JPEG formats are full range whatever color_range says
+static bool FullRangeFormat(int format)
+{
+    return format==AV_PIX_FMT_YUVJ420P || format==AV_PIX_FMT_YUVJ422P ||
+           format==AV_PIX_FMT_YUVJ444P || format==AV_PIX_FMT_YUVJ440P;
+}
+
+/*!
+ * \brief wait until it's time for the frame, then write it into the streamer as nv12
+ *
+ * The yuv shader is told the frame's range and matrix. Streams that don't say which
+ * matrix are taken to be BT.709 if they're HD, and BT.601 otherwise, like players do.
+ */
+void VideoDecoder::Show(const AVFrame* frame, AVRational time_base)
+{
+    /// nv12 has a chroma sample for each 2x2 pixels, so drop an odd row or column
+    unsigned int width=frame->width&~1;
+    unsigned int height=frame->height&~1;
+    if(width==0 || height==0){
+        return;
+    }
+    bool planar=(frame->format==AV_PIX_FMT_YUV420P || frame->format==AV_PIX_FMT_YUVJ420P);
+    bool nv12=(frame->format==AV_PIX_FMT_NV12);
+    bool full_range=(frame->color_range==AVCOL_RANGE_JPEG || FullRangeFormat(frame->format));
+    bool bt709=(frame->colorspace==AVCOL_SPC_BT709 || (frame->colorspace==AVCOL_SPC_UNSPECIFIED && frame->height>576));
+    if(!planar && !nv12){
+        m_scaler=sws_getCachedContext(m_scaler,frame->width,frame->height,(AVPixelFormat)frame->format,
+                                      width,height,AV_PIX_FMT_NV12,SWS_BILINEAR,NULL,NULL,NULL);
+        if(!m_scaler){
+            printf("Can't convert %s video frames\n",av_get_pix_fmt_name((AVPixelFormat)frame->format));
+            return;
+        }
+        /// Keep the matrix, but have it come out video range
+        const int* coefficients=sws_getCoefficients(bt709?SWS_CS_ITU709:SWS_CS_ITU601);
+        sws_setColorspaceDetails(m_scaler,coefficients,full_range,coefficients,0,0,1<<16,1<<16);
+        full_range=false;
+    }
+    ImageStreamer::ColorSpace color_space=ImageStreamer::ColorSpace((full_range?1:0)|(bt709?2:0));
+
+    Pace(frame->best_effort_timestamp,time_base);
+    if(Stopping()){
+        return;
+    }
+
+    unsigned int step=width;
+    unsigned char* luma=m_streamer->Begin("nv12",width,height,step,color_space);
+    unsigned char* chroma=luma+size_t(step)*height;
+    if(planar){
+        for(unsigned int row=0;row<height;row++){
+            memcpy(luma+row*step,frame->data[0]+row*frame->linesize[0],width);
+        }
+        for(unsigned int row=0;row<height/2;row++){
+            const unsigned char* u=frame->data[1]+row*frame->linesize[1];
+            const unsigned char* v=frame->data[2]+row*frame->linesize[2];
+            unsigned char* uv=chroma+row*step;
+            for(unsigned int col=0;col<width/2;col++){
+                uv[2*col+0]=u[col];
+                uv[2*col+1]=v[col];
+            }
+        }
+    }else if(nv12){
+        for(unsigned int row=0;row<height;row++){
+            memcpy(luma+row*step,frame->data[0]+row*frame->linesize[0],width);
+        }
+        for(unsigned int row=0;row<height/2;row++){
+            memcpy(chroma+row*step,frame->data[1]+row*frame->linesize[1],width);
+        }
+    }else{
+        uint8_t* planes[4]={luma,chroma,NULL,NULL};
+        int strides[4]={(int)step,(int)step,0,0};
+        sws_scale(m_scaler,frame->data,frame->linesize,0,frame->height,planes,strides);
+    }
+    m_streamer->Commit();
+    m_decoded++;
+}
+
+/*!
+ * \brief sleep until the frame's presentation time, on a clock started at the first frame
+ *
+ * If the frame is already late by more than half a second, or the timestamps jump ahead,
+ * the clock starts over from it instead.
+ */
+void VideoDecoder::Pace(int64_t pts, AVRational time_base)
+{
+    if(pts==AV_NOPTS_VALUE){
+        return;
+    }
+    double seconds=pts*av_q2d(time_base);
+    boost::chrono::steady_clock::time_point now=boost::chrono::steady_clock::now();
+    double ahead=(seconds-m_ptsStart)-boost::chrono::duration<double>(now-m_clockStart).count();
+    if(!m_paced || ahead<-0.5 || ahead>1.0){
+        m_paced=true;
+        m_clockStart=now;
+        m_ptsStart=seconds;
+        return;
+    }
+    if(ahead>0.0){
+        boost::chrono::steady_clock::time_point due=now+boost::chrono::duration_cast<boost::chrono::steady_clock::duration>(boost::chrono::duration<double>(ahead));
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        /// Packets coming in wake it too, Stop() ends it
+        while(!m_stop && m_packetReady.wait_until(lock,due)!=boost::cv_status::timeout){
+        }
+    }
+}
+#endif
@@ -0,0 +1,96 @@
+#ifndef VIDEO_DECODER_H
+#define	VIDEO_DECODER_H
+
+#include <deque>
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+#include <sensor_msgs/CompressedImage.h>
+#include "image_streamer.h"
+
+#ifdef HAVE_LIBAV
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+#endif
+
+/// Packets from the topic kept for the decoder before it is considered to have fallen behind
+#define VIDEO_DECODER_MAX_QUEUED 120
+
+/*!
+ * \brief Decodes H.264/H.265 video on a worker thread, straight into the ImageStreamer
+ *
+ * The video comes either from a file, pipe or URL (anything libavformat opens), or as
+ * packets on a topic: sensor_msgs/CompressedImage with format "h264" or "h265"/"hevc", and
+ * whole Annex B access units (one frame each, with their parameter sets) as the data.
+ *
+ * libavcodec decodes with frame threading, one thread per core. Frames are shown at their
+ * presentation timestamp (the stream's own, or the header stamps of the packets), so the
+ * bursts that frame threading decodes in come out evenly. 4:2:0 frames are written into
+ * the streamer as nv12, which the yuv shader converts with the frame's range (video or
+ * full/JPEG) and matrix (BT.601 or BT.709). Anything else is scaled to nv12 by libswscale
+ * first.
+ *
+ * Unlike still images, every packet has to be decoded, since the frames after it depend on
+ * it. If the decoder falls far enough behind the topic the queue is thrown away and the
+ * decoder flushed, and the picture recovers at the next keyframe.
+ *
+ * Built without libavcodec, Start() just says so and returns false.
+ */
+class VideoDecoder
+{
+public:
+    VideoDecoder();
+
+    ~VideoDecoder();
+
+    bool Start(ImageStreamer* streamer, const std::string& source, bool loop);
+    bool Start(ImageStreamer* streamer);
+    void Stop();
+
+    void Submit(const sensor_msgs::CompressedImage::ConstPtr& packet);
+
+    unsigned long Decoded() const { return m_decoded; }
+    unsigned long Dropped() const { return m_dropped; }
+
+private:
+    bool Stopping();
+
+    boost::thread m_thread;
+    boost::mutex m_mutex;                   ///!< Protects m_stop and m_packets
+    boost::condition_variable m_packetReady;
+    bool m_stop;
+    bool m_flush;                           ///!< Packets were dropped, so the decoder has to start over
+    std::deque<sensor_msgs::CompressedImage::ConstPtr> m_packets;
+    unsigned long m_decoded;                ///!< Frames handed to the streamer
+    unsigned long m_dropped;                ///!< Packets thrown away because the decoder fell behind
+
+    ImageStreamer* m_streamer;              ///!< Only the worker writes to it
+    std::string m_source;                   ///!< Empty if the packets come from the topic
+    bool m_loop;                            ///!< Start the file again when it ends
+
+#ifdef HAVE_LIBAV
+    void FileLoop();
+    void TopicLoop();
+    bool OpenCodec(AVCodecID codec_id, const AVCodecParameters* parameters);
+    void CloseCodec();
+    bool Decode(AVPacket* packet, AVRational time_base);
+    void Show(const AVFrame* frame, AVRational time_base);
+    void Pace(int64_t pts, AVRational time_base);
+    static int Interrupt(void* opaque);
+
+    AVCodecContext* m_codec;
+    AVCodecParserContext* m_parser;         ///!< Splits the topic's byte stream into packets
+    AVFrame* m_frame;
+    SwsContext* m_scaler;                   ///!< Only for frames that aren't 4:2:0 already
+
+    /// Frame pacing: when the first frame was shown, and what its timestamp was
+    bool m_paced;
+    boost::chrono::steady_clock::time_point m_clockStart;
+    double m_ptsStart;
+#endif
+};
+
+
+#endif	/* VIDEO_DECODER_H */
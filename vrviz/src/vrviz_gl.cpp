@@ -12,11 +12,26 @@
 #include <tf/transform_listener.h>
 #include <sensor_msgs/PointCloud.h>
 #include <visualization_msgs/MarkerArray.h>
+#include <geometry_msgs/PoseArray.h>
+#include <nav_msgs/Path.h>
+#include <nav_msgs/Odometry.h>
+#include <nav_msgs/OccupancyGrid.h>
+#include <map_msgs/OccupancyGridUpdate.h>
+#ifdef HAVE_GRID_MAP
+#include <grid_map_msgs/GridMap.h>
+#endif
+#ifdef HAVE_OCTOMAP
+#include <octomap_msgs/Octomap.h>
+#endif
 #include <std_msgs/Bool.h>
 
 /// Needed for rendering image to overlay
 #include <cv_bridge/cv_bridge.h>
 #include <sensor_msgs/Image.h>
+#include <sensor_msgs/CompressedImage.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <image_transport/image_transport.h>
+#include <image_transport/camera_common.h>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
@@ -32,15 +47,29 @@
 /// PCL Bridge to/from ROS
 #include <pcl_conversions/pcl_conversions.h>
 
+#include <deque>
+#include <algorithm>
+
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
 
 /// Inheret everything useful from the openvr example class
 #ifdef USE_VULKAN
 #include "openvr_vk.h"
 #else
 #include "openvr_gl.h"
+#include "mesh_streamer.h"
+#include "trajectory.h"
+#include "occupancy_map.h"
+#include "heightfield.h"
+#include "octomap_voxels.h"
+#include "image_convert.h"
+#include "image_streamer.h"
+#include "image_decoder.h"
+#include "video_decoder.h"
+#include "camera_planes.h"
 #endif
 
 
@@ -62,6 +91,7 @@ tf::TransformListener* listener;
 std::string vrviz_include_path;
 std::string texture_filename = "/texture_map.png";
 std::string fallback_texture_filename = "/fallback_texture.png";
+std::string text_atlas_filename = "";///!< Optional ready-made signed distance field atlas, laid out like texture_filename
 std::string texture_character_map=" !\"#$%&\'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_";
 std::string base_frame = "vrviz_base";
 std::string intermediate_frame = "vrviz_intermediate";
@@ -70,13 +100,32 @@ float hud_dist=1.0;///!< meters; distance that the head's up display will appear
 float hud_size=2.0;///!< Radians; How much
 float scaling_factor=1.0f;///!< Unitless; for values >1.0 this will make the scene bigger, relative to the person in VR
 int point_size=1;
+float line_width=2.0;///!< pixels; width of the tf axes and grid lines
 bool sbs_image=true;///!< If true, render the left half of the image to the left eye, the right half to the right eye. If false, render whole image to both eyes
 bool show_tf=false;
 bool load_robot=false;
 bool show_grid=true;
 bool show_movement=true;
+bool hud_text=false;///!< If true, text markers in the HMD frame are drawn into a HUD layer, only when they change
 float intensity_max=0.0;
-bool manual_image_copy = false;
+int stream_chunk_triangles=65536;///!< TRIANGLE_LIST markers bigger than this are built in the background, in chunks this big
+int stream_upload_budget_kb=4096;///!< How much streamed marker geometry to upload per frame
+int marker_update_budget=262144;///!< Marker points rebuilt per frame, at least one marker always is
+float pose_array_arrow_length=0.3;///!< ROS units; length of the arrow drawn at each pose of a PoseArray
+int trajectory_max_points=20000;///!< Points kept per Path or Odometry trajectory, the oldest are retired past this
+float trajectory_width=0.02;///!< ROS units; width of the Path and Odometry lines
+float odom_min_distance=0.05;///!< ROS units; Odometry poses closer than this to the last one kept are skipped
+float map_alpha=0.7;///!< Opacity of the occupancy grid
+float costmap_height=0.5;///!< ROS units; how tall lethal cost is drawn in the costmap heightfield
+std::string grid_map_layer="elevation";///!< Which layer of the grid map to draw as a heightfield
+float octomap_min_z=0.0;///!< ROS units; octomap voxels are colored blue at this height...
+float octomap_max_z=2.0;///!< ...to red at this one
+std::string image_transport_name="raw";///!< How to subscribe to the image: compressed ones are decoded on our own worker thread, "video" takes H.264/H.265 packets, anything else goes through image_transport
+std::string video_source="";///!< If set, play this video file (or pipe, or URL) instead of subscribing to the image
+bool video_loop=false;///!< Start video_source again when it ends
+float camera_plane_distance=1.0;///!< ROS units; how far in front of each camera in camera_topics its image is drawn
+int camera_texture_size=0;///!< Texels square the camera images are scaled to in the shared texture array, 0 keeps the first image's size so RGB ones from same-model cameras go straight in
+float camera_plane_alpha=1.0;///!< Opacity of the camera images drawn in the world
 
 /// This is a flag that tells the VR code that we have new ROS data
 /// \todo This should be a semaphore or mutex
@@ -84,14 +133,96 @@ volatile bool scene_update_needed=true;
 
 #ifdef USE_VULKAN
 #else
-/// Variables for rendering image to overlay
-GLuint textureFromImage = 0;
+/// Streams the camera image into the overlay texture
+ImageStreamer image_streamer;
+/// Decodes compressed images for image_streamer
+ImageDecoder image_decoder;
+/// Decodes video, from video_source or the video packet topic, for image_streamer
+VideoDecoder video_decoder;
+/// The images from camera_topics, drawn in the world. NULL if there aren't any
+CameraPlanes* camera_planes=NULL;
+/// Builds the really big markers without stalling the render thread
+MeshStreamer mesh_streamer;
+#endif
+
+
+/*!
+ * \brief One marker subscription, and the markers it owns
+ *
+ * Each topic keeps its own table, so two publishers using the same namespace and
+ * id don't clobber each other, and DELETEALL only clears its own topic.
+ */
+struct MarkerTopic{
+    std::string name;
+    ros::Subscriber sub;
+    std::map<std::pair<std::string,int>,Mesh*> meshes;///!< (ns,id) -> mesh. Only touched by the render thread
+};
+std::vector<MarkerTopic*> marker_topics;
+
+/*!
+ * \brief Marker messages for one topic that the render thread hasn't applied yet
+ *
+ * Only the newest message for each (ns,id) is kept, so a burst of messages
+ * between two frames costs one update per marker, not one per message.
+ */
+struct PendingMarkers{
+    PendingMarkers() : delete_all(false) {}
+    bool delete_all;    ///!< A DELETEALL came in, which goes before any of the changes
+    std::map<std::pair<std::string,int>,visualization_msgs::Marker> changes;
+};
+std::map<MarkerTopic*,PendingMarkers> pending_markers;
+boost::mutex pending_markers_mutex;
+/// Marker meshes waiting to be rebuilt, a budget's worth a frame. Render thread only
+std::deque<Mesh*> rebuild_queue;
+void apply_marker_updates();
+
+/// Newest PoseArray, waiting for the render thread. Older ones are just dropped
+geometry_msgs::PoseArray::ConstPtr pending_pose_array;
+boost::mutex pending_pose_array_mutex;
+/// Every arrow of the PoseArray, as instances of one mesh. Render thread only
+Mesh* pose_array_mesh=NULL;
+void apply_pose_array();
+
+/// Newest Path, and every Odometry since the last frame, waiting for the render thread
+nav_msgs::Path::ConstPtr pending_path;
+std::vector<nav_msgs::Odometry::ConstPtr> pending_odom;
+boost::mutex pending_trajectory_mutex;
+#ifndef USE_VULKAN
+/// Render thread only
+Trajectory* path_trajectory=NULL;
+Trajectory* odom_trajectory=NULL;
+#endif
+void apply_trajectories();
+
+/// Newest OccupancyGrid, and the updates that came after it, waiting for the render thread
+nav_msgs::OccupancyGrid::ConstPtr pending_map;
+std::vector<map_msgs::OccupancyGridUpdate::ConstPtr> pending_map_updates;
+boost::mutex pending_map_mutex;
+#ifndef USE_VULKAN
+/// Render thread only
+OccupancyMap* occupancy_map=NULL;
+#endif
+void apply_map();
+
+/// Newest costmap and grid map, plus the costmap updates that came after it, waiting for the render thread
+nav_msgs::OccupancyGrid::ConstPtr pending_costmap;
+std::vector<map_msgs::OccupancyGridUpdate::ConstPtr> pending_costmap_updates;
+#ifdef HAVE_GRID_MAP
+grid_map_msgs::GridMap::ConstPtr pending_grid_map;
+#endif
+boost::mutex pending_heightfield_mutex;
+#ifndef USE_VULKAN
+/// Render thread only
+Heightfield* costmap_heightfield=NULL;
+Heightfield* grid_map_heightfield=NULL;
+#endif
+void apply_heightfields();
+
+#if defined(HAVE_OCTOMAP) && !defined(USE_VULKAN)
+/// Decoded by the octomap callback, the render thread just uploads what changed
+OctomapVoxels* octomap_voxels=NULL;
+void apply_octomap();
 #endif
-bool received_image=false;
-bool received_first_image=false;
-boost::mutex image_mutex;
-cv::Mat image_flipped;
-cv_bridge::CvImagePtr cv_ptr_raw;
 
 
 /// Arrays of objects to be rendered. These have been converted into VR space, and are in a format easily rendered by the VR code.
@@ -124,6 +255,7 @@ private:
     Matrix4 move_trans_mat;
     Matrix4 move_trans_mat_old;
     std::vector<tf_obj> tf_cache;
+    boost::mutex tf_cache_mutex;    ///!< The timer refreshes tf_cache while the render thread reads it
 
    public:
 
@@ -161,6 +293,12 @@ private:
         /// Call the normal part of initializing OpenGL stuff
         bool bSuccess = CMainApplication::BInitGL();
 
+        /// Load the font for text markers, generating the distance field from the plain bitmap unless we were given one
+        if( bSuccess && !Mesh::text_atlas.Init(m_strTextPath, texture_character_map, text_atlas_filename) )
+        {
+            ROS_WARN("Could not set up the text atlas, text markers will not be shown");
+        }
+
         /// Now set up the Overlay
         vr::HmdError m_eOverlayError;
         vr::Compositor_OverlaySettings m_overlaySettings;
@@ -216,6 +354,23 @@ private:
 
             RenderFrame();
 
+#ifndef USE_VULKAN
+            apply_marker_updates();
+            apply_pose_array();
+            apply_trajectories();
+            apply_map();
+            apply_heightfields();
+#ifdef HAVE_OCTOMAP
+            apply_octomap();
+#endif
+            mesh_streamer.Upload();
+            Mesh::asset_cache.Update();
+            UpdateOverlayImage();
+            if(camera_planes){
+                camera_planes->Update(m_unYUVProgramID,m_nYUVLayoutLocation,m_nYUVRowsLocation,m_nYUVColorSpaceLocation);
+            }
+#endif
+
             if(scene_update_needed){
                 SetupScene();
             }
@@ -241,6 +396,7 @@ private:
         //m_uiControllerVertcount=0;
         if(show_tf){
             /// Show the 3 axis of every frame in our cache
+            boost::lock_guard<boost::mutex> lock(tf_cache_mutex);
             for(int ii=0;ii<tf_cache.size();ii++){
                 add_frame_to_scene(tf_cache[ii].transform,vertdataarray,0.1/scaling_factor);
             }
@@ -278,6 +434,9 @@ private:
             offset += sizeof( Vector3 );
             glEnableVertexAttribArray( 1 );
             glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
+            /// The thick line shader reads color from slot 2, like the marker geometry
+            glEnableVertexAttribArray( 2 );
+            glVertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
 
             glBindVertexArray( 0 );
         }
@@ -363,6 +522,34 @@ private:
         m_unPointSize=point_size;
     }
 
+    /*!
+     * \brief set width in pixels of the tf axes and grid lines
+     * \param line_width desired line width
+     */
+    void setLineWidth(float line_width)
+    {
+        m_fLineWidth=line_width;
+    }
+
+    /*!
+     * \brief set whether text markers attached to the HMD go into the HUD layer
+     * \param hud if true, they're drawn into a texture when they change, and shown as one quad per eye
+     */
+    void setHudText(bool hud)
+    {
+        m_bHudText=hud;
+    }
+
+    void setMapAlpha(float alpha)
+    {
+        m_fMapAlpha=alpha;
+    }
+
+    void setCameraPlaneAlpha(float alpha)
+    {
+        m_fCameraPlaneAlpha=alpha;
+    }
+
     //-----------------------------------------------------------------------------
     // Purpose: This function is intended to set up semi-perminant aspects of the
     //          scene, which for our purposes consists of ROS messages which should
@@ -375,28 +562,6 @@ private:
             return;
 
 
-        if(received_image && (manual_image_copy || image_mutex.try_lock())){
-#ifdef USE_VULKAN
-            /// \todo Bind texture
-#else
-            /// Bind texture
-            BindCVMat2GLTexture(textureFromImage);
-            /// Avoid recopying the same data
-            if(!manual_image_copy){
-                received_image = false;
-            }
-            /// Allow the subscriber to change the data
-            image_mutex.unlock();
-            /// Convert to a 'vr' texture
-            vr::Texture_t texture = {(void*)(uintptr_t)textureFromImage, vr::TextureType_OpenGL, vr::ColorSpace_Auto };
-            /// Set this texture to appear on the overlay and enable it. \note this may not need to be done every time?
-            vr::VROverlay()->SetOverlayTexture( m_ulOverlayHandle, &texture );
-            vr::VROverlay()->ShowOverlay(m_ulOverlayHandle);
-#endif
-        }else{
-            //ROS_ERROR("no image as of yet");
-        }
-
         m_uiVertcount = textured_tris_vertdataarray.size()/5;
 
 #ifdef USE_VULKAN
@@ -430,31 +595,6 @@ private:
             vkMapMemory( m_pDevice, m_pSceneConstantBufferMemory[ nEye ], 0, VK_WHOLE_SIZE, 0, &m_pSceneConstantBufferData[ nEye ] );
         }
 #else
-        if(textured_tris_vertdataarray.size()>0){
-            glGenVertexArrays( 1, &m_unSceneVAO );
-            glBindVertexArray( m_unSceneVAO );
-
-            glGenBuffers( 1, &m_glSceneVertBuffer );
-            glBindBuffer( GL_ARRAY_BUFFER, m_glSceneVertBuffer );
-            glBufferData( GL_ARRAY_BUFFER, sizeof(float) * textured_tris_vertdataarray.size(), &textured_tris_vertdataarray[0], GL_STATIC_DRAW);
-
-            GLsizei stride = sizeof(VertexDataScene);
-            uintptr_t offset = 0;
-
-            glEnableVertexAttribArray( 0 );
-            glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, stride , (const void *)offset);
-
-            offset += sizeof(Vector3);
-            glEnableVertexAttribArray( 1 );
-            glVertexAttribPointer( 1, 2, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
-
-
-            glBindVertexArray( 0 );
-            glDisableVertexAttribArray(0);
-            glDisableVertexAttribArray(1);
-        }
-
-
 
         // Setup the VAO the first time through.
         if ( m_unPointCloudVAO == 0 )
@@ -488,14 +628,6 @@ private:
             glBufferData( GL_ARRAY_BUFFER, sizeof(float) * color_points_vertdataarray.size(), &color_points_vertdataarray[0], GL_STREAM_DRAW );
         }
 
-        for(int idx=0;idx<robot_meshes.size();idx++){
-            if(robot_meshes[idx]->needs_update){
-
-                robot_meshes[idx]->InitMarker(scaling_factor);
-            }
-        }
-
-
 #endif
         scene_update_needed=false;
     }
@@ -508,69 +640,6 @@ private:
         return cart;
     }
 
-    /*!
-     * \brief add character as textured quad
-     * \param mat         Transform of the text globally
-     * \param vertdata    Where to put the vertices
-     * \param character   What character to print
-     * \param char_num    Offset each character side by side
-     * \param quad_size   How tall/wide should the character be
-     */
-    void add_char_quad(Matrix4 mat, std::vector<float> &vertdata, char character,int char_num=0,float quad_size=0.0005){
-
-        Vector2 text_global_start;
-        text_global_start.x=0.0;
-        text_global_start.y=0.0;
-        Vector2 text_global_stop;
-        text_global_stop.x=1.0;
-        text_global_stop.y=1.0;
-        for(int idx=0;idx<texture_character_map.size();idx++){
-            if(character==texture_character_map[idx]){
-                int row=idx%8;
-                int col=idx/8;
-                Vector2 text_start,text_stop;
-                text_start.x=text_global_start.x+(text_global_stop.x-text_global_start.x)*row/8;
-                text_stop.x=text_global_start.x+(text_global_stop.x-text_global_start.x)*(row+1)/8;
-                text_start.y=text_global_start.y+(text_global_stop.y-text_global_start.y)*col/8;
-                text_stop.y=text_global_start.y+(text_global_stop.y-text_global_start.y)*(col+1)/8;
-                /// Do something with u1,u2,v1,v2
-                ///
-                ///
-
-                Vector4 B = mat * Vector4( char_num*quad_size, 0, 0, 1 );
-                Vector4 A = mat * Vector4( char_num*quad_size+quad_size, 0, 0, 1 );
-                Vector4 D = mat * Vector4( char_num*quad_size+quad_size, quad_size, 0, 1 );
-                Vector4 C = mat * Vector4( char_num*quad_size, quad_size, 0, 1 );
-
-                // triangles instead of quads
-
-                AddCubeVertex( B.x, B.y, B.z, text_start.x, text_stop.y, vertdata ); //Back
-                AddCubeVertex( A.x, A.y, A.z, text_stop.x, text_stop.y, vertdata );
-                AddCubeVertex( D.x, D.y, D.z, text_stop.x, text_start.y, vertdata );
-                AddCubeVertex( D.x, D.y, D.z, text_stop.x, text_start.y, vertdata );
-                AddCubeVertex( C.x, C.y, C.z, text_start.x, text_start.y, vertdata );
-                AddCubeVertex( B.x, B.y, B.z, text_start.x, text_stop.y, vertdata );
-                return;
-            }
-        }
-        std::cout << "Error! character \"" << character << "\" not recognized" << std::endl;
-    }
-
-    /*!
-     * \brief Add Text To Scene
-     * \param mat         Transform of the text globally
-     * \param vertdata    Where to put the vertices
-     * \param text        String to display
-     * \param size        How tall/wide should each character be
-     */
-    void AddTextToScene( Matrix4 mat, std::vector<float> &vertdata, std::string text,float size=0.010)
-    {
-
-        for(int ii=0;ii<text.size();ii++){
-            add_char_quad(mat,vertdata,std::toupper(text[ii]),ii-text.size()/2,size);
-        }
-    }
-
     void AddColorVertex(Vector4 pt,Vector3 color, std::vector<float> &vertdata){
         vertdata.push_back(pt.x);
         vertdata.push_back(pt.y);
@@ -688,6 +757,7 @@ private:
      */
     void update_tf_cache(const ros::TimerEvent&){
         /// Go through the cache and get updated TF's
+        boost::unique_lock<boost::mutex> cache_lock(tf_cache_mutex);
         for(int ii=0;ii<tf_cache.size();ii++){
             tf::StampedTransform transform;
             try{
@@ -701,6 +771,7 @@ private:
             }
             tf_cache[ii].transform=VrTransform(transform);
         }
+        cache_lock.unlock();
 
         /// Also, publish transforms for things like the HMD and the controllers
         /// (Could publish the transforms for the HMD -> Eyes, the camera, the Lighthouse base stations, etc.)
@@ -960,9 +1031,12 @@ private:
      */
     Matrix4 GetRobotMatrixPose( std::string frame_name ){
         /// First, look to see if we have it in the cache
-        for(int ii=0;ii<tf_cache.size();ii++){
-            if(tf_cache[ii].frame_id==frame_name){
-                return tf_cache[ii].transform;
+        {
+            boost::lock_guard<boost::mutex> lock(tf_cache_mutex);
+            for(int ii=0;ii<tf_cache.size();ii++){
+                if(tf_cache[ii].frame_id==frame_name){
+                    return tf_cache[ii].transform;
+                }
             }
         }
         tf::StampedTransform transform;
@@ -979,67 +1053,133 @@ private:
         tf_obj trans;
         trans.transform=VrTransform(transform);
         trans.frame_id=frame_name;
+        boost::lock_guard<boost::mutex> lock(tf_cache_mutex);
         tf_cache.push_back(trans);
         return trans.transform;
     }
 
 #ifndef USE_VULKAN
     /*!
-     * \brief Convert an OpenCV image mat to OpenGL
+     * \brief Pose every robot mesh for this frame
+     *
+     * This is called once a frame, before either eye is drawn, so every mesh
+     * in both eyes uses the same snapshot of the TF cache.
+     *
+     * Robot links and frame_locked markers follow their frame_id, so they
+     * are re-posed from the snapshot every frame. Other markers stay where
+     * their frame_id was at header.stamp, like rviz does. That is looked up
+     * once relative to the base_frame, so they still move with the world when
+     * the user moves the scene around. None of this touches the geometry.
+     */
+    void UpdateMarkerPoses(){
+        std::map<std::string,Matrix4> snapshot;
+        {
+            boost::lock_guard<boost::mutex> lock(tf_cache_mutex);
+            for(int ii=0;ii<tf_cache.size();ii++){
+                snapshot[tf_cache[ii].frame_id]=tf_cache[ii].transform;
+            }
+        }
+        for(int idx=0;idx<robot_meshes.size();idx++){
+            Mesh* mesh=robot_meshes[idx];
+            if(mesh->frame_locked){
+                mesh->pose=SnapshotPose(snapshot,mesh->frame_id);
+                continue;
+            }
+            if(mesh->pose_stale){
+                ResolveFixedPose(mesh);
+            }
+            mesh->pose=SnapshotPose(snapshot,base_frame)*mesh->fixed_pose;
+        }
+
+        /// The camera planes mesh follows the base_frame, so each camera goes in relative to that
+        if(camera_planes){
+            Matrix4 base_inverse=SnapshotPose(snapshot,base_frame);
+            base_inverse.invertEuclidean();
+            std::vector<Matrix4> poses(camera_planes->Count());
+            for(unsigned int idx=0;idx<poses.size();idx++){
+                std::string frame_id=camera_planes->FrameId(idx);
+                if(!frame_id.empty()){
+                    poses[idx]=base_inverse*SnapshotPose(snapshot,frame_id);
+                }
+            }
+            camera_planes->SetPoses(poses,scaling_factor);
+        }
+    }
+
+    /*!
+     * \brief Look a frame up in this frame's snapshot, adding it to the TF cache if it's new
+     */
+    Matrix4 SnapshotPose(std::map<std::string,Matrix4> &snapshot, const std::string &frame_name){
+        std::map<std::string,Matrix4>::const_iterator found=snapshot.find(frame_name);
+        if(found!=snapshot.end()){
+            return found->second;
+        }
+        Matrix4 mat=GetRobotMatrixPose(frame_name);
+        snapshot[frame_name]=mat;
+        return mat;
+    }
+
+    /*!
+     * \brief Find where a marker's frame was in the base_frame at its header.stamp
      *
-     * \note This was adapted from https://stackoverflow.com/a/16815662 and may not be optimal
+     * If the stamp is newer than any TF we have, use the latest for now and
+     * try again next frame. If it still can't be found after a second, it's
+     * never going to be, so settle for the latest, or for where it is now if
+     * the frame isn't in TF at all. Either way it stops trying, so a frame
+     * that never shows up doesn't cost failed lookups every frame.
      *
-     * \param image
-     * \param imageTexture
+     * canTransform() is asked first, so failing doesn't throw.
+     *
+     * \param mesh marker mesh, fixed_pose is updated and pose_stale cleared once resolved
      */
-    void BindCVMat2GLTexture(GLuint& imageTexture)
+    void ResolveFixedPose(Mesh* mesh){
+        ros::Time stamp=mesh->marker.header.stamp;
+        bool expired=(ros::Time::now()-stamp>ros::Duration(1.0));
+        ros::Time when=stamp;
+        std::string error;
+        if(!listener->canTransform(base_frame, mesh->frame_id, when, &error)){
+            when=ros::Time(0);
+            if(!listener->canTransform(base_frame, mesh->frame_id, when, &error)){
+                ROS_ERROR_THROTTLE(2,"%s",error.c_str());
+                if(expired){
+                    mesh->pose_stale=false;
+                }
+                return;
+            }
+        }
+        tf::StampedTransform transform;
+        try{
+            listener->lookupTransform(base_frame, mesh->frame_id, when, transform);
+        }
+        catch (tf::TransformException ex){
+            ROS_ERROR_THROTTLE(2,"%s",ex.what());
+            return;
+        }
+        if(when==stamp || expired){
+            mesh->pose_stale=false;
+        }
+        mesh->fixed_pose=VrTransform(transform);
+    }
+#endif
+
+#ifndef USE_VULKAN
+    /*!
+     * \brief Put the newest camera image on the overlay, without waiting for it to upload
+     */
+    void UpdateOverlayImage()
     {
-       if(image_flipped.empty()){
-          std::cout << "image empty" << std::endl;
-      }else{
-          //glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-          glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-          if(imageTexture==0){
-              /// This allocates memory for the texture, so we do it the first time
-              /// If the image you are subscribing to changes resolution THINGS WILL BREAK
-              glGenTextures(1, &imageTexture);
-              glBindTexture(GL_TEXTURE_2D, imageTexture);
-              glTexImage2D( GL_TEXTURE_2D,          // Type of texture
-                            0,                      // Pyramid level (for mip-mapping) - 0 is the top level
-                            GL_RGBA,                // Internal colour format to convert to
-                            image_flipped.cols,     // Image width  i.e. 640 for Kinect in standard mode
-                            image_flipped.rows,     // Image height i.e. 480 for Kinect in standard mode
-                            0,                      // Border width in pixels (can either be 1 or 0)
-                            GL_RGBA,                // Input image format (i.e. GL_RGB, GL_RGBA, GL_BGR etc.)
-                            GL_UNSIGNED_BYTE,       // Image data type
-                            image_flipped.ptr());   // The actual image data itself
-          }
-
-          glBindTexture(GL_TEXTURE_2D, imageTexture);
-
-          glTexSubImage2D(GL_TEXTURE_2D,        // Type of texture
-                        0,                      // Pyramid level (for mip-mapping) - 0 is the top level
-                        0,0,                    // Internal colour format to convert to
-                        image_flipped.cols,     // Image width  i.e. 640 for Kinect in standard mode
-                        image_flipped.rows,     // Image height i.e. 480 for Kinect in standard mode
-                        GL_RGBA,                // Input image format (i.e. GL_RGB, GL_RGBA, GL_BGR etc.)
-                        GL_UNSIGNED_BYTE,       // Image data type
-                        image_flipped.ptr());   // The actual image data itself
-
-          // If this renders black ask McJohn what's wrong.
-          glGenerateMipmap(GL_TEXTURE_2D);
-
-          glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
-          glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
-          glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-          glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
-
-          GLfloat fLargest;
-          glGetFloatv( GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &fLargest );
-          glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, fLargest );
-
-          glBindTexture( GL_TEXTURE_2D, 0 );
+        if(!image_streamer.Update(m_unYUVProgramID,m_nYUVLayoutLocation,m_nYUVRowsLocation,m_nYUVColorSpaceLocation)){
+            return;
         }
+        ROS_DEBUG_THROTTLE(5.0,"%lu of %lu images were replaced before they could be shown",image_streamer.Dropped(),image_streamer.Written());
+        /// Convert to a 'vr' texture
+        vr::Texture_t texture = {(void*)(uintptr_t)image_streamer.Texture(), vr::TextureType_OpenGL, vr::ColorSpace_Auto };
+        /// Set this texture to appear on the overlay and enable it. \note this may not need to be done every time?
+        vr::VROverlay()->SetOverlayTexture( m_ulOverlayHandle, &texture );
+        /// The first row went in first, so flip it over here instead of flipping the pixels
+        vr::VRTextureBounds_t bounds = { 0.0f, 1.0f, 1.0f, 0.0f };
+        vr::VROverlay()->SetOverlayTextureBounds( m_ulOverlayHandle, &bounds );
+        vr::VROverlay()->ShowOverlay(m_ulOverlayHandle);
     }
 #endif
 
@@ -1059,7 +1199,7 @@ VRVizApplication *pVRVizApplication;
  * \param marker2 second marker
  * \return true if content of markers is identical
  */
-bool markers_equal(visualization_msgs::Marker marker1,visualization_msgs::Marker marker2){
+bool markers_equal(const visualization_msgs::Marker& marker1,const visualization_msgs::Marker& marker2){
     if(marker1.header.frame_id!=marker2.header.frame_id){return false;}
 //    if(marker1.ns!=marker2.ns){return false;}
 //    if(marker1.id!=marker2.id){return false;}
@@ -1099,25 +1239,90 @@ bool markers_equal(visualization_msgs::Marker marker1,visualization_msgs::Marker
     return true;
 }
 
-int find_or_add_marker(visualization_msgs::Marker marker){
+#ifndef USE_VULKAN
+/*!
+ * \brief is this text that should be in the HUD layer
+ *
+ * That is any text marker in the HMD frame, if hud_text is set.
+ *
+ * \param marker the marker
+ * \return true if it goes in the HUD layer rather than the world
+ */
+bool is_hud_marker(const visualization_msgs::Marker& marker){
+    if(!hud_text || marker.type!=visualization_msgs::Marker::TEXT_VIEW_FACING){
+        return false;
+    }
+    std::string frame=marker.header.frame_id;
+    if(!frame.empty() && frame[0]=='/'){
+        frame.erase(0,1);
+    }
+    std::string hmd_frame=frame_prefix + "_hmd";
+    if(!hmd_frame.empty() && hmd_frame[0]=='/'){
+        hmd_frame.erase(0,1);
+    }
+    return frame==hmd_frame;
+}
+
+/*!
+ * \brief Apply one marker to the table of the topic it came from
+ *
+ * This runs on the render thread. Deleted meshes are only flagged here, and
+ * freed by apply_marker_updates once all the changes are in. Changed meshes are
+ * queued to be rebuilt.
+ *
+ * \param topic  the subscription the marker arrived on
+ * \param marker the marker
+ * \return the mesh for this marker, or NULL if it was deleted
+ */
+Mesh* find_or_add_marker(MarkerTopic* topic, const visualization_msgs::Marker& marker){
     if(!pVRVizApplication){
-        return -1;
-    }
-    for(int idx=0;idx<pVRVizApplication->robot_meshes.size();idx++){
-        if(pVRVizApplication->robot_meshes[idx]->id==marker.id && pVRVizApplication->robot_meshes[idx]->name==marker.ns){
-            /// We already have something with this namespace and ID.
-            /// Check if this marker is different (other than the timestamp)
-            if(!markers_equal(pVRVizApplication->robot_meshes[idx]->marker,marker)){
-                /// Copy over the new data, and raise  flag telling it to be updated
-                pVRVizApplication->robot_meshes[idx]->marker=marker;
-                pVRVizApplication->robot_meshes[idx]->needs_update=true;
-            }else{
-                /// Nothing has changed, but at least update the timestamp so we know it's updated lifetime
-                pVRVizApplication->robot_meshes[idx]->marker.header.stamp=marker.header.stamp;
-            }
+        return NULL;
+    }
+    if(marker.action==visualization_msgs::Marker::DELETEALL){
+        for(std::map<std::pair<std::string,int>,Mesh*>::iterator it=topic->meshes.begin();it!=topic->meshes.end();++it){
+            it->second->needs_delete=true;
+        }
+        topic->meshes.clear();
+        return NULL;
+    }
 
-            return idx;
+    std::pair<std::string,int> key(marker.ns,marker.id);
+    std::map<std::pair<std::string,int>,Mesh*>::iterator found=topic->meshes.find(key);
+    if(marker.action==visualization_msgs::Marker::DELETE){
+        if(found!=topic->meshes.end()){
+            found->second->needs_delete=true;
+            topic->meshes.erase(found);
+        }
+        return NULL;
+    }
+
+    if(found!=topic->meshes.end()){
+        Mesh* mesh=found->second;
+        /// We already have something with this namespace and ID.
+        /// Every new message gets posed at its own stamp, even if the geometry is the same
+        mesh->frame_id=marker.header.frame_id;
+        mesh->frame_locked=marker.frame_locked;
+        mesh->pose_stale=true;
+        mesh->hud=is_hud_marker(marker);
+        /// Check if this marker is different (other than the timestamp)
+        if(!markers_equal(mesh->marker,marker)){
+            /// Copy over the new data, and raise  flag telling it to be updated
+            mesh->marker=marker;
+            if(mesh_streamer.ShouldStream(marker)){
+                /// Too big to build on the render thread, the streamer swaps it in when it's done
+                mesh_streamer.Submit(mesh,marker,scaling_factor);
+                mesh->needs_update=false;
+                return mesh;
+            }
+            if(!mesh->needs_update){
+                rebuild_queue.push_back(mesh);
+            }
+            mesh->needs_update=true;
+        }else{
+            /// Nothing has changed, but at least update the timestamp so we know it's updated lifetime
+            mesh->marker.header.stamp=marker.header.stamp;
         }
+        return mesh;
     }
 
     /// We didn't find it in our existing meshes, so make a new one
@@ -1125,6 +1330,8 @@ int find_or_add_marker(visualization_msgs::Marker marker){
     myMesh->name=marker.ns;
     myMesh->id=marker.id;
     myMesh->frame_id=marker.header.frame_id;
+    myMesh->frame_locked=marker.frame_locked;
+    myMesh->hud=is_hud_marker(marker);
     Vector3 scale;
     scale.x=1.0;
     scale.y=1.0;
@@ -1138,51 +1345,406 @@ int find_or_add_marker(visualization_msgs::Marker marker){
     myMesh->marker=marker;
     myMesh->initialized=false;
     myMesh->needs_update=true;
+    if(mesh_streamer.ShouldStream(marker)){
+        mesh_streamer.Submit(myMesh,marker,scaling_factor);
+        myMesh->needs_update=false;
+    }else{
+        rebuild_queue.push_back(myMesh);
+    }
+    topic->meshes[key]=myMesh;
     pVRVizApplication->robot_meshes.push_back(myMesh);
-    return -2;
+    return myMesh;
 }
 
 /*!
- * \brief Callback for an array of Visualization Markers
+ * \brief Apply the marker messages that came in since the last frame
  *
- * \warning This currently only works with text!
+ * Called once a frame from the render thread. The pending changes are swapped
+ * out under the lock, so the callbacks are never held up by the rebuilding.
+ * Then changed meshes are rebuilt until marker_update_budget points have been
+ * done, and the rest wait for the next frame. A marker that changes again
+ * before its turn is only built once, with its newest data.
+ */
+void apply_marker_updates()
+{
+    std::map<MarkerTopic*,PendingMarkers> pending;
+    {
+        boost::lock_guard<boost::mutex> lock(pending_markers_mutex);
+        pending.swap(pending_markers);
+    }
+
+    bool deleted=false;
+    for(std::map<MarkerTopic*,PendingMarkers>::iterator it=pending.begin();it!=pending.end();++it){
+        MarkerTopic* topic=it->first;
+        if(it->second.delete_all){
+            visualization_msgs::Marker delete_all;
+            delete_all.action=visualization_msgs::Marker::DELETEALL;
+            find_or_add_marker(topic,delete_all);
+            deleted=true;
+        }
+        std::map<std::pair<std::string,int>,visualization_msgs::Marker>::const_iterator change;
+        for(change=it->second.changes.begin();change!=it->second.changes.end();++change){
+            find_or_add_marker(topic,change->second);
+            deleted=deleted || change->second.action==visualization_msgs::Marker::DELETE;
+        }
+    }
+
+    if(deleted){
+        std::vector<Mesh*> &robot_meshes=pVRVizApplication->robot_meshes;
+        for(int idx=0;idx<robot_meshes.size();idx++){
+            if(robot_meshes[idx]->needs_delete){
+                /// Deleted by a marker, we free it here since it owns GL objects
+                mesh_streamer.Cancel(robot_meshes[idx]);
+                rebuild_queue.erase(std::remove(rebuild_queue.begin(),rebuild_queue.end(),robot_meshes[idx]),rebuild_queue.end());
+                delete robot_meshes[idx];
+                robot_meshes.erase(robot_meshes.begin()+idx);
+                idx--;
+            }
+        }
+    }
+
+    size_t points=0;
+    while(!rebuild_queue.empty()){
+        Mesh* mesh=rebuild_queue.front();
+        size_t cost=mesh->marker.points.size()+1;
+        if(points>0 && points+cost>size_t(marker_update_budget)){
+            break;
+        }
+        rebuild_queue.pop_front();
+        if(!mesh->needs_update){
+            /// It went to the streamer after it was queued
+            continue;
+        }
+        points+=cost;
+        /// Whatever was being streamed is out of date now
+        mesh_streamer.Cancel(mesh);
+        mesh->InitMarker(scaling_factor);
+    }
+}
+
+/*!
+ * \brief Rebuild the PoseArray arrows, if a new one came in since the last frame
  *
- * \todo Allow standard RGB color
- * \todo Allow Marker::MESH_RESOURCE (should be easy, just call loadModel())
- * \todo Allow spheres, cubes, cylinders, lines, etc.
+ * Only the instance buffer changes, the arrow itself is the shared template.
+ */
+void apply_pose_array()
+{
+    geometry_msgs::PoseArray::ConstPtr msg;
+    {
+        boost::lock_guard<boost::mutex> lock(pending_pose_array_mutex);
+        msg.swap(pending_pose_array);
+    }
+    if(!msg){
+        return;
+    }
+    if(!pose_array_mesh){
+        pose_array_mesh = new Mesh;
+        pose_array_mesh->name="pose_array";
+        /// Like a marker that isn't frame_locked, the poses were where they were at the stamp
+        pose_array_mesh->frame_locked=false;
+        pVRVizApplication->robot_meshes.push_back(pose_array_mesh);
+    }
+    pose_array_mesh->frame_id=msg->header.frame_id;
+    pose_array_mesh->marker.header=msg->header;
+    pose_array_mesh->pose_stale=true;
+    /// Same color as rviz uses
+    pose_array_mesh->InitPoseArray(msg->poses,scaling_factor,Vector3(1.0,0.1,0.0),pose_array_arrow_length);
+}
+
+/*!
+ * \brief Make a Path or Odometry trajectory the first time it is needed
+ */
+Trajectory* new_trajectory(const std::string& name, Vector3 color)
+{
+    Trajectory* trajectory = new Trajectory(name,color);
+    trajectory->SetCapacity(std::max(trajectory_max_points,2));
+    trajectory->mesh->m_Entries[0].Width=trajectory_width*scaling_factor;
+    pVRVizApplication->robot_meshes.push_back(trajectory->mesh);
+    return trajectory;
+}
+
+/*!
+ * \brief Add whatever is new in the Path and Odometry messages since the last frame
  *
- * \param msg
+ * Only the new points get uploaded, so this doesn't get slower as the trajectories get longer.
  */
-void markers_Callback(const visualization_msgs::MarkerArray::ConstPtr& msg)
+void apply_trajectories()
 {
-    std::vector<float> texturedvertdataarray;
+    nav_msgs::Path::ConstPtr path;
+    std::vector<nav_msgs::Odometry::ConstPtr> odom;
+    {
+        boost::lock_guard<boost::mutex> lock(pending_trajectory_mutex);
+        path.swap(pending_path);
+        odom.swap(pending_odom);
+    }
+    if(path){
+        if(!path_trajectory){
+            /// Same color as rviz uses
+            path_trajectory = new_trajectory("path",Vector3(0.1,1.0,0.0));
+        }
+        path_trajectory->SetPath(*path,scaling_factor);
+    }
+    if(!odom.empty() && !odom_trajectory){
+        odom_trajectory = new_trajectory("odom",Vector3(1.0,0.6,0.0));
+    }
+    for(size_t idx=0;idx<odom.size();idx++){
+        odom_trajectory->AddOdometry(*odom[idx],scaling_factor,odom_min_distance);
+    }
+}
 
-    for(int ii=0;ii<msg->markers.size();ii++)
+/*!
+ * \brief Upload the new occupancy grid, and/or the rectangles that changed since the last frame
+ */
+void apply_map()
+{
+    nav_msgs::OccupancyGrid::ConstPtr map;
+    std::vector<map_msgs::OccupancyGridUpdate::ConstPtr> updates;
     {
-        find_or_add_marker(msg->markers[ii]);
-        if(msg->markers[ii].type==visualization_msgs::Marker::TEXT_VIEW_FACING){
+        boost::lock_guard<boost::mutex> lock(pending_map_mutex);
+        map.swap(pending_map);
+        updates.swap(pending_map_updates);
+    }
+    if(!map && updates.empty()){
+        return;
+    }
+    if(!occupancy_map){
+        occupancy_map = new OccupancyMap("map");
+        pVRVizApplication->robot_meshes.push_back(occupancy_map->mesh);
+    }
+    if(map){
+        occupancy_map->SetMap(*map,scaling_factor);
+    }
+    for(size_t idx=0;idx<updates.size();idx++){
+        occupancy_map->ApplyUpdate(*updates[idx]);
+    }
+}
 
-            Matrix4 mat = pVRVizApplication->GetRobotMatrixPose(msg->markers[ii].header.frame_id);
+/*!
+ * \brief Upload whatever changed in the costmap and grid map since the last frame
+ */
+void apply_heightfields()
+{
+    nav_msgs::OccupancyGrid::ConstPtr costmap;
+    std::vector<map_msgs::OccupancyGridUpdate::ConstPtr> updates;
+#ifdef HAVE_GRID_MAP
+    grid_map_msgs::GridMap::ConstPtr grid_map;
+#endif
+    {
+        boost::lock_guard<boost::mutex> lock(pending_heightfield_mutex);
+        costmap.swap(pending_costmap);
+        updates.swap(pending_costmap_updates);
+#ifdef HAVE_GRID_MAP
+        grid_map.swap(pending_grid_map);
+#endif
+    }
+    if(costmap || !updates.empty()){
+        if(!costmap_heightfield){
+            costmap_heightfield = new Heightfield("costmap");
+            pVRVizApplication->robot_meshes.push_back(costmap_heightfield->mesh);
+        }
+        if(costmap){
+            costmap_heightfield->SetCostmap(*costmap,scaling_factor,costmap_height);
+        }
+        for(size_t idx=0;idx<updates.size();idx++){
+            costmap_heightfield->ApplyCostmapUpdate(*updates[idx],costmap_height);
+        }
+    }
+#ifdef HAVE_GRID_MAP
+    if(grid_map){
+        if(!grid_map_heightfield){
+            grid_map_heightfield = new Heightfield("grid_map");
+            pVRVizApplication->robot_meshes.push_back(grid_map_heightfield->mesh);
+        }
+        grid_map_heightfield->SetGridMap(*grid_map,grid_map_layer,scaling_factor);
+    }
+#endif
+}
 
-            tf::StampedTransform trans;
-            trans.setOrigin(tf::Vector3(msg->markers[ii].pose.position.x,msg->markers[ii].pose.position.y,msg->markers[ii].pose.position.z));
-            trans.setRotation(tf::Quaternion(msg->markers[ii].pose.orientation.x,msg->markers[ii].pose.orientation.y,msg->markers[ii].pose.orientation.z,msg->markers[ii].pose.orientation.w));
-            Matrix4 matTransform4 = pVRVizApplication->VrTransform(trans);
-            //matTransform4.translate(pt.x,pt.y,pt.z);
-            Matrix4 mat4 = mat * matTransform4;
+#ifdef HAVE_OCTOMAP
+/*!
+ * \brief Upload the Octomap subtrees that changed since the last frame
+ */
+void apply_octomap()
+{
+    octomap_voxels->Upload();
+}
+#endif
+#endif
 
-            /// Only scale.z is used. scale.z specifies the height of an uppercase "A".
-            float height=msg->markers[ii].scale.z*scaling_factor;
+/*!
+ * \brief Queue one marker for the render thread, replacing anything older with the same (ns,id)
+ *
+ * \note pending_markers_mutex must be held
+ */
+void queue_marker(MarkerTopic* topic, const visualization_msgs::Marker& marker)
+{
+    PendingMarkers &pending=pending_markers[topic];
+    if(marker.action==visualization_msgs::Marker::DELETEALL){
+        pending.delete_all=true;
+        pending.changes.clear();
+        return;
+    }
+    pending.changes[std::make_pair(marker.ns,marker.id)]=marker;
+}
 
-            pVRVizApplication->AddTextToScene(mat4,texturedvertdataarray,msg->markers[ii].text,height);
-        }
+/*!
+ * \brief Callback for an array of Visualization Markers
+ *
+ * Every marker (text included) becomes a Mesh, which gets rebuilt on the render
+ * thread only if it changed. Markers on other topics are never touched.
+ *
+ * \param msg
+ * \param topic the subscription this came in on
+ */
+void markers_Callback(const visualization_msgs::MarkerArray::ConstPtr& msg, MarkerTopic* topic)
+{
+    boost::lock_guard<boost::mutex> lock(pending_markers_mutex);
+    for(int ii=0;ii<msg->markers.size();ii++)
+    {
+        queue_marker(topic,msg->markers[ii]);
     }
-    /// Copy the data over to the shared data
-    /// \todo This should be protected with a mutex of sorts!
-    textured_tris_vertdataarray=texturedvertdataarray;
-    scene_update_needed=true;
 }
 
+/*!
+ * \brief Callback for a single Visualization Marker
+ * \param msg
+ * \param topic the subscription this came in on
+ */
+void marker_Callback(const visualization_msgs::Marker::ConstPtr& msg, MarkerTopic* topic)
+{
+    boost::lock_guard<boost::mutex> lock(pending_markers_mutex);
+    queue_marker(topic,*msg);
+}
+
+/*!
+ * \brief Callback for a PoseArray, e.g. AMCL's particle cloud
+ *
+ * The render thread builds it, so this just keeps the newest one.
+ *
+ * \param msg
+ */
+void poseArrayCallback(const geometry_msgs::PoseArray::ConstPtr& msg)
+{
+    ROS_INFO_ONCE("Received Pose Array Message");
+    boost::lock_guard<boost::mutex> lock(pending_pose_array_mutex);
+    pending_pose_array=msg;
+}
+
+/*!
+ * \brief Callback for a Path, e.g. a trajectory or a plan
+ *
+ * The render thread works out what is new, so this just keeps the newest one.
+ *
+ * \param msg
+ */
+void pathCallback(const nav_msgs::Path::ConstPtr& msg)
+{
+    ROS_INFO_ONCE("Received Path Message");
+    boost::lock_guard<boost::mutex> lock(pending_trajectory_mutex);
+    pending_path=msg;
+}
+
+/*!
+ * \brief Callback for Odometry, which builds up a history of where the robot has been
+ *
+ * Unlike the other callbacks, every message is kept, since each one is part of the history.
+ *
+ * \param msg
+ */
+void odomCallback(const nav_msgs::Odometry::ConstPtr& msg)
+{
+    ROS_INFO_ONCE("Received Odometry Message");
+    boost::lock_guard<boost::mutex> lock(pending_trajectory_mutex);
+    pending_odom.push_back(msg);
+}
+
+/*!
+ * \brief Callback for an OccupancyGrid, e.g. from map_server or a costmap
+ *
+ * Any updates still waiting are older than this, so they get dropped.
+ *
+ * \param msg
+ */
+void mapCallback(const nav_msgs::OccupancyGrid::ConstPtr& msg)
+{
+    ROS_INFO_ONCE("Received Occupancy Grid Message");
+    boost::lock_guard<boost::mutex> lock(pending_map_mutex);
+    pending_map=msg;
+    pending_map_updates.clear();
+}
+
+/*!
+ * \brief Callback for a change to part of the OccupancyGrid
+ *
+ * Every update is kept, since each one covers a different rectangle.
+ *
+ * \param msg
+ */
+void mapUpdateCallback(const map_msgs::OccupancyGridUpdate::ConstPtr& msg)
+{
+    boost::lock_guard<boost::mutex> lock(pending_map_mutex);
+    pending_map_updates.push_back(msg);
+}
+
+/*!
+ * \brief Callback for a costmap, drawn as a heightfield
+ *
+ * Any updates still waiting are older than this, so they get dropped.
+ *
+ * \param msg
+ */
+void costmapCallback(const nav_msgs::OccupancyGrid::ConstPtr& msg)
+{
+    ROS_INFO_ONCE("Received Costmap Message");
+    boost::lock_guard<boost::mutex> lock(pending_heightfield_mutex);
+    pending_costmap=msg;
+    pending_costmap_updates.clear();
+}
+
+/*!
+ * \brief Callback for a change to part of the costmap
+ * \param msg
+ */
+void costmapUpdateCallback(const map_msgs::OccupancyGridUpdate::ConstPtr& msg)
+{
+    boost::lock_guard<boost::mutex> lock(pending_heightfield_mutex);
+    pending_costmap_updates.push_back(msg);
+}
+
+#ifdef HAVE_GRID_MAP
+/*!
+ * \brief Callback for a grid map, e.g. an elevation map
+ *
+ * The render thread works out what changed, so this just keeps the newest one.
+ *
+ * \param msg
+ */
+void gridMapCallback(const grid_map_msgs::GridMap::ConstPtr& msg)
+{
+    ROS_INFO_ONCE("Received Grid Map Message");
+    boost::lock_guard<boost::mutex> lock(pending_heightfield_mutex);
+    pending_grid_map=msg;
+}
+#endif
+
+#ifdef HAVE_OCTOMAP
+/*!
+ * \brief Callback for an Octomap, e.g. octomap_server's octomap_binary
+ *
+ * The whole tree is walked and diffed here, so the render thread only uploads
+ * the subtrees that changed.
+ *
+ * \param msg
+ */
+void octomapCallback(const octomap_msgs::Octomap::ConstPtr& msg)
+{
+    ROS_INFO_ONCE("Received Octomap Message");
+#ifndef USE_VULKAN
+    octomap_voxels->SetOctomap(*msg,scaling_factor,octomap_min_z,octomap_max_z);
+#endif
+}
+#endif
+
 void lockCallback(const std_msgs::Bool::ConstPtr& lock_in)
 {
     pVRVizApplication->setLock(lock_in->data);
@@ -1322,108 +1884,126 @@ void pointCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud_in)
 
 
 /*!
- * \brief rawImageCallback
+ * \brief hand an image to a streamer, converting it first if it can't take it as it is
  *
- * \note This callback converts to OpenCV only to then convert to OpenGL, which is probably inefficient
- * \todo See if there is an easy way to pass the raw_image_msg->data directly into glTexImage2D to avoid OpenCV
+ * bgr8, rgb8, bgra8 and rgba8 images, and yuv422 (UYVY), yuv422_yuy2 (YUYV), nv12 and
+ * nv21 ones, are copied as they are into the pixel buffer the render thread streams into
+ * its texture (see image_streamer.h), YUV being converted on the GPU. Anything else is
+ * converted to rgba8 here first (see image_convert.h), going through cv_bridge only for
+ * encodings it doesn't know.
  *
  * \param raw_image_msg
+ * \param streamer     the overlay's, or a camera plane's
  */
-void rawImageCallback(const sensor_msgs::Image::ConstPtr& raw_image_msg){
-    if(manual_image_copy)
-    {
-        int x,y,idx,id2;
-        if(!received_first_image)
-        {
-            /// Preallocate with 4 bytes/pixel for RGBA
-            image_flipped = cv::Mat(raw_image_msg->height, raw_image_msg->width, CV_8UC4);
-            for(y=0;y<raw_image_msg->height;y++)
+void streamImage(const sensor_msgs::Image::ConstPtr& raw_image_msg, ImageStreamer& streamer){
+    sensor_msgs::Image::ConstPtr image=raw_image_msg;
+    if(!ImageStreamer::CanUpload(*raw_image_msg)){
+        ImageConvert::Format format=ImageConvert::FormatFromEncoding(raw_image_msg->encoding);
+        bool well_formed=(format!=ImageConvert::UNSUPPORTED &&
+                          raw_image_msg->step>=raw_image_msg->width*ImageConvert::BytesPerPixel(format) &&
+                          raw_image_msg->data.size()>=size_t(raw_image_msg->step)*raw_image_msg->height);
+        ROS_INFO_ONCE("Got a %s image, converting it to rgba8 with the %s kernel",raw_image_msg->encoding.c_str(),ImageConvert::KernelName());
+        const unsigned char* src=NULL;
+        size_t src_step=raw_image_msg->step;
+        cv_bridge::CvImagePtr cv_ptr_raw;
+        if(well_formed){
+            src=raw_image_msg->data.empty()?NULL:&raw_image_msg->data[0];
+        }else{
+            try
             {
-                for(x=0;x<raw_image_msg->width;x++)
-                {
-                    /// Set the alpha to non-transparent
-                    /// \todo Could make this a param, to allow people to overlay translucent images
-                    idx=(raw_image_msg->height-1-y)*raw_image_msg->step+x*3;
-                    image_flipped.at<cv::Vec4b>(y,x)[3] = 255;
-                }
+                /// Convert to OpenCV
+                cv_ptr_raw = cv_bridge::toCvCopy(raw_image_msg,sensor_msgs::image_encodings::BGR8);
+                format=ImageConvert::BGR8;
+                src=cv_ptr_raw->image.data;
+                src_step=cv_ptr_raw->image.step;
             }
-            //ROS_INFO("Set up image. Cols=%d,Rows=%d",image_flipped.cols,image_flipped.rows);
-            received_first_image = true;
-        }
-        if(raw_image_msg->encoding==sensor_msgs::image_encodings::BGR8)
-        {
-            /// Right now we only go from BGR -> RGBA
-            /// \todo RGB -> RGBA would be pretty easy to impliment, if anyone want it.
-            for(y=0;y<raw_image_msg->height;y++)
+            catch (cv_bridge::Exception& error)
             {
-                /// I tried a few different ways of looping through the data, and this is the fastest one I found.
-                uchar* pixel = image_flipped.ptr<uchar>(y);  // point to first color in row
-                pixel+=2;
-                const uchar* pixel2 = &(raw_image_msg->data[(raw_image_msg->height-1-y)*raw_image_msg->step]);  // point to first color in row
-                for(x=0;x<raw_image_msg->width;x++)
-                {
-                    /// Takes ~30ms for 2x1080p
-                    *pixel--=*pixel2++;
-                    *pixel--=*pixel2++;
-                    *pixel=*pixel2++;
-                    pixel+=6;
-                    /// Takes ~60ms for 2x1080p
-//                    idx=(raw_image_msg->height-1-y)*raw_image_msg->step+x*3;
-//                    id2=4*(raw_image_msg->width*y + x);
-//                    image_flipped.data[id2+0]=raw_image_msg->data[idx+2];
-//                    image_flipped.data[id2+1]=raw_image_msg->data[idx+1];
-//                    image_flipped.data[id2+2]=raw_image_msg->data[idx+0];
-                    /// Slowest, takes ~100ms for 2x1080p
-//                    idx=(raw_image_msg->height-1-y)*raw_image_msg->step+x*3;
-//                    image_flipped.at<cv::Vec4b>(y,x)[0] = raw_image_msg->data[idx+2];
-//                    image_flipped.at<cv::Vec4b>(y,x)[1] = raw_image_msg->data[idx+1];
-//                    image_flipped.at<cv::Vec4b>(y,x)[2] = raw_image_msg->data[idx+0];
-//                    image_flipped.at<cv::Vec4b>(y,x)[3] = 255;
-                }
+                ROS_ERROR("cv_bridge exception: %s", error.what());
             }
-        }else{
-            ROS_WARN("Manual image copy only works on BRG8 images, sorry!");
-            /// \todo Could fall back to the opencv copy
         }
-        /// tell the VR thread we have data
-        received_image=true;
-
-    }else{
-        try
-        {
-            /// Convert to OpenCV
-            cv_ptr_raw = cv_bridge::toCvCopy(raw_image_msg,sensor_msgs::image_encodings::BGR8);
-
-            /// Convert to RGB
-            /// \note this is actually pretty slow. For a stereo 1080p image it could be ~30ms
-            cv::cvtColor(cv_ptr_raw->image, cv_ptr_raw->image, CV_BGR2RGBA);
-
-            /// Don't bother copying the image if the VR thread hasn't even processed the last one.
-            if(!received_image && image_mutex.try_lock()){
+        if(!src || raw_image_msg->width==0 || raw_image_msg->height==0){
+            return;
+        }
+        sensor_msgs::Image::Ptr rgba(new sensor_msgs::Image);
+        rgba->header=raw_image_msg->header;
+        rgba->height=raw_image_msg->height;
+        rgba->width=raw_image_msg->width;
+        rgba->encoding=sensor_msgs::image_encodings::RGBA8;
+        rgba->is_bigendian=false;
+        rgba->step=4*rgba->width;
+        rgba->data.resize(size_t(rgba->step)*rgba->height);
+        ImageConvert::ToRGBA(src,src_step,rgba->width,rgba->height,format,raw_image_msg->is_bigendian,
+                             &rgba->data[0],rgba->step,false);
+        image=rgba;
+    }
 
-                /// Flip it because OpenCV and OpenGL have a different top/bottom standard
-                /// \note this is actually pretty slow. For a stereo 1080p image it could be ~15ms
-                /// \todo this should not be necessary. In opengl you can just flip the quad, not the texture. But with the overlay we don't have control of the quad?
-                cv::flip(cv_ptr_raw->image, image_flipped, 0);
+    /// If the render thread hasn't taken the last one yet, it never will
+    streamer.Write(image);
+}
 
-                /// tell the VR thread we have data
-                received_image=true;
+/*!
+ * \brief rawImageCallback
+ *
+ * The image for the overlay.
+ *
+ * \param raw_image_msg
+ */
+void rawImageCallback(const sensor_msgs::Image::ConstPtr& raw_image_msg){
+    streamImage(raw_image_msg,image_streamer);
+}
 
-                /// Release the mutex to allow the VR thread to use the image
-                image_mutex.unlock();
+/*!
+ * \brief cameraImageCallback
+ *
+ * For the topics in camera_topics, which are drawn in the world (see camera_planes.h)
+ * instead of on the overlay. The same encodings go straight through as for the overlay.
+ *
+ * \param image_msg
+ * \param camera   index into camera_topics
+ */
+void cameraImageCallback(const sensor_msgs::Image::ConstPtr& image_msg, unsigned int camera){
+    camera_planes->SetFrame(camera,image_msg->header.frame_id);
+    streamImage(image_msg,camera_planes->Streamer(camera));
+}
 
-            }
+/*!
+ * \brief cameraInfoCallback
+ *
+ * The intrinsics that shape the camera's plane, from the camera_info next to its image topic.
+ *
+ * \param info_msg
+ * \param camera   index into camera_topics
+ */
+void cameraInfoCallback(const sensor_msgs::CameraInfo::ConstPtr& info_msg, unsigned int camera){
+    ROS_INFO_ONCE("Received CameraInfo Message");
+    camera_planes->SetInfo(camera,info_msg);
+}
 
-        }
-        catch (cv_bridge::Exception& error)
-        {
-            ROS_ERROR("cv_bridge exception: %s", error.what());
-            received_image=false;
-        }
-    }
+/*!
+ * \brief compressedImageCallback
+ *
+ * Only used with the image_transport param set to compressed. The decoding happens on
+ * image_decoder's thread, so this just hands the message over.
+ *
+ * \param compressed_image_msg
+ */
+void compressedImageCallback(const sensor_msgs::CompressedImage::ConstPtr& compressed_image_msg){
+    ROS_INFO_ONCE("Got a %s compressed image",compressed_image_msg->format.c_str());
+    image_decoder.Submit(compressed_image_msg);
+}
 
-    /// We have new data, so trigger a scene update
-    scene_update_needed=true;
+/*!
+ * \brief videoPacketCallback
+ *
+ * Only used with the image_transport param set to video. Each message is an H.264 or H.265
+ * frame, which video_decoder decodes and shows at its header stamp.
+ *
+ * \param packet_msg
+ */
+void videoPacketCallback(const sensor_msgs::CompressedImage::ConstPtr& packet_msg){
+    ROS_INFO_ONCE("Got a %s video packet",packet_msg->format.c_str());
+    video_decoder.Submit(packet_msg);
 }
 
 #ifndef USE_VULKAN
@@ -1434,25 +2014,10 @@ void rawImageCallback(const sensor_msgs::Image::ConstPtr& raw_image_msg){
  */
 bool loadModel(std::string mod_url,std::string name,Matrix4 trans,Vector3 scale)
 {
-    if (mod_url.find("package://") == 0)
+    mod_url = AssetCache::ResolvePath(mod_url);
+    if (mod_url.empty())
     {
-        mod_url.erase(0, strlen("package://"));
-        size_t pos = mod_url.find("/");
-        if (pos == std::string::npos)
-        {
-            ROS_ERROR("Could not parse package:// format into file:// format");
-        }
-
-        std::string package = mod_url.substr(0, pos);
-        mod_url.erase(0, pos);
-        std::string package_path = ros::package::getPath(package);
-
-        if (package_path.empty())
-        {
-            ROS_ERROR("Package [%s] does not exist",package.c_str());
-        }
-
-        mod_url = package_path + mod_url;
+        return false;
     }
 
     Mesh* myMesh = new Mesh;
@@ -1461,47 +2026,7 @@ bool loadModel(std::string mod_url,std::string name,Matrix4 trans,Vector3 scale)
     myMesh->scale=scale;
     myMesh->trans=trans;
     myMesh->fallback_texture_filename=fallback_texture_filename;
-
-    bool verbose=false;
-
-    /// Assimp doesn't load the 'units' attribute of Collada files
-    /// https://github.com/assimp/assimp/issues/165
-    /// According to someone on the internet it should be "4 lines of code" to extract it with BOOST.
-    /// Unfortunately, it took me signficantly more lines than that...
-    /// https://github.com/assimp/assimp/issues/165#issuecomment-47468897
-    if(mod_url.substr(mod_url.length()-4,4)==".dae"){
-
-        boost::property_tree::ptree pt;
-        boost::property_tree::xml_parser::read_xml(mod_url, pt );
-
-        boost::property_tree::ptree collada=pt.get_child("COLLADA");
-        boost::property_tree::ptree asset=collada.get_child("asset");
-
-        if( asset.count("up_axis") != 0 ){
-            std::string up_axis_str=asset.get<std::string>("up_axis");
-            if(up_axis_str=="Z_UP"){
-                ROS_INFO_COND(verbose,"Found Z_UP attribute, compensating");
-                myMesh->Z_UP=true;
-            }else if(up_axis_str=="Y_UP"){
-                ROS_INFO_COND(verbose,"Found Y_UP attribute, proceeding as normal");
-            }else{
-                ROS_WARN("up_axis unexpected! up_axis=%s",up_axis_str.c_str());
-            }
-        }else{
-            ROS_INFO_COND(verbose,"up_axis normal");
-        }
-
-        if( asset.count("unit") != 0 ){
-            float meter=asset.get<float>("unit.<xmlattr>.meter");
-//            myMesh->scale.x*=meter;
-//            myMesh->scale.y*=meter;
-//            myMesh->scale.z*=meter;
-            ROS_INFO_COND(verbose,"Found units, 1 unit=%f meters.  Sx=%f,Sy=%f,Sz=%f",meter,myMesh->scale.x,myMesh->scale.y,myMesh->scale.z);
-        }else{
-            //ROS_WARN("no units found");
-        }
-    }
-
+    myMesh->Z_UP=AssetCache::ColladaZUp(mod_url);
 
     if(myMesh->LoadMesh(mod_url)){
         ROS_INFO("Loaded %s's mesh:%s",name.c_str(),mod_url.c_str());
@@ -1663,9 +2188,78 @@ int main(int argc, char *argv[])
     nh = new ros::NodeHandle("~");
 
 
-    ros::Subscriber sub_markers = nh->subscribe("/markers", 1, markers_Callback);
-    ros::Subscriber sub_image = nh->subscribe("/rgb/image_raw", 1, rawImageCallback);
+    /// Any number of marker topics, each with its own set of markers
+    std::vector<std::string> marker_array_topics(1,"/markers");
+    std::vector<std::string> single_marker_topics;
+    nh->getParam("marker_array_topics", marker_array_topics);
+    nh->getParam("marker_topics", single_marker_topics);
+    for(int idx=0;idx<marker_array_topics.size()+single_marker_topics.size();idx++){
+        MarkerTopic* topic = new MarkerTopic;
+        if(idx<marker_array_topics.size()){
+            topic->name=marker_array_topics[idx];
+            topic->sub=nh->subscribe<visualization_msgs::MarkerArray>(topic->name, 1, boost::bind(markers_Callback,_1,topic));
+        }else{
+            topic->name=single_marker_topics[idx-marker_array_topics.size()];
+            /// Single markers tend to come in bursts, so keep a few around
+            topic->sub=nh->subscribe<visualization_msgs::Marker>(topic->name, 100, boost::bind(marker_Callback,_1,topic));
+        }
+        marker_topics.push_back(topic);
+    }
+    nh->getParam("image_transport", image_transport_name);
+    nh->getParam("video_source", video_source);
+    nh->getParam("video_loop", video_loop);
+
+    /// Images from camera_topics are drawn in the world, in front of their cameras, each with the camera_info next to it
+    std::vector<std::string> camera_topics;
+    nh->getParam("camera_topics", camera_topics);
+    nh->getParam("camera_plane_distance", camera_plane_distance);
+    nh->getParam("camera_texture_size", camera_texture_size);
+    std::vector<image_transport::Subscriber> sub_camera_images;
+    std::vector<ros::Subscriber> sub_camera_infos;
+    if(!camera_topics.empty()){
+        camera_planes = new CameraPlanes("camera_planes", camera_topics.size(), std::max(camera_texture_size,0), std::max(camera_texture_size,0), camera_plane_distance);
+        /// These go through image_transport's plugins, video packets are only for the overlay
+        std::string transport=(image_transport_name=="video")?"raw":image_transport_name;
+        image_transport::ImageTransport it(*nh);
+        for(unsigned int idx=0;idx<camera_topics.size();idx++){
+            sub_camera_images.push_back(it.subscribe(camera_topics[idx], 1, boost::bind(cameraImageCallback,_1,idx), ros::VoidPtr(), image_transport::TransportHints(transport)));
+            sub_camera_infos.push_back(nh->subscribe<sensor_msgs::CameraInfo>(image_transport::getCameraInfoTopic(nh->resolveName(camera_topics[idx])), 1, boost::bind(cameraInfoCallback,_1,idx)));
+        }
+    }
+
+    /// Compressed images skip image_transport's plugin, so they can be decoded off the spinner thread
+    ros::Subscriber sub_image;
+    image_transport::Subscriber sub_image_transport;
+    if(!video_source.empty()){
+        video_decoder.Start(&image_streamer, video_source, video_loop);
+    }else if(!camera_topics.empty()){
+        /// The cameras are in the world instead of on the overlay
+    }else if(image_transport_name=="compressed"){
+        image_decoder.Start(&image_streamer);
+        sub_image = nh->subscribe(nh->resolveName("/rgb/image_raw")+"/compressed", 1, compressedImageCallback);
+    }else if(image_transport_name=="video"){
+        /// Every packet is needed to decode the ones after it, so keep plenty
+        if(video_decoder.Start(&image_streamer)){
+            sub_image = nh->subscribe(nh->resolveName("/rgb/image_raw")+"/video", 100, videoPacketCallback);
+        }
+    }else{
+        image_transport::ImageTransport it(*nh);
+        sub_image_transport = it.subscribe("/rgb/image_raw", 1, rawImageCallback, ros::VoidPtr(), image_transport::TransportHints(image_transport_name));
+    }
     ros::Subscriber sub_cloud = nh->subscribe("/cloud", 1, pointCloudCallback);
+    ros::Subscriber sub_poses = nh->subscribe("/pose_array", 1, poseArrayCallback);
+    ros::Subscriber sub_path = nh->subscribe("/path", 1, pathCallback);
+    ros::Subscriber sub_odom = nh->subscribe("/odom", 100, odomCallback);
+    ros::Subscriber sub_map = nh->subscribe("/map", 1, mapCallback);
+    ros::Subscriber sub_map_updates = nh->subscribe("/map_updates", 100, mapUpdateCallback);
+    ros::Subscriber sub_costmap = nh->subscribe("/costmap", 1, costmapCallback);
+    ros::Subscriber sub_costmap_updates = nh->subscribe("/costmap_updates", 100, costmapUpdateCallback);
+#ifdef HAVE_GRID_MAP
+    ros::Subscriber sub_grid_map = nh->subscribe("/grid_map", 1, gridMapCallback);
+#endif
+#ifdef HAVE_OCTOMAP
+    ros::Subscriber sub_octomap = nh->subscribe("/octomap", 1, octomapCallback);
+#endif
     ros::Subscriber sub_lock = nh->subscribe("/lock", 1, lockCallback);
     ros::Subscriber sub_show = nh->subscribe("/show", 1, showCallback);
 
@@ -1691,10 +2285,12 @@ int main(int argc, char *argv[])
     nh->getParam("hud_dist", hud_dist);
     nh->getParam("hud_size", hud_size);
     nh->getParam("point_size", point_size);
+    nh->getParam("line_width", line_width);
     nh->getParam("load_robot", load_robot);
     nh->getParam("show_tf", show_tf);
     nh->getParam("show_grid", show_grid);
     nh->getParam("show_movement", show_movement);
+    nh->getParam("hud_text", hud_text);
     nh->getParam("sbs_image", sbs_image);
 
     /// These params are probably not going to be changed, but are here just in case
@@ -1702,11 +2298,24 @@ int main(int argc, char *argv[])
     nh->getParam("texture_filename", texture_filename);
     nh->getParam("fallback_texture_filename", fallback_texture_filename);
     nh->getParam("texture_character_map", texture_character_map);
+    nh->getParam("text_atlas_filename", text_atlas_filename);
     nh->getParam("base_frame", base_frame);
     nh->getParam("intermediate_frame", intermediate_frame);
     nh->getParam("frame_prefix", frame_prefix);
     nh->getParam("intensity_max", intensity_max);
-    nh->getParam("manual_image_copy", manual_image_copy);
+    nh->getParam("stream_chunk_triangles", stream_chunk_triangles);
+    nh->getParam("stream_upload_budget_kb", stream_upload_budget_kb);
+    nh->getParam("marker_update_budget", marker_update_budget);
+    nh->getParam("pose_array_arrow_length", pose_array_arrow_length);
+    nh->getParam("trajectory_max_points", trajectory_max_points);
+    nh->getParam("trajectory_width", trajectory_width);
+    nh->getParam("odom_min_distance", odom_min_distance);
+    nh->getParam("map_alpha", map_alpha);
+    nh->getParam("costmap_height", costmap_height);
+    nh->getParam("grid_map_layer", grid_map_layer);
+    nh->getParam("octomap_min_z", octomap_min_z);
+    nh->getParam("octomap_max_z", octomap_max_z);
+    nh->getParam("camera_plane_alpha", camera_plane_alpha);
 
     /// Default to 720p companion window
     int window_width=1280;
@@ -1719,6 +2328,10 @@ int main(int argc, char *argv[])
     /// A value <1.0 would be for large scenes, and a value >1.0 would be for small scenes
     pVRVizApplication->setScale(scaling_factor);
     pVRVizApplication->setPointSize(point_size);
+    pVRVizApplication->setLineWidth(line_width);
+    pVRVizApplication->setHudText(hud_text);
+    pVRVizApplication->setMapAlpha(map_alpha);
+    pVRVizApplication->setCameraPlaneAlpha(camera_plane_alpha);
     pVRVizApplication->setTextPath(vrviz_include_path + texture_filename);
     pVRVizApplication->setActionManifestPath(vrviz_include_path + "/vrviz_actions.json");
     pVRVizApplication->setCompanionResolution(window_width,window_height);
@@ -1732,6 +2345,20 @@ int main(int argc, char *argv[])
     }
     pVRVizApplication->setScale(scaling_factor);
 
+#ifndef USE_VULKAN
+    /// Start this before the spinner, since the marker callback hands work to it
+    mesh_streamer.Start(std::max(stream_chunk_triangles,1),std::max(stream_upload_budget_kb,1)*1024);
+    if(camera_planes){
+        camera_planes->mesh->frame_id=base_frame;
+        pVRVizApplication->robot_meshes.push_back(camera_planes->mesh);
+    }
+#ifdef HAVE_OCTOMAP
+    /// Before the spinner too, the octomap callback decodes into it
+    octomap_voxels = new OctomapVoxels("octomap");
+    pVRVizApplication->robot_meshes.push_back(octomap_voxels->mesh);
+#endif
+#endif
+
     /// We spawn a spinner to look for callbacks
     ros::AsyncSpinner spinner(1); // Use 1 threads
     spinner.start();
@@ -1747,6 +2374,31 @@ int main(int argc, char *argv[])
     pVRVizApplication->RunMainLoop();
 
     /// Cleanup
+#ifndef USE_VULKAN
+    mesh_streamer.Stop();
+    /// Waits for a callback that is writing an image to finish, then there won't be any more
+    sub_image.shutdown();
+    sub_image_transport.shutdown();
+    image_decoder.Stop();
+    if(image_decoder.Dropped()>0){
+        ROS_INFO("%lu compressed images were replaced before they could be decoded",image_decoder.Dropped());
+    }
+    video_decoder.Stop();
+    if(video_decoder.Decoded()>0 || video_decoder.Dropped()>0){
+        ROS_INFO("Decoded %lu video frames, dropped %lu packets the decoder fell behind on",video_decoder.Decoded(),video_decoder.Dropped());
+    }
+    if(image_streamer.Written()>0){
+        ROS_INFO("%lu of %lu images were replaced before they could be shown",image_streamer.Dropped(),image_streamer.Written());
+    }
+    image_streamer.Release();
+    for(unsigned int idx=0;idx<sub_camera_images.size();idx++){
+        sub_camera_images[idx].shutdown();
+        sub_camera_infos[idx].shutdown();
+    }
+    if(camera_planes){
+        camera_planes->Release();
+    }
+#endif
     pVRVizApplication->Shutdown();
 
 	return 0;